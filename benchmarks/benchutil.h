@@ -0,0 +1,134 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/**
+ * @file   benchutil.h
+ * @brief  Helpers shared by the benchmark drivers.
+ *
+ * Every driver runs one named heap composition per process, picked
+ * from a table of Composition entries by findComposition; the
+ * fragmentation benchmarks also share an RSS reader and a
+ * reproducible PRNG.
+ */
+
+#ifndef HL_BENCHUTIL_H
+#define HL_BENCHUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "threads/cpuinfo.h"
+
+/// Read the resident set size (in bytes) of this process.
+inline size_t residentBytes() {
+  char buf[4096];
+  FILE * f = fopen ("/proc/self/smaps_rollup", "r");
+  if (f != NULL) {
+    size_t rss = 0;
+    while (fgets (buf, sizeof(buf), f)) {
+      if (strncmp (buf, "Rss:", 4) == 0) {
+	rss = strtoul (buf + 4, NULL, 10) * 1024;
+	break;
+      }
+    }
+    fclose (f);
+    return rss;
+  }
+  // Older kernels: fall back to statm (in pages).
+  f = fopen ("/proc/self/statm", "r");
+  if (f == NULL) {
+    return 0;
+  }
+  unsigned long size = 0, resident = 0;
+  if (fscanf (f, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose (f);
+  return resident * HL::CPUInfo::PageSize;
+}
+
+
+/// A small, deterministic PRNG (xorshift), so every run is reproducible.
+class Random {
+public:
+  Random (unsigned long seed)
+    : _state (seed ? seed : 88172645463325252UL)
+  {}
+  inline unsigned long next() {
+    _state ^= _state << 13;
+    _state ^= _state >> 7;
+    _state ^= _state << 17;
+    return _state;
+  }
+  inline size_t range (size_t lo, size_t hi) {
+    return lo + next() % (hi - lo + 1);
+  }
+private:
+  unsigned long _state;
+};
+
+
+/// A named heap composition and the driver instantiated for it.
+template <class RunFunction>
+class Composition {
+public:
+  const char * name;
+  RunFunction run;
+};
+
+/**
+ * Look up the composition named by argv[1].
+ *
+ * @param required  the number of mandatory arguments, the composition included.
+ * @param usage     the arguments, as shown in the usage message.
+ * @return the composition, or NULL (after printing the usage and the
+ *         known compositions) if an argument is missing or the name is unknown.
+ */
+template <class RunFunction, int N>
+const Composition<RunFunction> *
+findComposition (const Composition<RunFunction> (&compositions)[N],
+		 int argc, char * argv[],
+		 int required, const char * usage)
+{
+  if (argc > required) {
+    for (int i = 0; i < N; i++) {
+      if (strcmp (argv[1], compositions[i].name) == 0) {
+	return &compositions[i];
+      }
+    }
+    fprintf (stderr, "Unknown composition: %s\n", argv[1]);
+  }
+  fprintf (stderr, "Usage: %s %s\n", argv[0], usage);
+  fprintf (stderr, "Compositions:");
+  for (int i = 0; i < N; i++) {
+    fprintf (stderr, " %s", compositions[i].name);
+  }
+  fprintf (stderr, "\n");
+  return NULL;
+}
+
+#endif
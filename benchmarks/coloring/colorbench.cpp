@@ -0,0 +1,229 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   colorbench.cpp
+ * @brief  Shows the cache-set conflicts of page-aligned placement, with and without ColorHeap.
+ *
+ * Usage: colorbench <composition> <workload> [buffers] [iterations]
+ *
+ * Workloads:
+ *   columns  sums column j of a matrix whose rows are separate 64K allocations
+ *   rings    moves data through ring buffers (16K each) in lockstep
+ *   chunks   touches the first object of many zone chunks
+ *
+ * All three touch the same offset of many page-aligned blocks at
+ * once. Without coloring, those addresses map to one cache set and
+ * miss once the blocks outnumber the ways. The benchmark reports the
+ * number of distinct L1 sets (64-byte lines, 64 sets) among the block
+ * starts and the time per access.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "heaplayers.h"
+#include "../benchutil.h"
+
+using namespace HL;
+
+
+// The compositions under test.
+
+class PlainComposition :
+  public ANSIWrapper<SizeHeap<MmapHeap> > {};
+
+class ColoredComposition :
+  public ANSIWrapper<SizeHeap<ColorHeap<MmapHeap> > > {};
+
+class MallocComposition :
+  public MallocHeap {};
+
+/// Zone chunks straight from mmap, or colored. Both chunk sizes
+/// leave room for the arena header (and the color) within 16 pages.
+class PlainZone : public ZoneHeap<MmapHeap, 65536 - 64> {};
+class ColoredZone : public ZoneHeap<ColorHeap<MmapHeap>, 65536 - 4096> {};
+
+
+/// Count the distinct L1 sets (64 sets of 64-byte lines) that the pointers fall in.
+static int distinctSets (const std::vector<char *>& ptrs) {
+  bool used[64] = { false };
+  int n = 0;
+  for (size_t i = 0; i < ptrs.size(); i++) {
+    int set = (int) (((size_t) ptrs[i] >> 6) & 63);
+    if (!used[set]) {
+      used[set] = true;
+      n++;
+    }
+  }
+  return n;
+}
+
+static void report (const char * name, const char * workload,
+		    const std::vector<char *>& ptrs, double elapsed,
+		    double accesses, double checksum)
+{
+  printf ("%s\t%s\tblocks %lu\tdistinct-sets %d\tns/access %.3f\t(checksum %g)\n",
+	  name, workload, (unsigned long) ptrs.size(), distinctSets (ptrs),
+	  elapsed * 1e9 / accesses, checksum);
+}
+
+
+template <class TheHeap>
+static void columns (const char * name, int buffers, int iterations) {
+  static char heapBuf[sizeof(TheHeap)];
+  TheHeap * heap = new (heapBuf) TheHeap;
+  const int rowLength = 65536 / sizeof(double);
+  std::vector<char *> rows;
+  for (int i = 0; i < buffers; i++) {
+    double * row = (double *) heap->malloc (rowLength * sizeof(double));
+    for (int j = 0; j < rowLength; j++) {
+      row[j] = i + j;
+    }
+    rows.push_back ((char *) row);
+  }
+  double sum = 0.0;
+  Timer t;
+  t.start();
+  for (int it = 0; it < iterations; it++) {
+    for (int j = 0; j < rowLength; j++) {
+      for (int i = 0; i < buffers; i++) {
+	sum += ((double *) rows[i])[j];
+      }
+    }
+  }
+  t.stop();
+  report (name, "columns", rows, (double) t, (double) iterations * rowLength * buffers, sum);
+  for (size_t i = 0; i < rows.size(); i++) {
+    heap->free (rows[i]);
+  }
+}
+
+
+template <class TheHeap>
+static void rings (const char * name, int buffers, int iterations) {
+  static char heapBuf[sizeof(TheHeap)];
+  TheHeap * heap = new (heapBuf) TheHeap;
+  const int ringLength = 16384 / sizeof(long);
+  std::vector<char *> ring;
+  for (int i = 0; i < buffers; i++) {
+    long * r = (long *) heap->malloc (ringLength * sizeof(long));
+    memset (r, 0, ringLength * sizeof(long));
+    ring.push_back ((char *) r);
+  }
+  long checksum = 0;
+  Timer t;
+  t.start();
+  for (int it = 0; it < iterations; it++) {
+    for (int pos = 0; pos < ringLength; pos++) {
+      // Each stage consumes from its ring and produces into the next.
+      long v = it + pos;
+      for (int i = 0; i < buffers; i++) {
+	long * r = (long *) ring[i];
+	long old = r[pos];
+	r[pos] = v;
+	v = old + 1;
+      }
+      checksum += v;
+    }
+  }
+  t.stop();
+  report (name, "rings", ring, (double) t, (double) iterations * ringLength * buffers, (double) checksum);
+  for (size_t i = 0; i < ring.size(); i++) {
+    heap->free (ring[i]);
+  }
+}
+
+
+template <class TheZone>
+static void chunks (const char * name, int buffers, int iterations) {
+  // One zone per chunk, as a per-size-class or per-thread heap would have.
+  std::vector<TheZone *> zones;
+  std::vector<char *> first;
+  for (int i = 0; i < buffers; i++) {
+    TheZone * z = new TheZone;
+    long * obj = (long *) z->malloc (64);
+    memset (obj, 0, 64);
+    zones.push_back (z);
+    first.push_back ((char *) obj);
+  }
+  long checksum = 0;
+  Timer t;
+  t.start();
+  for (int it = 0; it < iterations * 1000; it++) {
+    for (int i = 0; i < buffers; i++) {
+      long * obj = (long *) first[i];
+      obj[it & 7]++;
+      checksum += obj[0];
+    }
+  }
+  t.stop();
+  report (name, "chunks", first, (double) t, (double) iterations * 1000 * buffers, (double) checksum);
+  for (size_t i = 0; i < zones.size(); i++) {
+    delete zones[i];
+  }
+}
+
+
+template <class TheHeap, class TheZone>
+static int run (const char * name, const char * workload, int buffers, int iterations) {
+  if (strcmp (workload, "columns") == 0) {
+    columns<TheHeap> (name, buffers, iterations);
+  } else if (strcmp (workload, "rings") == 0) {
+    rings<TheHeap> (name, buffers, iterations);
+  } else if (strcmp (workload, "chunks") == 0) {
+    chunks<TheZone> (name, buffers, iterations);
+  } else {
+    fprintf (stderr, "Unknown workload: %s\n", workload);
+    return 1;
+  }
+  return 0;
+}
+
+
+typedef int (*RunFunction) (const char *, const char *, int, int);
+
+static const Composition<RunFunction> compositions[] = {
+  { "plain",   run<PlainComposition, PlainZone> },
+  { "colored", run<ColoredComposition, ColoredZone> },
+  { "malloc",  run<MallocComposition, PlainZone> }
+};
+
+int
+main (int argc, char * argv[])
+{
+  const Composition<RunFunction> * composition =
+    findComposition (compositions, argc, argv, 2, "<composition> <columns|rings|chunks> [buffers] [iterations]");
+  if (composition == NULL) {
+    return 1;
+  }
+  int buffers    = (argc > 3) ? atoi (argv[3]) : 32;
+  int iterations = (argc > 4) ? atoi (argv[4]) : 20;
+  return composition->run (composition->name, argv[2], buffers, iterations);
+}
@@ -0,0 +1,194 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   pipeline.cpp
+ * @brief  An async request pipeline whose coroutine frames come from new or from CoroutineFrameHeap.
+ *
+ * Usage: pipeline <new|frameheap> [requests] [inflight]
+ *
+ * Each request runs a chain of coroutines (parse, then lookup, then
+ * two storage reads, then format), every one of which suspends on a
+ * run queue, so the given number of requests are in flight at once
+ * and their frames are freed in interleaved order. Reports the time
+ * per request. Requires C++20.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <utility>
+
+#include "heaplayers.h"
+
+using namespace HL;
+
+/// The run queue that suspended coroutines wait on.
+static std::deque<std::coroutine_handle<> > runQueue;
+
+class Yield {
+public:
+  bool await_ready() const { return false; }
+  void await_suspend (std::coroutine_handle<> h) { runQueue.push_back (h); }
+  void await_resume() const {}
+};
+
+/// Where frames come from: global new, or a CoroutineFrameHeap.
+class DefaultAllocation {};
+class FrameHeapAllocation : public CoroutineFrameAllocation<> {};
+
+/// A lazily started task that resumes its awaiter when it finishes.
+template <class Allocation>
+class Task {
+public:
+
+  class promise_type : public Allocation {
+  public:
+    Task get_return_object() {
+      return Task (std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+    std::suspend_always initial_suspend() { return std::suspend_always(); }
+    class FinalAwaiter {
+    public:
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend (std::coroutine_handle<promise_type> h) noexcept {
+	std::coroutine_handle<> next = h.promise().continuation;
+	return next ? next : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return FinalAwaiter(); }
+    void return_value (long v) { value = v; }
+    void unhandled_exception() { abort(); }
+    std::coroutine_handle<> continuation;
+    long value = 0;
+  };
+
+  explicit Task (std::coroutine_handle<promise_type> h) : _h (h) {}
+  Task (Task&& t) : _h (std::exchange (t._h, nullptr)) {}
+  ~Task() {
+    if (_h) {
+      _h.destroy();
+    }
+  }
+
+  bool await_ready() const { return false; }
+  std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaiter) {
+    _h.promise().continuation = awaiter;
+    return _h;
+  }
+  long await_resume() { return _h.promise().value; }
+
+  std::coroutine_handle<promise_type> handle() const { return _h; }
+  bool done() const { return _h.done(); }
+  long value() const { return _h.promise().value; }
+
+private:
+  std::coroutine_handle<promise_type> _h;
+};
+
+template <class A>
+Task<A> storageRead (long key) {
+  char block[256];
+  memset (block, (int) key, sizeof(block));
+  co_await Yield();
+  co_return key + block[17];
+}
+
+template <class A>
+Task<A> lookup (long key) {
+  long a = co_await storageRead<A> (key);
+  long b = co_await storageRead<A> (key * 31);
+  co_return a ^ b;
+}
+
+template <class A>
+Task<A> format (long v) {
+  char out[64];
+  co_await Yield();
+  co_return snprintf (out, sizeof(out), "%ld", v);
+}
+
+template <class A>
+Task<A> handleRequest (long id) {
+  co_await Yield();
+  long key = id * 2654435761L;
+  long v = co_await lookup<A> (key);
+  co_return co_await format<A> (v);
+}
+
+template <class A>
+static double run (long requests, int inflight, long& checksum) {
+  std::deque<Task<A> > active;
+  long next = 0;
+  checksum = 0;
+  std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+  while ((next < requests) || !active.empty()) {
+    while ((next < requests) && ((int) active.size() < inflight)) {
+      active.push_back (handleRequest<A> (next++));
+      runQueue.push_back (active.back().handle());
+    }
+    while (!runQueue.empty()) {
+      std::coroutine_handle<> h = runQueue.front();
+      runQueue.pop_front();
+      h.resume();
+      while (!active.empty() && active.front().done()) {
+	checksum += active.front().value();
+	active.pop_front();
+      }
+      if ((next < requests) && ((int) active.size() < inflight)) {
+	break;
+      }
+    }
+  }
+  return std::chrono::duration<double> (std::chrono::steady_clock::now() - t).count();
+}
+
+int main (int argc, char * argv[]) {
+  if (argc < 2) {
+    fprintf (stderr, "Usage: %s <new|frameheap> [requests] [inflight]\n", argv[0]);
+    return 1;
+  }
+  const long requests = (argc > 2) ? atol (argv[2]) : 2000000;
+  const int inflight = (argc > 3) ? atoi (argv[3]) : 64;
+  long checksum;
+  double elapsed;
+  if (strcmp (argv[1], "new") == 0) {
+    elapsed = run<DefaultAllocation> (requests, inflight, checksum);
+  } else if (strcmp (argv[1], "frameheap") == 0) {
+    elapsed = run<FrameHeapAllocation> (requests, inflight, checksum);
+  } else {
+    fprintf (stderr, "Unknown allocator %s\n", argv[1]);
+    return 1;
+  }
+  printf ("%s: %.1f ns per request (%d in flight, checksum %ld)\n",
+	  argv[1], elapsed * 1e9 / requests, inflight, checksum);
+  return 0;
+}
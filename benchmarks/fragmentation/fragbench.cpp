@@ -0,0 +1,260 @@
+/* -*- C++ -*- */
+
+/*
+ * @file   fragbench.cpp
+ * @brief  Long-running fragmentation benchmark: tracks RSS against live bytes over time.
+ * @author Emery Berger <http://www.cs.umass.edu/~emery>
+ *
+ * Runs a phase-changing workload (small-object churn, drains that
+ * leave scattered survivors, large-object churn) for a fixed number
+ * of operations against one heap composition, and periodically
+ * samples the live requested bytes reported by the heap against the
+ * resident set size from /proc/self/smaps_rollup. At every phase
+ * change it trims the heaps registered with the HeapRegistry (only
+ * the trimmable composition registers one), as a scavenger would.
+ *
+ * Usage: fragbench <composition> [operations] [samples]
+ *
+ * Run one composition per process, so that memory retained by one
+ * heap does not pollute the RSS of the next.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heaplayers.h"
+#include "../benchutil.h"
+
+using namespace HL;
+
+/**
+ * @class LiveBytesHeap
+ * @brief Tracks the number of requested bytes currently live.
+ *
+ * Unlike InUseHeap, this keeps no side map (whose nodes would
+ * inflate the very RSS we are measuring); the caller supplies the
+ * size on free, as the benchmark driver always knows it.
+ */
+
+template <class SuperHeap>
+class LiveBytesHeap : public SuperHeap {
+public:
+
+  LiveBytesHeap()
+    : _live (0),
+      _maxLive (0)
+  {}
+
+  inline void * malloc (size_t sz) {
+    void * ptr = SuperHeap::malloc (sz);
+    if (ptr != NULL) {
+      _live += sz;
+      if (_live > _maxLive) {
+	_maxLive = _live;
+      }
+    }
+    return ptr;
+  }
+
+  inline void free (void * ptr, size_t sz) {
+    _live -= sz;
+    SuperHeap::free (ptr);
+  }
+
+  size_t getLive() const { return _live; }
+  size_t getMaxLive() const { return _maxLive; }
+
+private:
+  size_t _live;
+  size_t _maxLive;
+};
+
+
+// The compositions under test.
+
+class KingsleyTop : public SizeHeap<UniqueHeap<ZoneHeap<MmapHeap, 65536> > > {};
+
+class KingsleyComposition :
+  public ANSIWrapper<KingsleyHeap<AdaptHeap<DLList, KingsleyTop>, KingsleyTop> > {};
+
+class ZoneComposition :
+  public ANSIWrapper<SizeHeap<ZoneHeap<MmapHeap, 65536> > > {};
+
+/// Immediate coalescing and splitting, in the manner of dlmalloc.
+class TLSFComposition :
+  public ANSIWrapper<TLSFHeap<MmapHeap> > {};
+
+/// Kingsley for small objects, decaying page spans for the rest.
+class PageDecayComposition :
+  public ANSIWrapper<HybridHeap<4096,
+				KingsleyHeap<AdaptHeap<DLList, KingsleyTop>, KingsleyTop>,
+				SizeHeap<PageHeap<MmapHeap, 256, 8 * 1024 * 1024, 100000> > > > {};
+
+/// Kingsley for small objects, hugepage-packed page runs for the rest.
+class HugePageComposition :
+  public ANSIWrapper<HybridHeap<4096,
+				KingsleyHeap<AdaptHeap<DLList, KingsleyTop>, KingsleyTop>,
+				SizeHeap<HugePageAwarePageHeap<> > > > {};
+
+/// Kingsley's free lists over a coalescing heap, emptied at every trim.
+class CoalescingTop : public TLSFHeap<MmapHeap> {};
+
+class TrimmableComposition :
+  public TrimmableHeap<LockedHeap<SpinLockType,
+				  ANSIWrapper<KingsleyHeap<AdaptHeap<DLList, CoalescingTop>, CoalescingTop> > > > {};
+
+class MallocComposition :
+  public MallocHeap {};
+
+
+/// The workload phases, cycled through in order.
+class Phase {
+public:
+  const char * name;
+  size_t minSize;
+  size_t maxSize;
+  /// Percentage of operations that are allocations.
+  int allocPercent;
+  /// For drains: the percentage of objects that survive (0 = not a drain).
+  int keepPercent;
+};
+
+static const Phase phases[] = {
+  { "small-churn", 16,   128,   60, 0  },
+  { "drain",       16,   128,   50, 10 },
+  { "large-churn", 1024, 16384, 60, 0  },
+  { "drain",       1024, 16384, 50, 20 },
+  { "mixed-churn", 16,   4096,  55, 0  },
+  { "drain",       16,   4096,  50, 5  }
+};
+
+enum { NUM_PHASES = sizeof(phases) / sizeof(Phase) };
+
+enum { MAX_LIVE = 1 << 20 };
+
+
+template <class TheHeap>
+static void runFragmentation (const char * name, size_t ops, size_t samples)
+{
+  // Keep the benchmark's own bookkeeping out of the heap under test,
+  // and touch it up front so it is part of the baseline RSS.
+  void ** objects = (void **) MmapWrapper::map (MAX_LIVE * sizeof(void *));
+  size_t * sizes  = (size_t *) MmapWrapper::map (MAX_LIVE * sizeof(size_t));
+  memset (objects, 0, MAX_LIVE * sizeof(void *));
+  memset (sizes, 0, MAX_LIVE * sizeof(size_t));
+
+  static char heapBuf[sizeof(LiveBytesHeap<TheHeap>)];
+  LiveBytesHeap<TheHeap> * heap = new (heapBuf) LiveBytesHeap<TheHeap>;
+
+  const size_t baseline = residentBytes();
+  const size_t sampleEvery = (ops / samples) ? (ops / samples) : 1;
+  const size_t phaseLength = (ops / (2 * NUM_PHASES)) ? (ops / (2 * NUM_PHASES)) : 1;
+
+  Random rng (12345);
+  size_t numLive = 0;
+  size_t maxRss = 0;
+  double maxBlowup = 0.0;
+  double lastBlowup = 0.0;
+  size_t trimmed = 0;
+  int phase = 0;
+  size_t drainTarget = 0;
+
+  printf ("# composition: %s\n", name);
+  printf ("# operations: %lu, baseline rss: %lu\n", (unsigned long) ops, (unsigned long) baseline);
+  printf ("# op\tphase\tlive_bytes\trss_bytes\tblowup\n");
+
+  for (size_t op = 0; op < ops; op++) {
+
+    if (op > 0 && op % phaseLength == 0) {
+      phase = (phase + 1) % NUM_PHASES;
+      drainTarget = numLive * phases[phase].keepPercent / 100;
+      trimmed += HeapRegistry::releaseFreeMemory();
+    }
+    const Phase& p = phases[phase];
+
+    bool allocate;
+    if (numLive == 0) {
+      allocate = true;
+    } else if (numLive >= MAX_LIVE) {
+      allocate = false;
+    } else if (p.keepPercent && numLive > drainTarget) {
+      // Draining: free random objects until only the survivors remain.
+      allocate = false;
+    } else {
+      allocate = ((int) rng.range (0, 99) < p.allocPercent);
+    }
+
+    if (allocate) {
+      size_t sz = rng.range (p.minSize, p.maxSize);
+      void * ptr = heap->malloc (sz);
+      if (ptr != NULL) {
+	// Touch the object, as a real program would.
+	memset (ptr, 0xab, sz);
+	objects[numLive] = ptr;
+	sizes[numLive] = sz;
+	numLive++;
+      }
+    } else {
+      // Free a random victim, leaving holes behind.
+      size_t victim = rng.range (0, numLive - 1);
+      heap->free (objects[victim], sizes[victim]);
+      numLive--;
+      objects[victim] = objects[numLive];
+      sizes[victim] = sizes[numLive];
+    }
+
+    if (op % sampleEvery == sampleEvery - 1) {
+      size_t rss = residentBytes();
+      size_t heapRss = (rss > baseline) ? (rss - baseline) : 0;
+      size_t live = heap->getLive();
+      double blowup = live ? (double) heapRss / (double) live : 0.0;
+      if (heapRss > maxRss) {
+	maxRss = heapRss;
+      }
+      if (blowup > maxBlowup) {
+	maxBlowup = blowup;
+      }
+      lastBlowup = blowup;
+      printf ("%lu\t%s\t%lu\t%lu\t%.3f\n",
+	      (unsigned long) (op + 1), p.name,
+	      (unsigned long) live, (unsigned long) heapRss, blowup);
+    }
+  }
+
+  printf ("# peak live: %lu, peak rss: %lu, peak-rss/peak-live: %.3f, max blowup: %.3f, final blowup: %.3f, trimmed: %lu\n",
+	  (unsigned long) heap->getMaxLive(), (unsigned long) maxRss,
+	  heap->getMaxLive() ? (double) maxRss / (double) heap->getMaxLive() : 0.0,
+	  maxBlowup, lastBlowup, (unsigned long) trimmed);
+}
+
+
+typedef void (*RunFunction) (const char *, size_t, size_t);
+
+static const Composition<RunFunction> compositions[] = {
+  { "kingsley",  runFragmentation<KingsleyComposition> },
+  { "zone",      runFragmentation<ZoneComposition> },
+  { "tlsf",      runFragmentation<TLSFComposition> },
+  { "pagedecay", runFragmentation<PageDecayComposition> },
+  { "hugepage",  runFragmentation<HugePageComposition> },
+  { "trimmable", runFragmentation<TrimmableComposition> },
+  { "malloc",    runFragmentation<MallocComposition> }
+};
+
+int
+main (int argc, char * argv[])
+{
+  const Composition<RunFunction> * composition =
+    findComposition (compositions, argc, argv, 1, "<composition> [operations] [samples]");
+  if (composition == NULL) {
+    return 1;
+  }
+  size_t ops     = (argc > 2) ? strtoul (argv[2], NULL, 10) : 20000000;
+  size_t samples = (argc > 3) ? strtoul (argv[3], NULL, 10) : 100;
+  if (samples == 0) {
+    fprintf (stderr, "The number of samples must be positive.\n");
+    return 1;
+  }
+  composition->run (composition->name, ops, samples);
+  return 0;
+}
@@ -0,0 +1,127 @@
+/* -*- C++ -*- */
+
+/*
+ * @file   meshbench.cpp
+ * @brief  Fragmentation benchmark: RSS after a drain, with and without meshing.
+ *
+ * Allocates many small objects of mixed sizes, frees a random
+ * majority of them (leaving every page sparsely occupied), and
+ * reports the resident set size against the live bytes. For the
+ * meshing composition, it then meshes and reports the RSS again.
+ *
+ * Usage: meshbench <composition> [objects] [keep-percent]
+ *
+ * Run one composition per process, so that memory retained by one
+ * heap does not pollute the RSS of the next.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heaplayers.h"
+#include "../benchutil.h"
+
+using namespace HL;
+
+// The compositions under test.
+
+class KingsleyTop : public SizeHeap<UniqueHeap<ZoneHeap<MmapHeap, 65536> > > {};
+
+class KingsleyComposition :
+  public ANSIWrapper<KingsleyHeap<AdaptHeap<DLList, KingsleyTop>, KingsleyTop> > {
+public:
+  size_t mesh() { return 0; }
+};
+
+class MeshComposition :
+  public ANSIWrapper<MeshingHeap<SizeHeap<MmapHeap> > > {};
+
+class MallocComposition : public MallocHeap {
+public:
+  size_t mesh() { return 0; }
+};
+
+
+template <class TheHeap>
+static void runDrain (const char * name, size_t n, int keepPercent)
+{
+  // Keep the benchmark's own bookkeeping out of the heap under test,
+  // and touch it up front so it is part of the baseline RSS.
+  void ** objects = (void **) MmapWrapper::map (n * sizeof(void *));
+  size_t * sizes  = (size_t *) MmapWrapper::map (n * sizeof(size_t));
+  memset (objects, 0, n * sizeof(void *));
+  memset (sizes, 0, n * sizeof(size_t));
+
+  static char heapBuf[sizeof(TheHeap)];
+  TheHeap * heap = new (heapBuf) TheHeap;
+
+  const size_t baseline = residentBytes();
+  Random rng (12345);
+
+  size_t live = 0;
+  for (size_t i = 0; i < n; i++) {
+    sizes[i] = rng.range (16, 512);
+    objects[i] = heap->malloc (sizes[i]);
+    memset (objects[i], 0xab, sizes[i]);
+    live += sizes[i];
+  }
+  const size_t fullRss = residentBytes() - baseline;
+
+  for (size_t i = 0; i < n; i++) {
+    if ((int) rng.range (0, 99) >= keepPercent) {
+      heap->free (objects[i]);
+      live -= sizes[i];
+      objects[i] = NULL;
+    }
+  }
+  const size_t drainedRss = residentBytes() - baseline;
+
+  const size_t released = heap->mesh();
+  const size_t meshedRss = residentBytes() - baseline;
+
+  // Make sure the survivors are intact.
+  for (size_t i = 0; i < n; i++) {
+    if (objects[i] != NULL) {
+      unsigned char * p = (unsigned char *) objects[i];
+      if ((p[0] != 0xab) || (p[sizes[i] - 1] != 0xab)) {
+	fprintf (stderr, "object %lu corrupted\n", (unsigned long) i);
+	exit (1);
+      }
+    }
+  }
+
+  printf ("# composition: %s, objects: %lu, kept: %d%%\n",
+	  name, (unsigned long) n, keepPercent);
+  printf ("full:    rss %10lu\n", (unsigned long) fullRss);
+  printf ("drained: rss %10lu  live %10lu  blowup %.3f\n",
+	  (unsigned long) drainedRss, (unsigned long) live,
+	  live ? (double) drainedRss / (double) live : 0.0);
+  printf ("meshed:  rss %10lu  live %10lu  blowup %.3f  (%lu pages released)\n",
+	  (unsigned long) meshedRss, (unsigned long) live,
+	  live ? (double) meshedRss / (double) live : 0.0,
+	  (unsigned long) released);
+}
+
+
+typedef void (*RunFunction) (const char *, size_t, int);
+
+static const Composition<RunFunction> compositions[] = {
+  { "kingsley", runDrain<KingsleyComposition> },
+  { "mesh",     runDrain<MeshComposition> },
+  { "malloc",   runDrain<MallocComposition> }
+};
+
+int
+main (int argc, char * argv[])
+{
+  const Composition<RunFunction> * composition =
+    findComposition (compositions, argc, argv, 1, "<composition> [objects] [keep-percent]");
+  if (composition == NULL) {
+    return 1;
+  }
+  size_t n        = (argc > 2) ? strtoul (argv[2], NULL, 10) : 1000000;
+  int keepPercent = (argc > 3) ? atoi (argv[3]) : 10;
+  composition->run (composition->name, n, keepPercent);
+  return 0;
+}
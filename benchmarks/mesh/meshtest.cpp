@@ -0,0 +1,231 @@
+/* -*- C++ -*- */
+
+/*
+ * @file   meshtest.cpp
+ * @brief  Correctness tests for MeshingHeap.
+ *
+ * Fills pages of one size class, frees most objects so that pages
+ * become meshable, meshes, and checks that every surviving object
+ * kept its address and its contents, that the meshed objects can
+ * still be written and freed, that freed slots are reused, and that
+ * threads writing to their objects while the heap meshes underneath
+ * them never lose a write, and that destroyed heaps release their
+ * arenas.
+ *
+ * Usage: meshtest
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "heaplayers.h"
+
+using namespace HL;
+
+typedef MeshingHeap<SizeHeap<MmapHeap>, 1UL << 28> TheHeap;
+
+static int failures = 0;
+
+#define CHECK(cond)							\
+  do {									\
+    if (!(cond)) {							\
+      fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;							\
+    }									\
+  } while (0)
+
+static bool verify (unsigned char * ptr, size_t sz, unsigned char tag) {
+  for (size_t i = 0; i < sz; i++) {
+    if (ptr[i] != tag) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Free all but every keep-th object, mesh, and check the survivors.
+static void testMeshPreservesObjects (size_t sz, int keep) {
+  enum { N = 20000 };
+  TheHeap heap;
+  static unsigned char * objects[N];
+  for (int i = 0; i < N; i++) {
+    objects[i] = (unsigned char *) heap.malloc (sz);
+    CHECK (objects[i] != NULL);
+    memset (objects[i], (unsigned char) i, sz);
+  }
+  for (int i = 0; i < N; i++) {
+    if (i % keep != 0) {
+      heap.free (objects[i]);
+      objects[i] = NULL;
+    }
+  }
+  const size_t before = heap.getPhysicalPages();
+  const size_t released = heap.mesh();
+  CHECK (released > 0);
+  CHECK (heap.getPhysicalPages() == before - released);
+  for (int i = 0; i < N; i++) {
+    if (objects[i] != NULL) {
+      CHECK (verify (objects[i], sz, (unsigned char) i));
+      CHECK (heap.getSize (objects[i]) >= sz);
+      // Meshed objects remain writable.
+      memset (objects[i], (unsigned char) ~i, sz);
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    if (objects[i] != NULL) {
+      CHECK (verify (objects[i], sz, (unsigned char) ~i));
+    }
+  }
+  printf ("size %lu: %lu of %lu pages released\n",
+	  (unsigned long) sz, (unsigned long) released, (unsigned long) before);
+
+  // Freed slots (including those of meshed pages) are reused, and
+  // fresh objects don't disturb the survivors.
+  static unsigned char * fresh[N];
+  for (int i = 0; i < N; i++) {
+    if (objects[i] == NULL) {
+      fresh[i] = (unsigned char *) heap.malloc (sz);
+      CHECK (fresh[i] != NULL);
+      memset (fresh[i], 0x5a, sz);
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    if (objects[i] != NULL) {
+      CHECK (verify (objects[i], sz, (unsigned char) ~i));
+      heap.free (objects[i]);
+    } else {
+      CHECK (verify (fresh[i], sz, 0x5a));
+      heap.free (fresh[i]);
+    }
+  }
+  heap.mesh();
+  // Only the current page of the class remains.
+  CHECK (heap.getPhysicalPages() <= 1);
+}
+
+/// Large objects bypass the arena.
+static void testLargeObjects() {
+  TheHeap heap;
+  void * ptr = heap.malloc (TheHeap::MaxObjectSize + 1);
+  CHECK (ptr != NULL);
+  CHECK (heap.getSize (ptr) >= TheHeap::MaxObjectSize + 1);
+  memset (ptr, 0, TheHeap::MaxObjectSize + 1);
+  heap.free (ptr);
+  CHECK (heap.getPhysicalPages() == 0);
+}
+
+/// The number of open file descriptors.
+static int openFiles() {
+  int n = 0;
+  DIR * d = opendir ("/proc/self/fd");
+  if (d == NULL) {
+    return -1;
+  }
+  while (readdir (d) != NULL) {
+    n++;
+  }
+  closedir (d);
+  return n;
+}
+
+/// Destroyed heaps give back their arena, memory file and barrier slot.
+static void testHeapsReleaseArenas() {
+  const int before = openFiles();
+  for (int i = 0; i < 2 * MeshBarrier::MaxArenas; i++) {
+    TheHeap * heap = new TheHeap;
+    void * ptr = heap->malloc (16);
+    // Still served from an arena rather than the superheap.
+    CHECK (heap->getPhysicalPages() == 1);
+    heap->free (ptr);
+    delete heap;
+  }
+  CHECK (openFiles() == before);
+}
+
+
+enum { WRITERS = 4 };
+enum { PER_WRITER = 4096 };
+
+static TheHeap concurrentHeap;
+static unsigned long * shared[WRITERS][PER_WRITER];
+static std::atomic<bool> done (false);
+static std::atomic<int> errors (0);
+
+static void * writer (void * arg) {
+  const long id = (long) arg;
+  unsigned long round = 0;
+  while (!done.load()) {
+    round++;
+    for (int i = 0; i < PER_WRITER; i++) {
+      if (shared[id][i] != NULL) {
+	shared[id][i][0] = round;
+	shared[id][i][1] = ~round;
+      }
+    }
+    for (int i = 0; i < PER_WRITER; i++) {
+      if (shared[id][i] != NULL) {
+	if ((shared[id][i][0] != round) || (shared[id][i][1] != ~round)) {
+	  errors++;
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+/// Threads keep writing to their objects while the heap meshes.
+static void testConcurrentWrites() {
+  for (int t = 0; t < WRITERS; t++) {
+    for (int i = 0; i < PER_WRITER; i++) {
+      shared[t][i] = (unsigned long *) concurrentHeap.malloc (16);
+    }
+  }
+  // Leave every eighth object of each thread.
+  for (int t = 0; t < WRITERS; t++) {
+    for (int i = 0; i < PER_WRITER; i++) {
+      if (i % 8 != 0) {
+	concurrentHeap.free (shared[t][i]);
+	shared[t][i] = NULL;
+      }
+    }
+  }
+  Fred threads[WRITERS];
+  for (long t = 0; t < WRITERS; t++) {
+    threads[t].create (writer, (void *) t);
+  }
+  concurrentHeap.startMeshing (1);
+  for (int i = 0; i < 200; i++) {
+    usleep (1000);
+  }
+  concurrentHeap.stopMeshing();
+  done = true;
+  for (int t = 0; t < WRITERS; t++) {
+    threads[t].join();
+  }
+  CHECK (concurrentHeap.getMeshes() > 0);
+  CHECK (errors.load() == 0);
+  printf ("concurrent: %lu meshes, %d lost writes\n",
+	  (unsigned long) concurrentHeap.getMeshes(), errors.load());
+}
+
+
+int
+main()
+{
+  testMeshPreservesObjects (16, 16);
+  testMeshPreservesObjects (48, 10);
+  testMeshPreservesObjects (256, 4);
+  testLargeObjects();
+  testHeapsReleaseArenas();
+  testConcurrentWrites();
+  if (failures) {
+    printf ("%d checks failed\n", failures);
+    return 1;
+  }
+  printf ("all tests passed\n");
+  return 0;
+}
@@ -0,0 +1,156 @@
+/* -*- C++ -*- */
+
+/*
+ * @file   pageheaptest.cpp
+ * @brief  Steady-state tests for the page-level heaps.
+ *
+ * Runs long malloc/free churn against HugePageAwarePageHeap and
+ * checks that its address space stops growing once the working set
+ * is established, rather than growing with the number of operations.
+ * Checks that PageHeap's free spans decay even while churn keeps
+ * splitting and re-merging them, and that its count of released bytes
+ * survives coalescing.
+ *
+ * Usage: pageheaptest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heaplayers.h"
+
+using namespace HL;
+
+static int failures = 0;
+
+#define CHECK(cond)							\
+  do {									\
+    if (!(cond)) {							\
+      fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;							\
+    }									\
+  } while (0)
+
+/// The size of this process's address space, in bytes.
+static size_t virtualBytes() {
+  FILE * f = fopen ("/proc/self/statm", "r");
+  if (f == NULL) {
+    return 0;
+  }
+  unsigned long size = 0;
+  if (fscanf (f, "%lu", &size) != 1) {
+    size = 0;
+  }
+  fclose (f);
+  return size * CPUInfo::PageSize;
+}
+
+/// A small, deterministic PRNG (xorshift), so every run is reproducible.
+static unsigned long nextRandom() {
+  static unsigned long state = 88172645463325252UL;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+/// Churn 1-3MB objects over a fixed number of slots; the address space must level off.
+static void testHugePageAwareAddressSpaceIsBounded() {
+  enum { Slots = 50, Cycles = 200000, Warmup = 20000 };
+  typedef HugePageAwarePageHeap<> TheHeap;
+  static char buf[sizeof(TheHeap)];
+  TheHeap * heap = new (buf) TheHeap;
+  void * objects[Slots];
+  memset (objects, 0, sizeof(objects));
+  size_t warm = 0;
+  for (int i = 0; i < Cycles; i++) {
+    const int slot = (int) (nextRandom() % Slots);
+    if (objects[slot] != NULL) {
+      heap->free (objects[slot]);
+    }
+    const size_t sz = (1 << 20) + nextRandom() % (2 << 20);
+    objects[slot] = heap->malloc (sz);
+    CHECK (objects[slot] != NULL);
+    if (objects[slot] == NULL) {
+      break;
+    }
+    // Touch the ends of the object only, to keep the test fast.
+    ((char *) objects[slot])[0] = 1;
+    ((char *) objects[slot])[sz - 1] = 1;
+    if (i == Warmup) {
+      warm = virtualBytes();
+    }
+  }
+  const size_t last = virtualBytes();
+  printf ("HugePageAwarePageHeap: address space %lu MB after warmup, %lu MB after %d cycles\n",
+	  (unsigned long) (warm >> 20), (unsigned long) (last >> 20), (int) Cycles);
+  // At most the cached and retained released hugepages on top of the warm footprint.
+  CHECK (last <= warm + (8 + 64) * 2 * 1024 * 1024);
+  for (int i = 0; i < Slots; i++) {
+    heap->free (objects[i]);
+  }
+}
+
+/// Free spans must decay even though churn splits and re-merges them.
+static void testPageHeapDecaysUnderChurn() {
+  enum { Spans = 100, Cycles = 3000 };
+  typedef PageHeap<MmapHeap, 256, 8 * 1024 * 1024, 1000> TheHeap;
+  static char buf[sizeof(TheHeap)];
+  TheHeap * heap = new (buf) TheHeap;
+  void * spans[Spans];
+  for (int i = 0; i < Spans; i++) {
+    spans[i] = heap->malloc (16 * 4096);
+    memset (spans[i], 1, 16 * 4096);
+  }
+  for (int i = 0; i < Spans; i++) {
+    heap->free (spans[i]);
+  }
+  for (int i = 0; i < Cycles; i++) {
+    void * ptr = heap->malloc (4096);
+    memset (ptr, 1, 4096);
+    heap->free (ptr);
+  }
+  printf ("PageHeap: %lu of %lu free bytes released after churn\n",
+	  (unsigned long) heap->getReleasedBytes(), (unsigned long) heap->getFreeBytes());
+  CHECK (heap->getReleasedBytes() >= Spans * 16 * 4096);
+}
+
+/// Coalescing released spans with backed ones must not lose the released count.
+static void testPageHeapCountsReleasedPages() {
+  enum { Spans = 64 };
+  typedef PageHeap<MmapHeap> TheHeap;
+  static char buf[sizeof(TheHeap)];
+  TheHeap * heap = new (buf) TheHeap;
+  void * spans[Spans];
+  for (int i = 0; i < Spans; i++) {
+    spans[i] = heap->malloc (8 * 4096);
+  }
+  // Free every other span and release those, then free the rest.
+  for (int i = 0; i < Spans; i += 2) {
+    heap->free (spans[i]);
+  }
+  const size_t released = heap->releaseMemory();
+  CHECK (heap->getReleasedBytes() == released);
+  for (int i = 1; i < Spans; i += 2) {
+    heap->free (spans[i]);
+  }
+  // The backed halves merged into released neighbors; the released ones still count.
+  CHECK (heap->getReleasedBytes() == released);
+  CHECK (heap->releaseMemory() == heap->getFreeBytes() - released);
+  CHECK (heap->getReleasedBytes() == heap->getFreeBytes());
+}
+
+int
+main()
+{
+  testHugePageAwareAddressSpaceIsBounded();
+  testPageHeapDecaysUnderChurn();
+  testPageHeapCountsReleasedPages();
+  if (failures == 0) {
+    printf ("All tests passed.\n");
+    return 0;
+  }
+  printf ("%d checks failed.\n", failures);
+  return 1;
+}
@@ -0,0 +1,196 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   rangebench.cpp
+ * @brief  Point lookups and insert/erase of millions of ranges, RangeMap against std::map.
+ *
+ * Usage: rangebench <rangemap|stdmap> [ranges] [lookups] [threads]
+ *
+ * Lays out the given number of page-granular ranges (1-8 pages with
+ * 0-2 page gaps, plus a few 1G ranges above them for RangeMap's
+ * fallback) in a synthetic address space; nothing is mapped. Reports
+ * the time per insert, per lookup (random addresses over the whole
+ * span, so some miss) from each of the reader threads, and per erase.
+ * std::map lookups take a lock, as they would inside an allocator.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "heaplayers.h"
+
+using namespace HL;
+
+static const uintptr_t PageSize = 4096;
+static const uintptr_t Base = (uintptr_t) 1 << 40;
+static const int HugeRanges = 16;
+static const uintptr_t HugeSize = (uintptr_t) 1 << 30;
+
+
+/// The structures under test, with a common interface.
+
+class RangeMapTest {
+public:
+  bool insert (uintptr_t start, size_t len, size_t v) {
+    return _map.insert ((void *) start, len, v);
+  }
+  bool erase (uintptr_t start) {
+    return _map.erase ((void *) start);
+  }
+  size_t find (uintptr_t addr) {
+    return _map.get ((void *) addr);
+  }
+private:
+  RangeMap<size_t> _map;
+};
+
+class StdMapTest {
+public:
+  bool insert (uintptr_t start, size_t len, size_t v) {
+    Guard<SpinLockType> l (_lock);
+    return _map.insert (std::make_pair (start, Entry (len, v))).second;
+  }
+  bool erase (uintptr_t start) {
+    Guard<SpinLockType> l (_lock);
+    return _map.erase (start) == 1;
+  }
+  size_t find (uintptr_t addr) {
+    Guard<SpinLockType> l (_lock);
+    std::map<uintptr_t, Entry>::iterator i = _map.upper_bound (addr);
+    if (i == _map.begin()) {
+      return 0;
+    }
+    --i;
+    return (addr < i->first + i->second.first) ? i->second.second : 0;
+  }
+private:
+  typedef std::pair<size_t, size_t> Entry;
+  SpinLockType _lock;
+  std::map<uintptr_t, Entry> _map;
+};
+
+
+static inline uint64_t nextRandom (uint64_t& state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+static double seconds (std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+}
+
+template <class Map>
+static void lookups (Map * map, uintptr_t end, size_t n, int seed, size_t * hits) {
+  uint64_t state = 0x9e3779b97f4a7c15ULL * (seed + 1);
+  size_t found = 0;
+  for (size_t i = 0; i < n; i++) {
+    const uintptr_t addr = Base + nextRandom (state) % (end - Base);
+    found += (map->find (addr) != 0);
+  }
+  *hits = found;
+}
+
+template <class Map>
+static void run (size_t count, size_t nlookups, int nthreads) {
+  Map * map = new Map;
+  std::vector<uintptr_t> starts (count);
+  uint64_t state = 12345;
+  uintptr_t addr = Base;
+  for (size_t i = 0; i < count; i++) {
+    addr += (nextRandom (state) % 3) * PageSize;
+    starts[i] = addr;
+    addr += (1 + nextRandom (state) % 8) * PageSize;
+  }
+  const uintptr_t end = addr;
+
+  std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++) {
+    const size_t len = ((i + 1 < count) ? starts[i + 1] : end) - starts[i];
+    if (!map->insert (starts[i], len - (len > PageSize ? PageSize : 0), i + 1)) {
+      fprintf (stderr, "insert %zu failed\n", i);
+      exit (1);
+    }
+  }
+  for (int i = 0; i < HugeRanges; i++) {
+    map->insert (end + (2 * i + 1) * HugeSize, HugeSize, count + i + 1);
+  }
+  printf ("insert: %6.1f ns\n", seconds (t) * 1e9 / (count + HugeRanges));
+
+  t = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  std::vector<size_t> hits (nthreads);
+  for (int i = 0; i < nthreads; i++) {
+    threads.push_back (std::thread (lookups<Map>, map, end + 2 * HugeRanges * HugeSize,
+				    nlookups, i, &hits[i]));
+  }
+  size_t totalHits = 0;
+  for (int i = 0; i < nthreads; i++) {
+    threads[i].join();
+    totalHits += hits[i];
+  }
+  printf ("lookup: %6.1f ns per thread (%d threads, %.0f%% hits)\n",
+	  seconds (t) * 1e9 / nlookups, nthreads,
+	  100.0 * totalHits / ((double) nlookups * nthreads));
+
+  t = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++) {
+    map->erase (starts[i]);
+  }
+  for (int i = 0; i < HugeRanges; i++) {
+    map->erase (end + (2 * i + 1) * HugeSize);
+  }
+  printf ("erase:  %6.1f ns\n", seconds (t) * 1e9 / (count + HugeRanges));
+  delete map;
+}
+
+int main (int argc, char * argv[]) {
+  if (argc < 2) {
+    fprintf (stderr, "Usage: %s <rangemap|stdmap> [ranges] [lookups] [threads]\n", argv[0]);
+    return 1;
+  }
+  const size_t count = (argc > 2) ? strtoul (argv[2], NULL, 10) : 4000000;
+  const size_t nlookups = (argc > 3) ? strtoul (argv[3], NULL, 10) : 10000000;
+  const int nthreads = (argc > 4) ? atoi (argv[4]) : 1;
+  printf ("%s: %zu ranges\n", argv[1], count);
+  if (strcmp (argv[1], "rangemap") == 0) {
+    run<RangeMapTest> (count, nlookups, nthreads);
+  } else if (strcmp (argv[1], "stdmap") == 0) {
+    run<StdMapTest> (count, nlookups, nthreads);
+  } else {
+    fprintf (stderr, "Unknown structure %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
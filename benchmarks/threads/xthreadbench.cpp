@@ -0,0 +1,505 @@
+/* -*- C++ -*- */
+
+/*
+ * @file   xthreadbench.cpp
+ * @brief  Cross-thread producer/consumer and false-sharing benchmarks for thread heaps.
+ *
+ * The thread-heap layers differ mainly in where memory freed by a
+ * thread other than its allocator ends up, and in whether objects
+ * handed to different threads share cache lines. Three benchmarks
+ * exercise exactly that:
+ *
+ *   pipeline  N producers allocate messages and hand them through a
+ *             bounded queue to M consumers, which free them (plus
+ *             some thread-local scratch churn on both sides, which
+ *             is freed by the thread that allocated it).
+ *   active    Active false sharing: every thread repeatedly
+ *             allocates a small object, writes it, and frees it.
+ *   passive   Passive false sharing: the main thread allocates one
+ *             small object per thread and hands it over; each thread
+ *             frees it and then allocates and writes its own.
+ *
+ * Each run reports throughput and the cross-thread free rate. The
+ * pipeline also reports memory blowup (peak RSS / peak live bytes);
+ * the false-sharing benchmarks keep only a few bytes live, so they
+ * report how many cache lines ended up shared between threads
+ * instead.
+ *
+ * Usage: xthreadbench <composition> <benchmark> [threads] [iterations] [consumers]
+ *
+ * For the pipeline, threads is the number of producers and consumers
+ * (which defaults to the same number) the number of consumers.
+ *
+ * Run one composition per process, so that memory retained by one
+ * heap does not pollute the RSS of the next.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <atomic>
+
+#include "heaplayers.h"
+#include "../benchutil.h"
+
+using namespace HL;
+
+
+// The compositions under test. Every per-thread heap draws its
+// chunks from one shared, locked source.
+
+class SharedTop :
+  public SizeHeap<UniqueHeap<LockedHeap<SpinLockType, ZoneHeap<MmapHeap, 65536> > > > {};
+
+class PerThreadKingsley :
+  public KingsleyHeap<AdaptHeap<DLList, SharedTop>, SharedTop> {};
+
+class ThreadHeapComposition :
+  public ThreadHeap<64, LockedHeap<SpinLockType, PerThreadKingsley> > {};
+
+class ThreadSpecificComposition :
+  public ThreadSpecificHeap<PerThreadKingsley> {};
+
+class PHOThreadComposition :
+  public PHOThreadHeap<64, LockedHeap<SpinLockType, RequireCoalesceable<PerThreadKingsley> > > {};
+
+class MallocComposition :
+  public MallocHeap {};
+
+
+enum { CACHE_LINE_SIZE = 64 };
+
+/// Peak RSS of this process, in bytes.
+static size_t peakResidentBytes() {
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  return (size_t) ru.ru_maxrss * 1024;
+}
+
+/**
+ * @class Stats
+ * @brief Counters shared by all benchmark threads.
+ */
+
+class Stats {
+public:
+  Stats()
+    : ops (0),
+      frees (0),
+      crossFrees (0),
+      live (0),
+      maxLive (0)
+  {}
+
+  void allocated (size_t sz) {
+    size_t now = (live += sz);
+    size_t old = maxLive.load();
+    while (now > old && !maxLive.compare_exchange_weak (old, now))
+      ;
+  }
+
+  void freed (size_t sz, bool crossThread) {
+    live -= sz;
+    frees++;
+    if (crossThread) {
+      crossFrees++;
+    }
+  }
+
+  std::atomic<size_t> ops;
+  std::atomic<size_t> frees;
+  std::atomic<size_t> crossFrees;
+  std::atomic<size_t> live;
+  std::atomic<size_t> maxLive;
+};
+
+
+/**
+ * @class Message
+ * @brief The header of every object passed between threads.
+ */
+
+class Message {
+public:
+  int owner;     // Index of the allocating thread.
+  int size;      // Requested size, including this header.
+};
+
+
+/**
+ * @class BoundedQueue
+ * @brief A fixed-capacity blocking queue of messages.
+ */
+
+class BoundedQueue {
+public:
+
+  enum { CAPACITY = 1024 };
+
+  BoundedQueue()
+    : _head (0),
+      _tail (0),
+      _count (0),
+      _closed (false)
+  {
+    pthread_mutex_init (&_lock, NULL);
+    pthread_cond_init (&_notEmpty, NULL);
+    pthread_cond_init (&_notFull, NULL);
+  }
+
+  void put (Message * m) {
+    pthread_mutex_lock (&_lock);
+    while (_count == CAPACITY) {
+      pthread_cond_wait (&_notFull, &_lock);
+    }
+    _buf[_tail] = m;
+    _tail = (_tail + 1) % CAPACITY;
+    _count++;
+    pthread_cond_signal (&_notEmpty);
+    pthread_mutex_unlock (&_lock);
+  }
+
+  /// Returns NULL once the queue is closed and drained.
+  Message * get() {
+    pthread_mutex_lock (&_lock);
+    while (_count == 0 && !_closed) {
+      pthread_cond_wait (&_notEmpty, &_lock);
+    }
+    Message * m = NULL;
+    if (_count > 0) {
+      m = _buf[_head];
+      _head = (_head + 1) % CAPACITY;
+      _count--;
+      pthread_cond_signal (&_notFull);
+    }
+    pthread_mutex_unlock (&_lock);
+    return m;
+  }
+
+  void close() {
+    pthread_mutex_lock (&_lock);
+    _closed = true;
+    pthread_cond_broadcast (&_notEmpty);
+    pthread_mutex_unlock (&_lock);
+  }
+
+private:
+  pthread_mutex_t _lock;
+  pthread_cond_t _notEmpty;
+  pthread_cond_t _notFull;
+  Message * _buf[CAPACITY];
+  int _head;
+  int _tail;
+  int _count;
+  bool _closed;
+};
+
+
+/// Everything a benchmark thread needs.
+template <class TheHeap>
+class Context {
+public:
+  TheHeap * heap;
+  Stats * stats;
+  BoundedQueue * queue;
+  int index;
+  int iterations;
+  // For the false-sharing benchmarks: the object handed to this
+  // thread, and the addresses this thread ended up writing.
+  char * handoff;
+  size_t * lines;
+  int numLines;
+};
+
+
+/// A cheap per-thread PRNG.
+static inline unsigned int nextRandom (unsigned int& state) {
+  state = state * 1103515245 + 12345;
+  return (state >> 16) & 0x7fff;
+}
+
+
+template <class TheHeap>
+static void * producer (void * arg) {
+  Context<TheHeap>& c = *((Context<TheHeap> *) arg);
+  unsigned int seed = c.index + 1;
+  for (int i = 0; i < c.iterations; i++) {
+    int sz = sizeof(Message) + 16 + (int) (nextRandom (seed) % 1024);
+    Message * m = (Message *) c.heap->malloc (sz);
+    m->owner = c.index;
+    m->size = sz;
+    memset (m + 1, c.index, sz - sizeof(Message));
+    c.stats->allocated (sz);
+    // Some thread-local scratch churn.
+    void * scratch = c.heap->malloc (64);
+    memset (scratch, 0, 64);
+    c.heap->free (scratch);
+    c.queue->put (m);
+  }
+  // Only the messages are counted as live; the scratch objects are
+  // freed locally, one per iteration.
+  c.stats->frees += c.iterations;
+  c.stats->ops += 4 * c.iterations;
+  return NULL;
+}
+
+
+template <class TheHeap>
+static void * consumer (void * arg) {
+  Context<TheHeap>& c = *((Context<TheHeap> *) arg);
+  Message * m;
+  unsigned long checksum = 0;
+  size_t received = 0;
+  while ((m = c.queue->get()) != NULL) {
+    // Read the payload, as a real consumer would.
+    checksum += ((unsigned char *) (m + 1))[m->size - sizeof(Message) - 1];
+    bool cross = (m->owner != c.index);
+    c.stats->freed (m->size, cross);
+    c.heap->free (m);
+    void * scratch = c.heap->malloc (128);
+    memset (scratch, 0, 128);
+    c.heap->free (scratch);
+    received++;
+  }
+  c.stats->frees += received;
+  c.stats->ops += 3 * received;
+  return (void *) checksum;
+}
+
+
+/// Write to an object repeatedly, recording its cache line.
+template <class TheHeap>
+static inline void hammer (Context<TheHeap>& c, char * obj, int i) {
+  if (i < c.numLines) {
+    c.lines[i] = (size_t) obj / CACHE_LINE_SIZE;
+  }
+  for (int j = 0; j < 1000; j++) {
+    *((volatile char *) obj) = (char) j;
+  }
+}
+
+// The false-sharing workers update the shared counters only once, at
+// the end, so that the counters themselves don't cause cache-line
+// ping-ponging.
+
+/// Active false sharing: allocate, write, free, in every thread at once.
+template <class TheHeap>
+static void * activeWorker (void * arg) {
+  Context<TheHeap>& c = *((Context<TheHeap> *) arg);
+  c.stats->allocated (8);
+  for (int i = 0; i < c.iterations; i++) {
+    char * obj = (char *) c.heap->malloc (8);
+    hammer (c, obj, i);
+    c.heap->free (obj);
+  }
+  c.stats->freed (8, false);
+  c.stats->frees += c.iterations - 1;
+  c.stats->ops += 2 * c.iterations;
+  return NULL;
+}
+
+
+/// Passive false sharing: free the handed-off object, then reuse its space.
+template <class TheHeap>
+static void * passiveWorker (void * arg) {
+  Context<TheHeap>& c = *((Context<TheHeap> *) arg);
+  c.heap->free (c.handoff);
+  c.stats->freed (8, true);
+  c.stats->allocated (8);
+  for (int i = 0; i < c.iterations; i++) {
+    char * obj = (char *) c.heap->malloc (8);
+    hammer (c, obj, i);
+    c.heap->free (obj);
+  }
+  c.stats->freed (8, false);
+  c.stats->frees += c.iterations - 1;
+  c.stats->ops += 2 * c.iterations + 1;
+  return NULL;
+}
+
+
+/// Count the distinct cache lines touched by more than one thread.
+template <class TheHeap>
+static size_t countSharedLines (Context<TheHeap> * ctx, int nthreads) {
+  size_t shared = 0;
+  for (int t = 0; t < nthreads; t++) {
+    for (int i = 0; i < ctx[t].numLines; i++) {
+      size_t line = ctx[t].lines[i];
+      bool seenEarlier = false;
+      for (int j = 0; j < i && !seenEarlier; j++) {
+	seenEarlier = (ctx[t].lines[j] == line);
+      }
+      if (seenEarlier) {
+	continue;
+      }
+      for (int u = t + 1; u < nthreads; u++) {
+	bool found = false;
+	for (int k = 0; k < ctx[u].numLines; k++) {
+	  if (ctx[u].lines[k] == line) {
+	    found = true;
+	    break;
+	  }
+	}
+	if (found) {
+	  shared++;
+	  break;
+	}
+      }
+    }
+  }
+  return shared;
+}
+
+
+enum { MAX_THREADS = 256 };
+enum { LINES_RECORDED = 64 };
+
+template <class TheHeap>
+static void runBenchmark (const char * name, const char * bench, int nthreads, int nconsumers, int iterations)
+{
+  static char heapBuf[sizeof(TheHeap)];
+  TheHeap * heap = new (heapBuf) TheHeap;
+  Stats stats;
+  BoundedQueue queue;
+  static Context<TheHeap> ctx[MAX_THREADS];
+  static size_t lines[MAX_THREADS][LINES_RECORDED];
+  static Fred threads[MAX_THREADS];
+
+  const bool pipeline = (strcmp (bench, "pipeline") == 0);
+
+  // In the pipeline, nthreads counts the producers only.
+  if (pipeline) {
+    if (nthreads < 1) {
+      nthreads = 1;
+    }
+    if (nconsumers < 1) {
+      nconsumers = 1;
+    }
+    if (nthreads > MAX_THREADS / 2) {
+      nthreads = MAX_THREADS / 2;
+    }
+    if (nconsumers > MAX_THREADS - nthreads) {
+      nconsumers = MAX_THREADS - nthreads;
+    }
+  } else {
+    if (nthreads > MAX_THREADS) {
+      nthreads = MAX_THREADS;
+    }
+    if (nthreads < 2) {
+      nthreads = 2;
+    }
+    nconsumers = 0;
+  }
+  const int totalThreads = nthreads + nconsumers;
+
+  for (int i = 0; i < totalThreads; i++) {
+    ctx[i].heap = heap;
+    ctx[i].stats = &stats;
+    ctx[i].queue = &queue;
+    ctx[i].index = i;
+    ctx[i].iterations = iterations;
+    ctx[i].handoff = NULL;
+    ctx[i].lines = lines[i];
+    ctx[i].numLines = 0;
+  }
+
+  const size_t baselineRss = peakResidentBytes();
+  size_t sharedLines = 0;
+
+  Timer t;
+  t.start();
+
+  if (pipeline) {
+    // Threads [0, nthreads) produce, the rest consume.
+    for (int i = 0; i < totalThreads; i++) {
+      threads[i].create (i < nthreads ? producer<TheHeap> : consumer<TheHeap>, &ctx[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+      threads[i].join();
+    }
+    queue.close();
+    for (int i = nthreads; i < totalThreads; i++) {
+      threads[i].join();
+    }
+  } else if (strcmp (bench, "active") == 0 || strcmp (bench, "passive") == 0) {
+    bool passive = (bench[0] == 'p');
+    for (int i = 0; i < nthreads; i++) {
+      ctx[i].numLines = (iterations < LINES_RECORDED) ? iterations : LINES_RECORDED;
+      if (passive) {
+	// Adjacent objects from one thread, one per worker.
+	ctx[i].handoff = (char *) heap->malloc (8);
+	stats.allocated (8);
+      }
+    }
+    for (int i = 0; i < nthreads; i++) {
+      threads[i].create (passive ? passiveWorker<TheHeap> : activeWorker<TheHeap>, &ctx[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+      threads[i].join();
+    }
+  } else {
+    fprintf (stderr, "Unknown benchmark: %s\n", bench);
+    exit (1);
+  }
+
+  t.stop();
+
+  if (!pipeline) {
+    sharedLines = countSharedLines (ctx, nthreads);
+  }
+
+  const size_t peakRss = peakResidentBytes() - baselineRss;
+  const double elapsed = (double) t;
+  const size_t frees = stats.frees;
+  const double crossPct = frees ? 100.0 * (double) stats.crossFrees / (double) frees : 0.0;
+  const double crossRate = (double) stats.crossFrees / elapsed;
+
+  if (pipeline) {
+    printf ("composition\tbenchmark\tproducers\tconsumers\tseconds\tops/sec\tpeak_live\tpeak_rss\tblowup\tcross_free_pct\tcross_frees/sec\n");
+    printf ("%s\t%s\t%d\t%d\t%.3f\t%.0f\t%lu\t%lu\t%.3f\t%.1f\t%.0f\n",
+	    name, bench, nthreads, nconsumers, elapsed,
+	    (double) stats.ops / elapsed,
+	    (unsigned long) stats.maxLive.load(),
+	    (unsigned long) peakRss,
+	    stats.maxLive ? (double) peakRss / (double) stats.maxLive : 0.0,
+	    crossPct, crossRate);
+  } else {
+    // Only a few bytes per thread are ever live here, so peak RSS
+    // divided by peak live bytes would be meaningless.
+    printf ("composition\tbenchmark\tthreads\tseconds\tops/sec\tpeak_rss\tcross_free_pct\tcross_frees/sec\tshared_lines\n");
+    printf ("%s\t%s\t%d\t%.3f\t%.0f\t%lu\t%.1f\t%.0f\t%lu\n",
+	    name, bench, nthreads, elapsed,
+	    (double) stats.ops / elapsed,
+	    (unsigned long) peakRss,
+	    crossPct, crossRate,
+	    (unsigned long) sharedLines);
+  }
+}
+
+
+typedef void (*RunFunction) (const char *, const char *, int, int, int);
+
+static const Composition<RunFunction> compositions[] = {
+  { "threadheap",     runBenchmark<ThreadHeapComposition> },
+  { "threadspecific", runBenchmark<ThreadSpecificComposition> },
+  { "phothreadheap",  runBenchmark<PHOThreadComposition> },
+  { "malloc",         runBenchmark<MallocComposition> }
+};
+
+int
+main (int argc, char * argv[])
+{
+  const Composition<RunFunction> * composition =
+    findComposition (compositions, argc, argv, 2, "<composition> <pipeline|active|passive> [threads] [iterations] [consumers]");
+  if (composition == NULL) {
+    return 1;
+  }
+  int nthreads   = (argc > 3) ? atoi (argv[3]) : CPUInfo::getNumProcessors();
+  int iterations = (argc > 4) ? atoi (argv[4]) : 100000;
+  int consumers  = (argc > 5) ? atoi (argv[5]) : nthreads;
+  composition->run (composition->name, argv[2], nthreads, consumers, iterations);
+  return 0;
+}
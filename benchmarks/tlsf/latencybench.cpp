@@ -0,0 +1,182 @@
+/* -*- C++ -*- */
+
+/*
+ * @file   latencybench.cpp
+ * @brief  Worst-case latency benchmark: times every malloc and free individually.
+ *
+ * Runs a random workload over a fixed number of slots: each operation
+ * picks a slot, and frees its object if it holds one or allocates one
+ * (of a log-uniformly distributed size) if it doesn't. Every call is
+ * timed on its own, and the benchmark reports the median, the tail
+ * percentiles and the maximum for malloc and free separately. Real-time
+ * code cares about the maximum, not the mean.
+ *
+ * The fixed-pool TLSF composition gets all of its memory (touched in
+ * advance) before the run, so it never calls the operating system;
+ * the others grow on demand, as they normally would.
+ *
+ * Usage: latencybench <composition> [operations] [slots] [maxsize]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "heaplayers.h"
+#include "../benchutil.h"
+
+using namespace HL;
+
+
+// The compositions under test.
+
+enum { PoolBytes = 512 * 1024 * 1024 };
+
+class TLSFFixedComposition :
+  public ANSIWrapper<TLSFHeap<NullHeap<MmapHeap> > > {
+public:
+  TLSFFixedComposition() {
+    void * pool = MmapWrapper::map (PoolBytes);
+    memset (pool, 0, PoolBytes);
+    addPool (pool, PoolBytes);
+  }
+};
+
+class TLSFComposition :
+  public ANSIWrapper<TLSFHeap<MmapHeap> > {};
+
+class KingsleyTop : public SizeHeap<UniqueHeap<ZoneHeap<MmapHeap, 65536> > > {};
+
+class KingsleyComposition :
+  public ANSIWrapper<KingsleyHeap<AdaptHeap<DLList, KingsleyTop>, KingsleyTop> > {};
+
+class MallocComposition :
+  public MallocHeap {};
+
+
+/// Sorted latencies (in nanoseconds) for one kind of call.
+class Latencies {
+public:
+  Latencies (size_t capacity)
+    : _samples ((unsigned int *) MmapWrapper::map (capacity * sizeof(unsigned int))),
+      _count (0)
+  {
+    memset (_samples, 0, capacity * sizeof(unsigned int));
+  }
+  inline void add (unsigned long ns) {
+    _samples[_count++] = (unsigned int) std::min (ns, 0xffffffffUL);
+  }
+  void report (const char * what) {
+    if (_count == 0) {
+      return;
+    }
+    std::sort (_samples, _samples + _count);
+    printf ("%-6s %10lu calls  p50 %6u  p99 %6u  p99.9 %7u  p99.99 %8u  max %9u ns\n",
+	    what, (unsigned long) _count,
+	    percentile (50.0), percentile (99.0), percentile (99.9),
+	    percentile (99.99), _samples[_count - 1]);
+  }
+private:
+  unsigned int percentile (double p) const {
+    size_t i = (size_t) ((double) (_count - 1) * p / 100.0);
+    return _samples[i];
+  }
+  unsigned int * _samples;
+  size_t _count;
+};
+
+
+template <class TheHeap>
+static void runLatency (const char * name, size_t ops, size_t slots, size_t maxSize)
+{
+  // Keep the benchmark's own bookkeeping out of the heap under test.
+  void ** objects = (void **) MmapWrapper::map (slots * sizeof(void *));
+  memset (objects, 0, slots * sizeof(void *));
+  Latencies mallocs (ops);
+  Latencies frees (ops);
+
+  static char heapBuf[sizeof(TheHeap)];
+  TheHeap * heap = new (heapBuf) TheHeap;
+
+  int maxLog = 4;
+  while (((size_t) 1 << (maxLog + 1)) <= maxSize) {
+    maxLog++;
+  }
+
+  Random rng (12345);
+  size_t failures = 0;
+  // Fill half of the slots first (untimed), so the run starts in a steady state.
+  for (size_t i = 0; i < slots; i += 2) {
+    size_t sz = (size_t) 16 << (rng.next() % (maxLog - 3));
+    objects[i] = heap->malloc (sz);
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  for (size_t op = 0; op < ops; op++) {
+    size_t slot = rng.next() % slots;
+    if (objects[slot] != NULL) {
+      void * ptr = objects[slot];
+      Clock::time_point start = Clock::now();
+      heap->free (ptr);
+      Clock::time_point end = Clock::now();
+      frees.add (std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+      objects[slot] = NULL;
+    } else {
+      // Log-uniform sizes: as many small objects as large ones, per power of two.
+      const int log = 4 + (int) (rng.next() % (maxLog - 3));
+      size_t sz = ((size_t) 1 << log) + rng.next() % ((size_t) 1 << log);
+      if (sz > maxSize) {
+	sz = maxSize;
+      }
+      Clock::time_point start = Clock::now();
+      void * ptr = heap->malloc (sz);
+      Clock::time_point end = Clock::now();
+      mallocs.add (std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+      if (ptr == NULL) {
+	failures++;
+	continue;
+      }
+      // Touch the object (untimed), as a real program would.
+      memset (ptr, 0xab, sz);
+      objects[slot] = ptr;
+    }
+  }
+
+  printf ("# composition: %s, operations: %lu, slots: %lu, max size: %lu, failed mallocs: %lu\n",
+	  name, (unsigned long) ops, (unsigned long) slots,
+	  (unsigned long) maxSize, (unsigned long) failures);
+  mallocs.report ("malloc");
+  frees.report ("free");
+}
+
+
+typedef void (*RunFunction) (const char *, size_t, size_t, size_t);
+
+static const Composition<RunFunction> compositions[] = {
+  { "tlsf-fixed", runLatency<TLSFFixedComposition> },
+  { "tlsf",       runLatency<TLSFComposition> },
+  { "kingsley",   runLatency<KingsleyComposition> },
+  { "malloc",     runLatency<MallocComposition> }
+};
+
+int
+main (int argc, char * argv[])
+{
+  const Composition<RunFunction> * composition =
+    findComposition (compositions, argc, argv, 1, "<composition> [operations] [slots] [maxsize]");
+  if (composition == NULL) {
+    return 1;
+  }
+  size_t ops     = (argc > 2) ? strtoul (argv[2], NULL, 10) : 10000000;
+  size_t slots   = (argc > 3) ? strtoul (argv[3], NULL, 10) : 10000;
+  size_t maxSize = (argc > 4) ? strtoul (argv[4], NULL, 10) : 65536;
+  if ((slots == 0) || (maxSize < 32)) {
+    fprintf (stderr, "Need at least one slot and a maximum size of at least 32.\n");
+    return 1;
+  }
+  composition->run (composition->name, ops, slots, maxSize);
+  return 0;
+}
@@ -0,0 +1,87 @@
+/* -*- C++ -*- */
+
+/*
+ * @file   traitstest.cpp
+ * @brief  Compile-time tests for HeapTraits.
+ *
+ * Each check is a static_assert, so building this file is the test;
+ * running it only exercises the compositions once. The layers here
+ * overload malloc (taking a call site) or free (taking a size), which
+ * the traits must see through.
+ *
+ * Usage: traitstest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heaplayers.h"
+
+using namespace HL;
+
+/// A zero-filling layer whose malloc is overloaded, like CallSiteHeap's.
+class OverloadedHeap : public MmapHeap {
+public:
+  typedef OverloadedHeap ZeroMemory;
+  inline void * malloc (size_t sz) { return MmapHeap::malloc (sz); }
+  inline void * malloc (size_t sz, void *) { return malloc (sz); }
+  inline void * mallocNear (size_t sz, const void *) { return malloc (sz); }
+};
+
+/// A layer with sized free next to its own free and freeBatch.
+class SizedFreeHeap : public MallocHeap {
+public:
+  inline void free (void * ptr) { MallocHeap::free (ptr); }
+  inline void free (void * ptr, size_t) { free (ptr); }
+  inline void freeBatch (void ** ptrs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      free (ptrs[i]);
+    }
+  }
+};
+
+// The static malloc of MmapHeap counts as its own.
+static_assert (HeapTraits<MmapHeap>::ZeroMemory, "MmapHeap zeroes memory");
+static_assert (HeapTraits<MmapHeap>::ThreadSafe, "MmapHeap is thread-safe");
+
+// An overloaded malloc that declares ZeroMemory keeps it...
+static_assert (HeapTraits<OverloadedHeap>::ZeroMemory, "OverloadedHeap zeroes memory");
+static_assert (HeapTraits<OverloadedHeap>::HasMallocNear, "OverloadedHeap has mallocNear");
+// ...and one that doesn't hides the superheap's.
+static_assert (!HeapTraits<OverloadedHeap>::ThreadSafe, "OverloadedHeap is not thread-safe");
+static_assert (!HeapTraits<CallSiteHeap<MmapHeap, 4> >::ZeroMemory, "CallSiteHeap does not zero memory");
+static_assert (!HeapTraits<CallSiteHeap<MallocHeap, 4> >::ThreadSafe, "CallSiteHeap is not thread-safe");
+static_assert (!HeapTraits<LifetimeHeap<MmapHeap> >::ZeroMemory, "LifetimeHeap does not zero memory");
+static_assert (!HeapTraits<LifetimePredictingHeap<MmapHeap> >::ThreadSafe, "LifetimePredictingHeap is not thread-safe");
+
+// A layer over the overloaded one does not inherit what it bypasses.
+static_assert (!HeapTraits<SizeHeap<OverloadedHeap> >::ZeroMemory, "SizeHeap adds a header");
+
+// An overloaded free still finds its freeBatch.
+static_assert (HeapTraits<SizedFreeHeap>::HasSizedFree, "SizedFreeHeap has sized free");
+static_assert (HeapTraits<SizedFreeHeap>::HasFreeBatch, "SizedFreeHeap has freeBatch");
+
+// A const malloc.
+static_assert (!HeapTraits<NullHeap<MmapHeap> >::ZeroMemory, "NullHeap returns no memory");
+
+template <class TheHeap>
+static void exercise() {
+  static TheHeap heap;
+  void * ptr = heap.malloc (100);
+  if (ptr == NULL) {
+    fprintf (stderr, "malloc failed\n");
+    exit (1);
+  }
+  heap.free (ptr);
+}
+
+int
+main()
+{
+  exercise<ANSIWrapper<OverloadedHeap> >();
+  exercise<ANSIWrapper<CallSiteHeap<MallocHeap, 4> > >();
+  exercise<ANSIWrapper<LifetimeHeap<MallocHeap> > >();
+  exercise<ANSIWrapper<SizedFreeHeap> >();
+  printf ("All tests passed.\n");
+  return 0;
+}
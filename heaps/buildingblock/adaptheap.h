@@ -31,6 +31,8 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "utility/mallocnear.h"
+
 /**
  * @class AdaptHeap
  * @brief Maintains dictionary entries through freed objects.
@@ -54,6 +56,15 @@ namespace HL {
       return ptr;
     }
 
+    /// Allocate an object, preferring one on the same page as hint.
+    inline void * mallocNear (const size_t sz, const void * hint) {
+      void * ptr = (Entry *) dict.getNear (hint, MallocNear::NearBytes, MallocNear::MaxScan);
+      if (ptr == NULL) {
+        ptr = malloc (sz);
+      }
+      return ptr;
+    }
+
     /// Deallocate the object (return to the dictionary).
     inline void free (void * ptr) {
       if (ptr) {
@@ -38,6 +38,7 @@
 
 #include <assert.h>
 #include "utility/freesllist.h"
+#include "utility/mallocnear.h"
 
 #ifndef NULL
 #define NULL 0
@@ -60,6 +61,18 @@ namespace HL {
       return ptr;
     }
 
+    /// Prefer a free object on the same page as hint.
+    inline void * mallocNear (size_t sz, const void * hint) {
+      void * ptr = _freelist.getNear (hint, MallocNear::NearBytes, MallocNear::MaxScan);
+      if (ptr == 0) {
+        ptr = _freelist.get();
+      }
+      if (ptr == 0) {
+        ptr = MallocNear::allocate (static_cast<SuperHeap&>(*this), sz, hint);
+      }
+      return ptr;
+    }
+
     inline void free (void * ptr) {
       if (ptr == 0) {
         return;
@@ -1,3 +1,4 @@
+#include "callsiteheap.h"
 #include "hybridheap.h"
 #include "segheap.h"
 #include "strictsegheap.h"
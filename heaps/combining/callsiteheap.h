@@ -0,0 +1,237 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_CALLSITEHEAP_H
+#define HL_CALLSITEHEAP_H
+
+/**
+ * @class CallSiteHeap
+ * @brief Segregates objects by allocation site into NumGroups independent heaps.
+ *
+ * Objects from the same site land in the same group, so that hot and
+ * cold objects of one size class do not share cache lines and pages.
+ * The site is the return address of malloc, or an explicit tag.
+ *
+ * Sites are mapped to groups lazily, by hashing, in a fixed table;
+ * loadProfile pre-assigns sites from a file whose lines are either
+ *
+ * @code
+ *  <site> <group>
+ *  site <site> <samples> <live> <short|medium|long> : ...   (a LifetimeHeap dump)
+ * @endcode
+ *
+ * where short, medium and long map to groups 0, 1 and 2 (mod NumGroups).
+ * Each object carries a small header naming its group, so it is freed
+ * to the right heap from any thread. The groups are used concurrently,
+ * so SuperHeap must be thread-safe if the program is threaded.
+ * Like PHOThreadHeap, it owns its groups rather than inheriting from
+ * SuperHeap, so no superheap call can bypass them.
+ *
+ * @param SuperHeap The heap used for each group.
+ * @param NumGroups The number of groups.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "utility/callsite.h"
+#include "utility/gcd.h"
+
+namespace HL {
+
+  template <class SuperHeap, int NumGroups>
+  class CallSiteHeap {
+  private:
+
+    class Header {
+    public:
+      size_t group;
+      size_t magic;
+    };
+
+  public:
+
+    enum { Alignment = gcd<(int) SuperHeap::Alignment, (int) sizeof(Header)>::value };
+
+    enum { MaxSites = 4096 };
+
+    CallSiteHeap() {
+      for (int i = 0; i < MaxSites; i++) {
+	_sites[i].site = NULL;
+	_sites[i].group = -1;
+      }
+    }
+
+    NO_INLINE void * malloc (size_t sz) {
+      return mallocGroup (sz, getGroup (HL_RETURN_ADDRESS()));
+    }
+
+    /// Allocate on behalf of an explicit site tag.
+    inline void * malloc (size_t sz, void * site) {
+      return mallocGroup (sz, getGroup (site));
+    }
+
+    inline void free (void * ptr) {
+      if (ptr == NULL) {
+	return;
+      }
+      Header * h = getHeader (ptr);
+      assert (h->magic == MAGIC);
+      assert (h->group < (size_t) NumGroups);
+      _heaps[h->group].free (h);
+    }
+
+    inline size_t getSize (void * ptr) {
+      Header * h = getHeader (ptr);
+      assert (h->magic == MAGIC);
+      return _heaps[h->group].getSize (h) - sizeof(Header);
+    }
+
+    /// The group that an object belongs to.
+    static inline int getGroupOf (void * ptr) {
+      return (int) getHeader(ptr)->group;
+    }
+
+    /// Map a site (or tag) to a group.
+    bool setGroup (void * site, int group) {
+      Site * s = findSite (site);
+      if (s == NULL) {
+	return false;
+      }
+      s->group.store (group % NumGroups, std::memory_order_release);
+      return true;
+    }
+
+    /// Load site-to-group assignments; returns the number loaded.
+    int loadProfile (const char * fname) {
+      FILE * f = fopen (fname, "r");
+      if (f == NULL) {
+	return 0;
+      }
+      int loaded = 0;
+      char buf[1024];
+      char name[512];
+      char cls[32];
+      int group;
+      while (fgets (buf, sizeof(buf), f)) {
+	if (buf[0] == '#') {
+	  continue;
+	}
+	if (sscanf (buf, "site %511s %*lu %*lu %31s", name, cls) == 2) {
+	  if (strcmp (cls, "short") == 0) {
+	    group = 0;
+	  } else if (strcmp (cls, "medium") == 0) {
+	    group = 1;
+	  } else {
+	    group = 2;
+	  }
+	} else if (sscanf (buf, "%511s %d", name, &group) != 2) {
+	  continue;
+	}
+	void * site = CallSite::resolve (name);
+	if ((site != NULL) && (group >= 0) && setGroup (site, group)) {
+	  loaded++;
+	}
+      }
+      fclose (f);
+      return loaded;
+    }
+
+  private:
+
+    enum { MAGIC = 0xca115173 };
+
+    class Site {
+    public:
+      std::atomic<void *> site;
+      std::atomic<int> group;
+    };
+
+    inline void * mallocGroup (size_t sz, int group) {
+      Header * h = (Header *) _heaps[group].malloc (sz + sizeof(Header));
+      if (h == NULL) {
+	return NULL;
+      }
+      h->group = (size_t) group;
+      h->magic = MAGIC;
+      return (void *) (h + 1);
+    }
+
+    static inline Header * getHeader (void * ptr) {
+      return (Header *) ptr - 1;
+    }
+
+    static inline size_t hashSite (void * site) {
+      size_t h = (size_t) site;
+      h ^= h >> 17;
+      h *= 0x9e3779b97f4a7c15ULL;
+      return h ^ (h >> 29);
+    }
+
+    inline int getGroup (void * site) {
+      Site * s = findSite (site);
+      int group = (s != NULL) ? s->group.load (std::memory_order_acquire) : -1;
+      if (group < 0) {
+	// A new site (or a full table): assign it by hash.
+	group = (int) (hashSite (site) % NumGroups);
+	if (s != NULL) {
+	  int unassigned = -1;
+	  s->group.compare_exchange_strong (unassigned, group);
+	}
+      }
+      return group;
+    }
+
+    /// Find (or claim) the table entry for a site; NULL if the table is full.
+    Site * findSite (void * site) {
+      size_t i = hashSite (site) % MaxSites;
+      for (int probes = 0; probes < MaxSites; probes++) {
+	void * current = _sites[i].site.load (std::memory_order_acquire);
+	if (current == site) {
+	  return &_sites[i];
+	}
+	if (current == NULL) {
+	  if (_sites[i].site.compare_exchange_strong (current, site)
+	      || (current == site)) {
+	    return &_sites[i];
+	  }
+	}
+	i = (i + 1) % MaxSites;
+      }
+      return NULL;
+    }
+
+    SuperHeap _heaps[NumGroups];
+
+    Site _sites[MaxSites];
+  };
+
+}
+
+#endif
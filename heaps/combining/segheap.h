@@ -58,6 +58,7 @@
 
 #include <assert.h>
 #include <utility/gcd.h>
+#include <utility/mallocnear.h>
 
 namespace HL {
 
@@ -69,7 +70,7 @@ namespace HL {
   class SegHeap : public LittleHeap {
   public:
 
-    enum { Alignment = gcd<LittleHeap::Alignment, BigHeap::Alignment>::VALUE };
+    enum { Alignment = gcd<LittleHeap::Alignment, BigHeap::Alignment>::value };
 
     inline SegHeap()
       : _memoryHeld (0),
@@ -146,6 +147,19 @@ namespace HL {
       return ptr;
     }
 
+    /// Prefer an object on the same page as hint from the exact size class.
+    inline void * mallocNear (const size_t sz, const void * hint) {
+      if (sz <= _maxObjectSize) {
+        const int sc = getSizeClass(sz);
+        void * ptr = MallocNear::allocate (myLittleHeap[sc], sz, hint);
+        if (ptr != NULL) {
+	  _memoryHeld -= sz;
+          return ptr;
+        }
+      }
+      return malloc (sz);
+    }
+
 
     inline void free (void * ptr) {
       // printf ("Free: %x (%d bytes)\n", ptr, getSize(ptr));
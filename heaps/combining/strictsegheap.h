@@ -99,6 +99,9 @@ namespace HL {
         assert (sizeClass >= 0);
         assert (sizeClass < NumBins);
         ptr = SuperHeap::myLittleHeap[sizeClass].malloc (realSize);
+        if (ptr) {
+          SuperHeap::_memoryHeld -= realSize;
+        }
       }
       if (!ptr) {
         ptr = SuperHeap::bigheap.malloc (realSize);
@@ -106,6 +109,24 @@ namespace HL {
       return ptr;
     }
 
+    /// As malloc, but prefer memory on the same page as hint.
+    inline void * mallocNear (const size_t sz, const void * hint) {
+      void * ptr = NULL;
+      const int sizeClass   = size2class(sz);
+      const size_t realSize = class2size(sizeClass);
+
+      if (realSize <= SuperHeap::_maxObjectSize) {
+        ptr = MallocNear::allocate (SuperHeap::myLittleHeap[sizeClass], realSize, hint);
+        if (ptr) {
+          SuperHeap::_memoryHeld -= realSize;
+        }
+      }
+      if (!ptr) {
+        ptr = MallocNear::allocate (SuperHeap::bigheap, realSize, hint);
+      }
+      return ptr;
+    }
+
     inline void free (void * ptr) {
       const size_t objectSize = SuperHeap::getSize(ptr);
       if (objectSize > SuperHeap::_maxObjectSize) {
@@ -124,6 +145,7 @@ namespace HL {
           objectSizeClass--;
 
         SuperHeap::myLittleHeap[objectSizeClass].free (ptr);
+        SuperHeap::_memoryHeld += class2size(objectSizeClass);
       }
     }
 
@@ -1,5 +1,6 @@
 #include "checkheap.h"
 #include "debugheap.h"
+#include "lifetimeheap.h"
 #include "logheap.h"
 #include "sanitycheckheap.h"
 #include "statsheap.h"
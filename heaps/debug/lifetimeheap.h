@@ -0,0 +1,314 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_LIFETIMEHEAP_H
+#define HL_LIFETIMEHEAP_H
+
+/**
+ * @class LifetimeHeap
+ * @brief Samples allocations and records how long they live, per size class and per call site.
+ *
+ * Time is measured by the allocation clock: the number of bytes
+ * allocated so far. One allocation is sampled every SampleBytes bytes;
+ * its birth time is kept in a side table, and when it is freed its
+ * lifetime goes into a log2 histogram for its size class and for its
+ * call site. The histograms can be dumped for offline analysis, along
+ * with a short/medium/long classification of every site that
+ * LifetimePredictingHeap can read back.
+ *
+ * The call site is the return address of malloc (this layer's malloc
+ * is never inlined), so place this layer where its caller is the
+ * application, or pass the site explicitly. Not thread-safe: put it
+ * under a lock.
+ *
+ * @param SuperHeap   The heap to profile.
+ * @param SampleBytes The mean number of bytes allocated between samples.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "heaps/buildingblock/freelistheap.h"
+#include "heaps/special/bumpalloc.h"
+#include "heaps/top/mmapheap.h"
+#include "utility/callsite.h"
+#include "utility/ilog2.h"
+#include "utility/myhashmap.h"
+
+namespace HL {
+
+  template <class SuperHeap, size_t SampleBytes = 65536>
+  class LifetimeHeap : public SuperHeap {
+  public:
+
+    enum { NumBuckets = 48 };
+    enum { NumSizeClasses = 48 };
+    enum { MaxSites = 1024 };
+
+    LifetimeHeap()
+      : _clock (0),
+	_nextSample (SampleBytes),
+	_liveSamples (0)
+    {
+      memset (_sizeClasses, 0, sizeof(_sizeClasses));
+      memset (_sites, 0, sizeof(_sites));
+      memset (&_otherSites, 0, sizeof(_otherSites));
+    }
+
+    NO_INLINE void * malloc (size_t sz) {
+      return malloc (sz, HL_RETURN_ADDRESS());
+    }
+
+    /// Allocate on behalf of an explicit call site.
+    inline void * malloc (size_t sz, void * site) {
+      void * ptr = SuperHeap::malloc (sz);
+      if (ptr == NULL) {
+	return NULL;
+      }
+      _clock += sz;
+      if (_clock >= _nextSample) {
+	sample (ptr, sz, site);
+	_nextSample = _clock + SampleBytes;
+      }
+      return ptr;
+    }
+
+    inline void free (void * ptr) {
+      if (_liveSamples && (ptr != NULL)) {
+	Sample * s = _samples.get (ptr);
+	if (s != NULL) {
+	  retire (ptr, s);
+	}
+      }
+      SuperHeap::free (ptr);
+    }
+
+    /// The allocation clock (bytes allocated so far).
+    size_t getClock() const {
+      return _clock;
+    }
+
+    /// Write the histograms to a file (appending).
+    bool dump (const char * fname,
+	       size_t shortLifetime = DefaultShortLifetime,
+	       size_t longLifetime = DefaultLongLifetime)
+    {
+      FILE * f = fopen (fname, "a");
+      if (f == NULL) {
+	return false;
+      }
+      dump (f, shortLifetime, longLifetime);
+      fclose (f);
+      return true;
+    }
+
+    /**
+     * Write the histograms. Bucket i counts lifetimes in [2^i, 2^(i+1))
+     * bytes (bucket 0 also counts zero). A site is short-lived if 90%
+     * of its freed samples lived less than shortLifetime, long-lived
+     * if half lived at least longLifetime or a quarter are still
+     * live, and medium otherwise.
+     */
+    void dump (FILE * f,
+	       size_t shortLifetime = DefaultShortLifetime,
+	       size_t longLifetime = DefaultLongLifetime)
+    {
+      fprintf (f, "# LifetimeHeap: clock %lu, sampled every %lu bytes\n",
+	       (unsigned long) _clock, (unsigned long) SampleBytes);
+      fprintf (f, "# size <max size> <samples> <live> : <histogram>\n");
+      fprintf (f, "# site <site> <samples> <live> <short|medium|long> : <histogram>\n");
+      for (int i = 0; i < NumSizeClasses; i++) {
+	if (_sizeClasses[i].samples) {
+	  fprintf (f, "size %lu", (unsigned long) ((size_t) 1 << i));
+	  dumpStats (f, _sizeClasses[i], NULL);
+	}
+      }
+      char name[512];
+      for (int i = 0; i < MaxSites; i++) {
+	if (_sites[i].samples) {
+	  CallSite::format (_sites[i].site, name, sizeof(name));
+	  fprintf (f, "site %s", name);
+	  dumpStats (f, _sites[i], classify (_sites[i], shortLifetime, longLifetime));
+	}
+      }
+      if (_otherSites.samples) {
+	fprintf (f, "# sites beyond the first %d\n", (int) MaxSites);
+	fprintf (f, "site other");
+	dumpStats (f, _otherSites, classify (_otherSites, shortLifetime, longLifetime));
+      }
+    }
+
+  private:
+
+    enum { DefaultShortLifetime = 1 << 20 };
+    enum { DefaultLongLifetime = 1 << 28 };
+
+    class Stats {
+    public:
+      void * site;
+      unsigned long samples;
+      unsigned long live;
+      unsigned long histogram[NumBuckets];
+    };
+
+    class Sample {
+    public:
+      size_t birth;
+      Stats * sizeClass;
+      Stats * site;
+    };
+
+    typedef FreelistHeap<BumpAlloc<16384, PrivateMmapHeap> > MetadataHeap;
+
+    void sample (void * ptr, size_t sz, void * site) {
+      void * buf = _sampleHeap.malloc (sizeof(Sample));
+      if (buf == NULL) {
+	return;
+      }
+      Sample * s = new (buf) Sample;
+      s->birth = _clock;
+      s->sizeClass = &_sizeClasses[sizeClass (sz)];
+      s->site = findSite (site);
+      s->sizeClass->samples++;
+      s->sizeClass->live++;
+      s->site->samples++;
+      s->site->live++;
+      _samples.set (ptr, s);
+      _liveSamples++;
+    }
+
+    void retire (void * ptr, Sample * s) {
+      const int b = bucket (_clock - s->birth);
+      s->sizeClass->live--;
+      s->sizeClass->histogram[b]++;
+      s->site->live--;
+      s->site->histogram[b]++;
+      _samples.erase (ptr);
+      _sampleHeap.free (s);
+      _liveSamples--;
+    }
+
+    static int sizeClass (size_t sz) {
+      if (sz <= 1) {
+	return 0;
+      }
+      const int c = (int) ilog2 (sz);
+      return (c < NumSizeClasses) ? c : NumSizeClasses - 1;
+    }
+
+    /// The floor of log2 of the lifetime.
+    static int bucket (size_t lifetime) {
+      if (lifetime <= 1) {
+	return 0;
+      }
+      const int b = (int) ilog2 (lifetime + 1) - 1;
+      return (b < NumBuckets) ? b : NumBuckets - 1;
+    }
+
+    Stats * findSite (void * site) {
+      size_t i = ((size_t) site >> 2) % MaxSites;
+      for (int probes = 0; probes < MaxSites; probes++) {
+	if (_sites[i].site == site) {
+	  return &_sites[i];
+	}
+	if (_sites[i].samples == 0) {
+	  _sites[i].site = site;
+	  return &_sites[i];
+	}
+	i = (i + 1) % MaxSites;
+      }
+      return &_otherSites;
+    }
+
+    static const char * classify (const Stats& s, size_t shortLifetime, size_t longLifetime) {
+      if (s.live * 4 > s.samples) {
+	return "long";
+      }
+      const unsigned long freed = s.samples - s.live;
+      // Walk the histogram to the median and the 90th percentile.
+      unsigned long seen = 0;
+      int median = -1, p90 = -1;
+      for (int i = 0; i < NumBuckets; i++) {
+	seen += s.histogram[i];
+	if ((median < 0) && (seen * 2 >= freed)) {
+	  median = i;
+	}
+	if ((p90 < 0) && (seen * 10 >= freed * 9)) {
+	  p90 = i;
+	  break;
+	}
+      }
+      if (((size_t) 1 << (p90 + 1)) <= shortLifetime) {
+	return "short";
+      }
+      if (((size_t) 1 << median) >= longLifetime) {
+	return "long";
+      }
+      return "medium";
+    }
+
+    static void dumpStats (FILE * f, const Stats& s, const char * classification) {
+      fprintf (f, " %lu %lu", s.samples, s.live);
+      if (classification) {
+	fprintf (f, " %s", classification);
+      }
+      fprintf (f, " :");
+      // Omit the trailing empty buckets.
+      int last = NumBuckets - 1;
+      while ((last > 0) && (s.histogram[last] == 0)) {
+	last--;
+      }
+      for (int i = 0; i <= last; i++) {
+	fprintf (f, " %lu", s.histogram[i]);
+      }
+      fprintf (f, "\n");
+    }
+
+    /// Bytes allocated so far.
+    size_t _clock;
+
+    /// The clock value at which to take the next sample.
+    size_t _nextSample;
+
+    /// The number of sampled objects not yet freed.
+    unsigned long _liveSamples;
+
+    /// Maps sampled objects to their samples.
+    MyHashMap<void *, Sample *, HashTableHeap> _samples;
+
+    /// Holds the samples.
+    MetadataHeap _sampleHeap;
+
+    Stats _sizeClasses[NumSizeClasses];
+    Stats _sites[MaxSites];
+
+    /// Sites that did not fit in the table.
+    Stats _otherSites;
+  };
+
+}
+
+#endif
@@ -1,4 +1,7 @@
+#include "buddyheap.h"
 #include "dlheap.h"
 #include "kingsleyheap.h"
 #include "leamallocheap.h"
+#include "tlsfheap.h"
+#include "tunedheap.h"
 
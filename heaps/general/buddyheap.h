@@ -0,0 +1,307 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_BUDDYHEAP_H
+#define HL_BUDDYHEAP_H
+
+/**
+ * @class BuddyHeap
+ * @brief A binary buddy allocator: power-of-two blocks that split and coalesce.
+ *
+ * Every request is rounded up to a block of MinBlock << k bytes (its
+ * order k), carved out of MaxBlock-sized chunks. A larger free block
+ * is split in halves until one of the right order remains, and a
+ * freed block merges with its buddy (the other half of its parent,
+ * found by flipping one bit of its offset) for as long as the buddy
+ * is free, so freed 4K blocks can satisfy a later 8K request. Blocks
+ * are aligned to their own size.
+ *
+ * There are no per-block headers. Each chunk keeps a bitmap with one
+ * bit per block of every order, set while that block is whole and
+ * free, which decides in constant time whether a buddy can be merged;
+ * and an order map with one byte per MinBlock, giving the order of the
+ * allocated block that starts there, for free and getSize. free
+ * (ptr, sz) derives the order from the size instead. Free blocks of
+ * each order are kept in a doubly-linked list threaded through the
+ * blocks themselves, and a mask of the non-empty orders finds the
+ * smallest block to split with one find-first-set.
+ *
+ * Chunks are taken from the superheap. The chunk's metadata takes up
+ * its first few MinBlocks, which are never freed, and the rest of the
+ * chunk starts out as the free blocks that remain (one of each order
+ * below the top, at most), so the largest block is half a chunk. A
+ * source aligned to MaxBlock is asked for just MaxBlock bytes; a less
+ * aligned one for enough more to hold an aligned chunk, the unaligned
+ * part left untouched (which, from MmapHeap, costs only address
+ * space). Chunks are never returned to the superheap. Requests larger
+ * than MaxBlock / 2 fail (put a HybridHeap in front for those). Not
+ * thread-safe.
+ *
+ * @param MinBlock The smallest block (a power of two, at least two pointers).
+ * @param MaxBlock The chunk size (a power of two); blocks are at most half of it.
+ * @param SuperHeap The source of chunks.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utility/ilog2.h"
+#include "utility/sassert.h"
+
+namespace HL {
+
+  template <size_t MinBlock,
+	    size_t MaxBlock,
+	    class SuperHeap>
+  class BuddyHeap : public SuperHeap {
+  public:
+
+    enum { Alignment = MinBlock };
+
+    BuddyHeap()
+      : _nonEmpty (0)
+    {
+      sassert<((MinBlock & (MinBlock - 1)) == 0)> verifyMinPowerOfTwo;
+      sassert<((MaxBlock & (MaxBlock - 1)) == 0)> verifyMaxPowerOfTwo;
+      sassert<(MinBlock >= 2 * sizeof(void *))> verifyRoomForLinks;
+      sassert<(MaxBlock >= MinBlock) && (MaxOrder < 64)> verifyOrders;
+      verifyMinPowerOfTwo = verifyMinPowerOfTwo;
+      verifyMaxPowerOfTwo = verifyMaxPowerOfTwo;
+      verifyRoomForLinks = verifyRoomForLinks;
+      verifyOrders = verifyOrders;
+      sassert<(MetaBlocks <= BlocksPerChunk / 2)> verifyRoomForBlocks;
+      verifyRoomForBlocks = verifyRoomForBlocks;
+      for (int i = 0; i <= MaxOrder; i++) {
+	_freeLists[i] = NULL;
+      }
+    }
+
+    inline void * malloc (size_t sz) {
+      if (sz > MaxBlock / 2) {
+	return NULL;
+      }
+      const int order = getOrder (sz);
+      // The smallest non-empty order that is large enough.
+      uint64_t candidates = _nonEmpty & (~(uint64_t) 0 << order);
+      if (candidates == 0) {
+	if (!addChunk()) {
+	  return NULL;
+	}
+	candidates = _nonEmpty & (~(uint64_t) 0 << order);
+      }
+      int k = __builtin_ctzll (candidates);
+      char * block = (char *) _freeLists[k];
+      ChunkInfo * info = getInfo (block);
+      const size_t offset = block - getChunk (block);
+      remove (block, k);
+      info->clearFree (k, offset);
+      // Split, returning the upper halves to their free lists.
+      while (k > order) {
+	k--;
+	char * buddy = block + (MinBlock << k);
+	info->setFree (k, offset + (MinBlock << k));
+	insert (buddy, k);
+      }
+      info->orders[offset / MinBlock] = (uint8_t) order;
+      return block;
+    }
+
+    inline void free (void * ptr) {
+      if (ptr == NULL) {
+	return;
+      }
+      release (ptr, getInfo (ptr)->orders[((char *) ptr - getChunk (ptr)) / MinBlock]);
+    }
+
+    inline void free (void * ptr, size_t sz) {
+      if (ptr == NULL) {
+	return;
+      }
+      assert (getOrder (sz) == getInfo (ptr)->orders[((char *) ptr - getChunk (ptr)) / MinBlock]);
+      release (ptr, getOrder (sz));
+    }
+
+    inline size_t getSize (void * ptr) {
+      return MinBlock << getInfo (ptr)->orders[((char *) ptr - getChunk (ptr)) / MinBlock];
+    }
+
+  private:
+
+    /// Compile-time log2 of a power of two.
+    template <size_t N, bool Done = (N <= 1)>
+    class StaticLog {
+    public:
+      enum { value = 1 + StaticLog<N / 2>::value };
+    };
+
+    template <size_t N>
+    class StaticLog<N, true> {
+    public:
+      enum { value = 0 };
+    };
+
+    enum { MinShift = StaticLog<MinBlock>::value };
+    enum { MaxOrder = StaticLog<MaxBlock>::value - StaticLog<MinBlock>::value };
+    enum { BlocksPerChunk = MaxBlock / MinBlock };
+
+    /// The links of a free block, in its body.
+    class FreeLinks {
+    public:
+      void * next;
+      void * prev;
+    };
+
+    /// The metadata for one chunk, stored at its start.
+    class ChunkInfo {
+    public:
+
+      // The bit for the block of order k at this offset. Blocks form a
+      // binary tree: the whole chunk is node 1, and the children of
+      // node n are 2n and 2n + 1.
+      static inline size_t node (int k, size_t offset) {
+	return (BlocksPerChunk >> k) + (offset >> (MinShift + k));
+      }
+
+      inline bool isFree (int k, size_t offset) const {
+	const size_t n = node (k, offset);
+	return (freeMap[n / 64] >> (n % 64)) & 1;
+      }
+
+      inline void setFree (int k, size_t offset) {
+	const size_t n = node (k, offset);
+	freeMap[n / 64] |= (uint64_t) 1 << (n % 64);
+      }
+
+      inline void clearFree (int k, size_t offset) {
+	const size_t n = node (k, offset);
+	freeMap[n / 64] &= ~((uint64_t) 1 << (n % 64));
+      }
+
+      enum { FreeMapWords = (2 * BlocksPerChunk + 63) / 64 };
+
+      uint64_t freeMap[FreeMapWords];
+      uint8_t orders[BlocksPerChunk];
+    };
+
+    /// The MinBlocks at the start of each chunk taken up by its ChunkInfo.
+    enum { MetaBlocks = (sizeof(ChunkInfo) + MinBlock - 1) / MinBlock };
+
+    static inline int getOrder (size_t sz) {
+      if (sz <= MinBlock) {
+	return 0;
+      }
+      return (int) ilog2 (sz) - MinShift;
+    }
+
+    static inline char * getChunk (const void * ptr) {
+      return (char *) ((size_t) ptr & ~((size_t) MaxBlock - 1));
+    }
+
+    static inline ChunkInfo * getInfo (const void * ptr) {
+      return (ChunkInfo *) getChunk (ptr);
+    }
+
+    /// Free a block of the given order, merging it with free buddies.
+    inline void release (void * ptr, int k) {
+      char * chunk = getChunk (ptr);
+      ChunkInfo * info = getInfo (ptr);
+      size_t offset = (char *) ptr - chunk;
+      assert (offset % (MinBlock << k) == 0);
+      assert (!info->isFree (k, offset));
+      while (k < MaxOrder) {
+	const size_t buddy = offset ^ (MinBlock << k);
+	if (!info->isFree (k, buddy)) {
+	  break;
+	}
+	info->clearFree (k, buddy);
+	remove (chunk + buddy, k);
+	offset &= ~(MinBlock << k);
+	k++;
+      }
+      info->setFree (k, offset);
+      insert (chunk + offset, k);
+    }
+
+    inline void insert (void * block, int k) {
+      FreeLinks * l = (FreeLinks *) block;
+      l->prev = NULL;
+      l->next = _freeLists[k];
+      if (l->next != NULL) {
+	((FreeLinks *) l->next)->prev = block;
+      }
+      _freeLists[k] = block;
+      _nonEmpty |= (uint64_t) 1 << k;
+    }
+
+    inline void remove (void * block, int k) {
+      FreeLinks * l = (FreeLinks *) block;
+      if (l->prev != NULL) {
+	((FreeLinks *) l->prev)->next = l->next;
+      } else {
+	_freeLists[k] = l->next;
+	if (l->next == NULL) {
+	  _nonEmpty &= ~((uint64_t) 1 << k);
+	}
+      }
+      if (l->next != NULL) {
+	((FreeLinks *) l->next)->prev = l->prev;
+      }
+    }
+
+    /// Get a new chunk from the superheap, and free all but its metadata.
+    bool addChunk() {
+      const size_t alignment = (SuperHeap::Alignment > 0) ? (size_t) SuperHeap::Alignment : 1;
+      const bool aligned = (alignment % MaxBlock == 0);
+      // An aligned chunk starts at most MaxBlock - alignment bytes in.
+      const size_t bytes = aligned ? MaxBlock : 2 * MaxBlock - ((alignment < MaxBlock) ? alignment : 1);
+      char * mem = (char *) SuperHeap::malloc (bytes);
+      if (mem == NULL) {
+	return false;
+      }
+      char * chunk = (char *) (((size_t) mem + MaxBlock - 1) & ~((size_t) MaxBlock - 1));
+      ChunkInfo * info = getInfo (chunk);
+      memset (info->freeMap, 0, sizeof(info->freeMap));
+      // Cover the rest of the chunk with the largest aligned blocks that fit.
+      size_t offset = MetaBlocks * MinBlock;
+      while (offset < MaxBlock) {
+	const int k = __builtin_ctzll (offset) - MinShift;
+	info->setFree (k, offset);
+	insert (chunk + offset, k);
+	offset += MinBlock << k;
+      }
+      return true;
+    }
+
+    /// The orders with a non-empty free list.
+    uint64_t _nonEmpty;
+
+    void * _freeLists[MaxOrder + 1];
+  };
+
+}
+
+#endif
@@ -0,0 +1,302 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_TLSFHEAP_H
+#define HL_TLSFHEAP_H
+
+/**
+ * @class TLSFHeap
+ * @brief A two-level segregated fit allocator: malloc and free in constant time.
+ *
+ * Free blocks are kept in lists indexed by two levels: the first by
+ * the floor of the block size's log, the second by a linear
+ * subdivision of that power-of-two range into 2^SecondLevelBits
+ * classes (sizes below 2^(SecondLevelBits + 4) are classed exactly,
+ * in 16-byte steps). A bitmap over each level records which lists are
+ * non-empty, so malloc finds a block with two find-first-set
+ * operations. The request is first rounded up to the next class
+ * boundary, so any block in the list found is large enough, and
+ * waste from this rounding is bounded by 1/2^SecondLevelBits.
+ *
+ * Blocks carry the boundary tags of RequireCoalesceable. free merges a
+ * block with its free neighbors immediately, and malloc splits off
+ * the unused tail of a block, so neither ever walks a list.
+ *
+ * Memory comes from pools. When no block fits, the heap adds a pool
+ * of at least ChunkSize bytes from the superheap; for strict bounds,
+ * give it all of its memory up front instead, with addPool or by
+ * making the superheap a StaticHeap (and ChunkSize its size). Pools
+ * are never returned to the superheap. Not thread-safe.
+ *
+ * @param SuperHeap The source of pools (need not be aligned).
+ * @param ChunkSize The minimum size of a pool taken from the superheap.
+ * @param SecondLevelBits log2 of the number of second-level classes.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "heaps/objectrep/coalesceableheap.h"
+#include "utility/ilog2.h"
+#include "utility/sassert.h"
+
+namespace HL {
+
+  template <class SuperHeap,
+	    size_t ChunkSize = 1024 * 1024,
+	    int SecondLevelBits = 5>
+  class TLSFHeap : public RequireCoalesceable<SuperHeap> {
+  public:
+
+    typedef RequireCoalesceable<SuperHeap> super;
+    typedef typename super::Header Header;
+
+    enum { Alignment = 16 };
+
+    TLSFHeap()
+      : _firstLevelMap (0)
+    {
+      sassert<(sizeof(Header) == Alignment)> verifyHeaderSize;
+      sassert<(SecondLevelBits >= 1) && (SecondLevelBits <= 5)> verifySecondLevelFits;
+      verifyHeaderSize = verifyHeaderSize;
+      verifySecondLevelFits = verifySecondLevelFits;
+      for (int i = 0; i < FirstLevelCount; i++) {
+	_secondLevelMap[i] = 0;
+	for (int j = 0; j < SecondLevelCount; j++) {
+	  _lists[i][j] = NULL;
+	}
+      }
+    }
+
+    inline void * malloc (size_t sz) {
+      const size_t size = roundUp (sz);
+      if (size >= MaxBlockSize) {
+	return NULL;
+      }
+      void * ptr = findBlock (size);
+      if (ptr == NULL) {
+	if (!grow (size)) {
+	  return NULL;
+	}
+	ptr = findBlock (size);
+	if (ptr == NULL) {
+	  return NULL;
+	}
+      }
+      removeBlock (ptr);
+      splitBlock (ptr, size);
+      super::markInUse (ptr);
+      return ptr;
+    }
+
+    inline void free (void * ptr) {
+      if (ptr == NULL) {
+	return;
+      }
+      size_t size = super::getSize (ptr);
+      if (super::isPrevFree (ptr)) {
+	void * prev = super::getPrev (ptr);
+	removeBlock (prev);
+	size += super::getSize (prev) + sizeof(Header);
+	ptr = prev;
+      }
+      void * next = (char *) ptr + size + sizeof(Header);
+      if (super::isFree (next)) {
+	removeBlock (next);
+	size += super::getSize (next) + sizeof(Header);
+      }
+      super::setSize (ptr, size);
+      super::getHeader (super::getNext (ptr))->setPrevSize (size);
+      super::markFree (ptr);
+      insertBlock (ptr);
+    }
+
+    /// Add the memory [start, start + bytes) to the heap.
+    bool addPool (void * start, size_t bytes) {
+      char * begin = (char *) (((size_t) start + Alignment - 1) & ~((size_t) Alignment - 1));
+      char * end = (char *) (((size_t) start + bytes) & ~((size_t) Alignment - 1));
+      // A header for the block, and two for the sentinel at the end.
+      if ((end <= begin) || ((size_t) (end - begin) < 3 * sizeof(Header) + MinBlockSize)) {
+	return false;
+      }
+      size_t size = (end - begin) - 3 * sizeof(Header);
+      if (size >= MaxBlockSize) {
+	size = MaxBlockSize - Alignment;
+      }
+      void * ptr = Header::makeObject (begin, 0, size);
+      super::getHeader (ptr)->markPrevInUse();
+      // The sentinel: an empty block, always in use, with a header after it.
+      char * sentinel = (char *) ptr + size;
+      void * last = Header::makeObject (sentinel, size, 0);
+      super::getHeader ((char *) last + sizeof(Header))->markPrevInUse();
+      super::markFree (ptr);
+      insertBlock (ptr);
+      return true;
+    }
+
+  private:
+
+    enum { AlignmentShift = 4 };
+    enum { MinBlockSize = 16 };
+    enum { SecondLevelCount = 1 << SecondLevelBits };
+
+    /// Sizes below this are classed exactly (first-level index 0).
+    enum { SmallBlockSize = 1 << (SecondLevelBits + AlignmentShift) };
+
+    enum { MaxBlockLog = 40 };
+    static const size_t MaxBlockSize = (size_t) 1 << MaxBlockLog;
+    enum { FirstLevelCount = MaxBlockLog - (SecondLevelBits + AlignmentShift) + 1 };
+
+    /// The links of a free block, in its body.
+    class FreeLinks {
+    public:
+      void * next;
+      void * prev;
+    };
+
+    static inline FreeLinks * links (void * ptr) {
+      return (FreeLinks *) ptr;
+    }
+
+    static inline size_t roundUp (size_t sz) {
+      if (sz < MinBlockSize) {
+	return MinBlockSize;
+      }
+      return (sz + Alignment - 1) & ~((size_t) Alignment - 1);
+    }
+
+    static inline int floorLog2 (size_t sz) {
+      return (int) ilog2 (sz + 1) - 1;
+    }
+
+    static inline int lowestBit (uint64_t bits) {
+      return __builtin_ctzll (bits);
+    }
+
+    /// The list a block of this size belongs in.
+    static inline void mapping (size_t size, int& fl, int& sl) {
+      if (size < SmallBlockSize) {
+	fl = 0;
+	sl = (int) (size >> AlignmentShift);
+      } else {
+	const int log = floorLog2 (size);
+	fl = log - (SecondLevelBits + AlignmentShift) + 1;
+	sl = (int) (size >> (log - SecondLevelBits)) ^ SecondLevelCount;
+      }
+    }
+
+    /// A free block of at least size bytes, or NULL (without removing it).
+    inline void * findBlock (size_t size) {
+      // Round up to the next class, so that every block there fits.
+      if (size >= SmallBlockSize) {
+	size += ((size_t) 1 << (floorLog2 (size) - SecondLevelBits)) - 1;
+      }
+      int fl, sl;
+      mapping (size, fl, sl);
+      if (fl >= FirstLevelCount) {
+	return NULL;
+      }
+      uint64_t slMap = _secondLevelMap[fl] & (~(uint64_t) 0 << sl);
+      if (slMap == 0) {
+	const uint64_t flMap = (fl + 1 < 64) ? (_firstLevelMap & (~(uint64_t) 0 << (fl + 1))) : 0;
+	if (flMap == 0) {
+	  return NULL;
+	}
+	fl = lowestBit (flMap);
+	slMap = _secondLevelMap[fl];
+      }
+      sl = lowestBit (slMap);
+      return _lists[fl][sl];
+    }
+
+    inline void insertBlock (void * ptr) {
+      int fl, sl;
+      mapping (super::getSize (ptr), fl, sl);
+      FreeLinks * l = links (ptr);
+      l->prev = NULL;
+      l->next = _lists[fl][sl];
+      if (l->next != NULL) {
+	links (l->next)->prev = ptr;
+      }
+      _lists[fl][sl] = ptr;
+      _firstLevelMap |= (uint64_t) 1 << fl;
+      _secondLevelMap[fl] |= (uint64_t) 1 << sl;
+    }
+
+    inline void removeBlock (void * ptr) {
+      int fl, sl;
+      mapping (super::getSize (ptr), fl, sl);
+      FreeLinks * l = links (ptr);
+      if (l->prev != NULL) {
+	links (l->prev)->next = l->next;
+      } else {
+	_lists[fl][sl] = l->next;
+	if (l->next == NULL) {
+	  _secondLevelMap[fl] &= ~((uint64_t) 1 << sl);
+	  if (_secondLevelMap[fl] == 0) {
+	    _firstLevelMap &= ~((uint64_t) 1 << fl);
+	  }
+	}
+      }
+      if (l->next != NULL) {
+	links (l->next)->prev = l->prev;
+      }
+    }
+
+    /// Return the tail of a block beyond size bytes to the free lists.
+    inline void splitBlock (void * ptr, size_t size) {
+      const size_t total = super::getSize (ptr);
+      if (total - size < sizeof(Header) + MinBlockSize) {
+	return;
+      }
+      super::setSize (ptr, size);
+      void * rest = Header::makeObject ((char *) ptr + size, size, total - size - sizeof(Header));
+      super::getHeader (rest)->markPrevInUse();
+      super::markFree (rest);
+      insertBlock (rest);
+    }
+
+    /// Add a pool from the superheap that can hold a block of size bytes.
+    bool grow (size_t size) {
+      size_t bytes = size + 3 * sizeof(Header) + 2 * Alignment + (size >> SecondLevelBits);
+      if (bytes < ChunkSize) {
+	bytes = ChunkSize;
+      }
+      void * mem = SuperHeap::malloc (bytes);
+      if (mem == NULL) {
+	return false;
+      }
+      return addPool (mem, bytes);
+    }
+
+    uint64_t _firstLevelMap;
+    uint64_t _secondLevelMap[FirstLevelCount];
+    void * _lists[FirstLevelCount][SecondLevelCount];
+  };
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_TUNEDHEAP_H
+#define HL_TUNEDHEAP_H
+
+/**
+ * @file tunedheap.h
+ * @brief A parameterized composition, used as the search space of the autotuner.
+ *
+ * Every knob the autotuner (tools/autotune) varies is a template
+ * parameter here, so that the winning variant can be emitted as a
+ * single typedef.
+ */
+
+#include "utility/ilog2.h"
+#include "heaps/buildingblock/adaptheap.h"
+#include "heaps/combining/strictsegheap.h"
+#include "heaps/general/kingsleyheap.h"
+#include "heaps/objectrep/sizeheap.h"
+#include "heaps/special/zoneheap.h"
+#include "heaps/threads/lockedheap.h"
+#include "heaps/threads/threadheap.h"
+#include "heaps/threads/threadspecificheap.h"
+#include "heaps/top/mmapheap.h"
+#include "heaps/utility/uniqueheap.h"
+#include "utility/dllist.h"
+#include "wrappers/ansiwrapper.h"
+
+#if !defined(_WIN32) // ThreadSpecificHeap is not implemented for Windows.
+
+namespace HL {
+
+  /**
+   * @class KingsleyClasses
+   * @brief Power-of-two size classes (as in KingsleyHeap).
+   */
+
+  class KingsleyClasses {
+  public:
+    enum { NumBins = Kingsley::NUMBINS };
+    static inline int size2Class (const size_t sz) {
+      return Kingsley::size2Class (sz);
+    }
+    static inline size_t class2Size (const int i) {
+      return Kingsley::class2Size (i);
+    }
+  };
+
+  /**
+   * @class FineClasses
+   * @brief 16-byte spaced classes up to 256 bytes, then four classes per power of two.
+   *
+   * Worst-case internal fragmentation is 25% (versus 100% for
+   * power-of-two classes), at the cost of more bins.
+   */
+
+  class FineClasses {
+  public:
+    enum { NumBins = 16 + (31 - 8) * 4 };
+    static inline int size2Class (const size_t sz) {
+      if (sz <= 256) {
+	return (sz == 0) ? 0 : (int) ((sz + 15) >> 4) - 1;
+      }
+      // The floor of log2 (sz - 1).
+      const int p = (int) ilog2 (sz) - 1;
+      return 16 + (p - 8) * 4 + (int) ((sz - 1 - ((size_t) 1 << p)) >> (p - 2));
+    }
+    static inline size_t class2Size (const int i) {
+      if (i < 16) {
+	return (size_t) (i + 1) << 4;
+      }
+      const int p = 8 + (i - 16) / 4;
+      const int r = (i - 16) % 4;
+      return ((size_t) 1 << p) + ((size_t) (r + 1) << (p - 2));
+    }
+  };
+
+
+  /// Picks the threading layer: a per-thread heap, NumHeaps locked
+  /// heaps chosen by thread id, or one locked heap.
+  template <bool PerThreadCache, int NumHeaps, class LockType, class Heap>
+  class TunedThreadLayer :
+    public ThreadHeap<NumHeaps, LockedHeap<LockType, Heap> > {};
+
+  template <class LockType, class Heap>
+  class TunedThreadLayer<false, 1, LockType, Heap> :
+    public LockedHeap<LockType, Heap> {};
+
+  template <int NumHeaps, class LockType, class Heap>
+  class TunedThreadLayer<true, NumHeaps, LockType, Heap> :
+    public ThreadSpecificHeap<Heap> {};
+
+
+  /**
+   * @class TunedHeap
+   * @brief A segregated-fits heap over a shared chunk source, with a chosen threading layer.
+   *
+   * @param Classes        The size-class table (e.g., KingsleyClasses, FineClasses).
+   * @param ChunkSize      The size of the chunks obtained from the OS.
+   * @param NumHeaps       The number of locked heaps (1 = a single locked heap).
+   * @param LockType       The lock protecting shared state.
+   * @param PerThreadCache If true, every thread gets its own heap (NumHeaps is ignored).
+   */
+
+  template <class Classes,
+	    size_t ChunkSize,
+	    int NumHeaps,
+	    class LockType,
+	    bool PerThreadCache>
+  class TunedHeap {
+  public:
+
+    class TopHeap :
+      public SizeHeap<UniqueHeap<LockedHeap<LockType, ZoneHeap<MmapHeap, ChunkSize> > > > {};
+
+    class SegregatedHeap :
+      public StrictSegHeap<Classes::NumBins,
+			   Classes::size2Class,
+			   Classes::class2Size,
+			   AdaptHeap<DLList, TopHeap>,
+			   TopHeap> {};
+
+    class Heap :
+      public ANSIWrapper<TunedThreadLayer<PerThreadCache, NumHeaps, LockType, SegregatedHeap> > {};
+
+  };
+
+}
+
+#endif
+
+#endif
@@ -92,7 +92,7 @@ public:
     inline void sanityCheck (void) {
 #ifndef NDEBUG
       int headerSize = sizeof(Header);
-      assert (headerSize <= sizeof(double));
+      assert (headerSize <= 2 * sizeof(size_t));
       assert (getSize() == getNextHeader()->getPrevSize());
       assert (isFree() == getNextHeader()->isPrevFree());
       assert (getNextHeader()->getPrev() == getObject(this));
@@ -176,7 +176,7 @@ public:
       _currHeap (0)
 #endif
     {
-      assert (sizeof(Header) <= sizeof(double));
+      assert (sizeof(Header) <= 2 * sizeof(size_t));
     }
 
     inline Header * getNextHeader (void) const {
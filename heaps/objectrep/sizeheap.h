@@ -37,6 +37,7 @@
 #include "wrappers/mallocinfo.h"
 #include "heaps/objectrep/addheap.h"
 #include "utility/gcd.h"
+#include "utility/mallocnear.h"
 
 namespace HL {
 
@@ -69,6 +70,14 @@ namespace HL {
       return (void *) (p + 1);
     }
 
+    inline void * mallocNear (size_t sz, const void * hint) {
+      freeObject * p = (freeObject *)
+	MallocNear::allocate (static_cast<SuperHeap&>(*this), sz + sizeof(freeObject), hint);
+      p->_sz = sz;
+      p->_magic = 0xcafebabe;
+      return (void *) (p + 1);
+    }
+
     inline void free (void * ptr) {
       assert (getHeader(ptr)->_magic == 0xcafebabe);
       SuperHeap::free (getHeader(ptr));
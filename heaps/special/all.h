@@ -1,5 +1,10 @@
 #include "bumpalloc.h"
+#include "colorheap.h"
+#include "coroutineframeheap.h"
+#include "lifetimepredictingheap.h"
+#include "meshingheap.h"
 #include "nestedheap.h"
+#include "pageheap.h"
 #include "xallocheap.h"
 #include "zoneheap.h"
 
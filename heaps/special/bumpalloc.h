@@ -57,9 +57,9 @@ namespace HL {
       : _bump (NULL),
 	_remaining (0)
     {
-      sassert<((int) gcd<ChunkSize, Alignment>::VALUE == Alignment)> 
+      sassert<((int) gcd<ChunkSize, Alignment>::value == Alignment)> 
 	verifyAlignmentSatisfiable;
-      sassert<((int) gcd<SuperHeap::Alignment, Alignment>::VALUE == Alignment)>
+      sassert<((int) gcd<SuperHeap::Alignment, Alignment>::value == Alignment)>
 	verifyAlignmentFromSuperHeap;
       sassert<((Alignment & (Alignment-1)) == 0)>
 	verifyPowerOfTwoAlignment;
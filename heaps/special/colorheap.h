@@ -0,0 +1,110 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_COLORHEAP_H
+#define HL_COLORHEAP_H
+
+/**
+ * @class ColorHeap
+ * @brief Rotates the starting cache-line offset of successive objects (slab coloring).
+ *
+ * Page-aligned sources start every chunk and every large object at
+ * page offset 0, so chunk headers, the first objects of chunks and
+ * the starts of large buffers all compete for the same cache sets
+ * (and alias in the L1 every 4K). This layer, placed directly above a
+ * page-aligned source, offsets each object by the next of NumColors
+ * cache-line colors, as in Bonwick's slab allocator. Each object costs
+ * at most NumColors * ColorSize extra bytes.
+ *
+ * The colors rotate across all instances of the layer, so that the
+ * chunks of many small heaps (one per size class or per thread) are
+ * spread as well. The offset is less than the superheap's alignment,
+ * so the original pointer is recovered by masking.
+ *
+ * @param SuperHeap A heap returning memory aligned to at least NumColors * ColorSize.
+ * @param NumColors The number of distinct starting offsets.
+ * @param ColorSize The distance between offsets (a cache line).
+ */
+
+#include <assert.h>
+
+#include <atomic>
+
+#include "utility/gcd.h"
+#include "utility/sassert.h"
+
+namespace HL {
+
+  template <class SuperHeap,
+	    int NumColors = 64,
+	    int ColorSize = 64>
+  class ColorHeap : public SuperHeap {
+  public:
+
+    enum { Alignment = gcd<(int) SuperHeap::Alignment, ColorSize>::value };
+
+    ColorHeap() {
+      sassert<((ColorSize & (ColorSize - 1)) == 0)> verifyPowerOfTwo;
+      sassert<(NumColors * ColorSize <= (int) SuperHeap::Alignment)> verifyColorsFit;
+      verifyPowerOfTwo = verifyPowerOfTwo;
+      verifyColorsFit = verifyColorsFit;
+    }
+
+    inline void * malloc (size_t sz) {
+      const size_t offset =
+	(nextColor().fetch_add (1, std::memory_order_relaxed) % NumColors) * ColorSize;
+      char * ptr = (char *) SuperHeap::malloc (sz + offset);
+      if (ptr == NULL) {
+	return NULL;
+      }
+      assert ((size_t) ptr % SuperHeap::Alignment == 0);
+      return ptr + offset;
+    }
+
+    inline void free (void * ptr) {
+      SuperHeap::free (getBase (ptr));
+    }
+
+    inline size_t getSize (void * ptr) {
+      char * base = getBase (ptr);
+      return SuperHeap::getSize (base) - ((char *) ptr - base);
+    }
+
+  private:
+
+    static inline char * getBase (void * ptr) {
+      return (char *) ((size_t) ptr & ~((size_t) SuperHeap::Alignment - 1));
+    }
+
+    static std::atomic<unsigned int>& nextColor() {
+      static std::atomic<unsigned int> color (0);
+      return color;
+    }
+  };
+
+}
+
+#endif
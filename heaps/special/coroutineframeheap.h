@@ -0,0 +1,273 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_COROUTINEFRAMEHEAP_H
+#define HL_COROUTINEFRAMEHEAP_H
+
+/**
+ * @class CoroutineFrameHeap
+ * @brief Serves coroutine frames from per-thread bump regions with LIFO reuse.
+ *
+ * Every call of a coroutine allocates its frame, whose size is fixed
+ * per coroutine, and the frames of an await chain are mostly freed in
+ * reverse order on the thread that allocated them. Each thread bumps
+ * through a RegionBytes region from the superheap. Freeing the most
+ * recent frame rolls the bump pointer back; any other frame goes onto
+ * the thread's recycling stack for its size (in 16-byte buckets), which
+ * the next frame of that size pops. Frames may be freed on any thread.
+ *
+ * Sizes are passed to free (from the sized operator delete that a
+ * promise type declares; see CoroutineFrameAllocation), so frames carry
+ * no header. Frames over MaxFrameSize go directly to the superheap.
+ * When a thread exits, its stacks go to a shared set that other threads
+ * draw from; the unused tail of its region is abandoned.
+ *
+ * @param SuperHeap The source of regions and large frames (frees by pointer).
+ * @param RegionBytes The size of each thread's bump regions.
+ * @param MaxFrameSize The largest frame served from regions.
+ */
+
+#include <assert.h>
+
+#include <atomic>
+#include <new>
+
+#include "heaps/top/mmapheap.h"
+#include "locks/spinlock.h"
+#include "utility/guard.h"
+#include "utility/sassert.h"
+#include "utility/singleton.h"
+
+namespace HL {
+
+  template <class SuperHeap,
+	    size_t RegionBytes = 256 * 1024,
+	    size_t MaxFrameSize = 4096>
+  class CoroutineFrameHeap {
+  public:
+
+    enum { Alignment = 16 };
+
+    CoroutineFrameHeap() {
+      sassert<(MaxFrameSize % Alignment == 0)> verifyBucketed;
+      sassert<(RegionBytes >= MaxFrameSize)> verifyRegionHoldsFrame;
+      sassert<((int) SuperHeap::Alignment % Alignment == 0)> verifyAlignment;
+      verifyBucketed = verifyBucketed;
+      verifyRegionHoldsFrame = verifyRegionHoldsFrame;
+      verifyAlignment = verifyAlignment;
+    }
+
+    inline void * malloc (size_t sz) {
+      if (sz > MaxFrameSize) {
+	Shared& s = shared();
+	Guard<SpinLockType> l (s.lock);
+	return s.superHeap.malloc (sz);
+      }
+      const size_t rounded = roundUp (sz);
+      const int b = bucket (rounded);
+      ThreadState& ts = threadState();
+      Frame * f = ts.stacks[b];
+      if (f == NULL) {
+	f = takeShared (ts, b);
+      }
+      if (f != NULL) {
+	ts.stacks[b] = f->next;
+	return f;
+      }
+      if (ts.bump + rounded > ts.end) {
+	if (!newRegion (ts)) {
+	  return NULL;
+	}
+      }
+      void * ptr = ts.bump;
+      ts.bump += rounded;
+      return ptr;
+    }
+
+    inline void free (void * ptr, size_t sz) {
+      if (ptr == NULL) {
+	return;
+      }
+      if (sz > MaxFrameSize) {
+	Shared& s = shared();
+	Guard<SpinLockType> l (s.lock);
+	s.superHeap.free (ptr);
+	return;
+      }
+      const size_t rounded = roundUp (sz);
+      ThreadState& ts = threadState();
+      if (((char *) ptr + rounded == ts.bump) && ((char *) ptr >= ts.start)) {
+	// The most recent frame: pop it off the region.
+	ts.bump = (char *) ptr;
+	return;
+      }
+      const int b = bucket (rounded);
+      Frame * f = (Frame *) ptr;
+      f->next = ts.stacks[b];
+      ts.stacks[b] = f;
+    }
+
+  private:
+
+    enum { NumBuckets = MaxFrameSize / Alignment };
+
+    class Frame {
+    public:
+      Frame * next;
+    };
+
+    /// Frames left behind by exited threads, and the superheap.
+    class Shared {
+    public:
+      Shared() {
+	for (int i = 0; i < NumBuckets; i++) {
+	  stacks[i] = NULL;
+	  nonEmpty[i].store (false);
+	}
+      }
+      SpinLockType lock;
+      SuperHeap superHeap;
+      Frame * stacks[NumBuckets];
+      std::atomic<bool> nonEmpty[NumBuckets];
+    };
+
+    class ThreadState {
+    public:
+      ThreadState()
+	: start (NULL),
+	  bump (NULL),
+	  end (NULL)
+      {
+	for (int i = 0; i < NumBuckets; i++) {
+	  stacks[i] = NULL;
+	}
+      }
+      ~ThreadState() {
+	Shared& s = shared();
+	Guard<SpinLockType> l (s.lock);
+	for (int i = 0; i < NumBuckets; i++) {
+	  if (stacks[i] == NULL) {
+	    continue;
+	  }
+	  Frame * last = stacks[i];
+	  while (last->next != NULL) {
+	    last = last->next;
+	  }
+	  last->next = s.stacks[i];
+	  s.stacks[i] = stacks[i];
+	  s.nonEmpty[i].store (true, std::memory_order_relaxed);
+	  stacks[i] = NULL;
+	}
+      }
+      char * start;
+      char * bump;
+      char * end;
+      Frame * stacks[NumBuckets];
+    };
+
+    static inline size_t roundUp (size_t sz) {
+      return (sz + Alignment - 1) & ~((size_t) Alignment - 1);
+    }
+
+    static inline int bucket (size_t rounded) {
+      return (int) (rounded / Alignment) - 1;
+    }
+
+    static Shared& shared() {
+      return singleton<Shared>::getInstance();
+    }
+
+    static ThreadState& threadState() {
+      static thread_local ThreadState ts;
+      return ts;
+    }
+
+    /// Adopt the shared stack for bucket b, if there is one.
+    static Frame * takeShared (ThreadState& ts, int b) {
+      Shared& s = shared();
+      if (!s.nonEmpty[b].load (std::memory_order_relaxed)) {
+	return NULL;
+      }
+      Guard<SpinLockType> l (s.lock);
+      ts.stacks[b] = s.stacks[b];
+      s.stacks[b] = NULL;
+      s.nonEmpty[b].store (false, std::memory_order_relaxed);
+      return ts.stacks[b];
+    }
+
+    static bool newRegion (ThreadState& ts) {
+      Shared& s = shared();
+      char * region;
+      {
+	Guard<SpinLockType> l (s.lock);
+	region = (char *) s.superHeap.malloc (RegionBytes);
+      }
+      if (region == NULL) {
+	return false;
+      }
+      ts.start = region;
+      ts.bump = region;
+      ts.end = region + RegionBytes;
+      return true;
+    }
+  };
+
+
+  /**
+   * @class CoroutineFrameAllocation
+   * @brief A promise_type mixin that allocates coroutine frames from a CoroutineFrameHeap.
+   *
+   * The compiler allocates a coroutine's frame with its promise
+   * type's operator new, and frees it with the sized operator delete.
+   *
+   * <TT>
+   *   struct promise_type : public CoroutineFrameAllocation<> { ... };
+   * </TT>
+   */
+
+  template <class Heap = CoroutineFrameHeap<MmapHeap> >
+  class CoroutineFrameAllocation {
+  public:
+    static void * operator new (size_t sz) {
+      void * ptr = getHeap().malloc (sz);
+      if (ptr == NULL) {
+	throw std::bad_alloc();
+      }
+      return ptr;
+    }
+    static void operator delete (void * ptr, size_t sz) {
+      getHeap().free (ptr, sz);
+    }
+
+  private:
+    static Heap& getHeap() {
+      return singleton<Heap>::getInstance();
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,473 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_LIFETIMEPREDICTINGHEAP_H
+#define HL_LIFETIMEPREDICTINGHEAP_H
+
+/**
+ * @class LifetimePredictingHeap
+ * @brief Bump-allocates objects from sites predicted to be short-lived; everything else goes to SuperHeap.
+ *
+ * Predictions come from a lifetime profile (see LifetimeHeap::dump),
+ * loaded with loadProfile. Each thread bump-allocates the objects of a
+ * short-lived site from a chunk of its own. Chunks count their live
+ * objects and are recycled whole once the count drops to zero.
+ *
+ * Chunks are carved from one reserved region, so ownership is a range
+ * check. Each chunk names its site, so a misprediction shows up as a
+ * sealed chunk that stays live. When a site accumulates MaxStrikes
+ * such chunks, it is demoted and its later objects go to SuperHeap.
+ * A sealed chunk counts as lingering once GraceChunks more chunks
+ * have been sealed heap-wide.
+ *
+ * SuperHeap must be thread-safe if the program is threaded; the
+ * arena path is. The per-thread chunk caches are shared by all
+ * instances of one template instantiation, so use one instance.
+ *
+ * @param SuperHeap  The general-purpose heap.
+ * @param ChunkSize  The size (and alignment) of arena chunks.
+ * @param ArenaBytes The size of the region reserved for chunks.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "locks/spinlock.h"
+#include "utility/align.h"
+#include "utility/callsite.h"
+#include "utility/gcd.h"
+#include "utility/guard.h"
+#include "wrappers/mmapwrapper.h"
+
+namespace HL {
+
+  template <class SuperHeap,
+	    size_t ChunkSize = 65536,
+	    size_t ArenaBytes = 1UL << 30>
+  class LifetimePredictingHeap : public SuperHeap {
+  public:
+
+    enum { Alignment = gcd<(int) SuperHeap::Alignment, 16>::value };
+
+    /// Predicted lifetimes.
+    enum { SHORT, MEDIUM, LONG };
+
+    enum { MaxSites = 4096 };
+
+    /// Larger objects always go to SuperHeap.
+    enum { MaxArenaObject = ChunkSize / 8 };
+
+    enum { GraceChunks = 64 };
+    enum { MaxStrikes = 4 };
+
+    LifetimePredictingHeap()
+      : _epoch (0),
+	_carved (0),
+	_freeChunks (NULL),
+	_arenaAllocations (0),
+	_recycled (0),
+	_demotions (0)
+    {
+      sassert<((ChunkSize & (ChunkSize - 1)) == 0)> verifyPowerOfTwo;
+      verifyPowerOfTwo = verifyPowerOfTwo;
+      for (int i = 0; i < GraceChunks; i++) {
+	_recentlySealed[i] = NULL;
+      }
+      for (int i = 0; i < MaxSites; i++) {
+	_sites[i].site = NULL;
+	_sites[i].prediction = MEDIUM;
+	_sites[i].strikes = 0;
+      }
+      // Reserve the region, aligned to the chunk size; chunks are committed as carved.
+      char * region = (char *) MmapWrapper::reserve (ArenaBytes + ChunkSize);
+      if (region == NULL) {
+	_start = _end = NULL;
+      } else {
+	_start = (char *) align<ChunkSize> ((size_t) region);
+	_end = _start + ArenaBytes;
+      }
+    }
+
+    NO_INLINE void * malloc (size_t sz) {
+      return malloc (sz, HL_RETURN_ADDRESS());
+    }
+
+    /// Allocate on behalf of an explicit site tag.
+    inline void * malloc (size_t sz, void * site) {
+      if (sz <= MaxArenaObject) {
+	Site * s = lookupSite (site);
+	if ((s != NULL) && (s->prediction.load (std::memory_order_relaxed) == SHORT)) {
+	  void * ptr = arenaMalloc (sz, (int) (s - _sites));
+	  if (ptr != NULL) {
+	    return ptr;
+	  }
+	}
+      }
+      return SuperHeap::malloc (sz);
+    }
+
+    inline void free (void * ptr) {
+      if (inArena (ptr)) {
+	release (getChunk (ptr));
+      } else {
+	SuperHeap::free (ptr);
+      }
+    }
+
+    inline size_t getSize (void * ptr) {
+      if (inArena (ptr)) {
+	return ((ObjectHeader *) ptr - 1)->size;
+      }
+      return SuperHeap::getSize (ptr);
+    }
+
+    /// Set the prediction for a site (or tag).
+    bool setPrediction (void * site, int prediction) {
+      Site * s = claimSite (site);
+      if (s == NULL) {
+	return false;
+      }
+      s->strikes.store (0);
+      s->prediction.store (prediction);
+      return true;
+    }
+
+    /// The current prediction for a site.
+    int getPrediction (void * site) {
+      Site * s = lookupSite (site);
+      return s ? s->prediction.load() : (int) MEDIUM;
+    }
+
+    /**
+     * Load predictions from a file whose lines are either a
+     * LifetimeHeap dump or "<site> <short|medium|long>". Returns the
+     * number of sites loaded.
+     */
+    int loadProfile (const char * fname) {
+      FILE * f = fopen (fname, "r");
+      if (f == NULL) {
+	return 0;
+      }
+      int loaded = 0;
+      char buf[1024];
+      char name[512];
+      char cls[32];
+      while (fgets (buf, sizeof(buf), f)) {
+	if (buf[0] == '#') {
+	  continue;
+	}
+	if ((sscanf (buf, "site %511s %*lu %*lu %31s", name, cls) != 2)
+	    && (sscanf (buf, "%511s %31s", name, cls) != 2)) {
+	  continue;
+	}
+	int prediction;
+	if (strcmp (cls, "short") == 0) {
+	  prediction = SHORT;
+	} else if (strcmp (cls, "medium") == 0) {
+	  prediction = MEDIUM;
+	} else if (strcmp (cls, "long") == 0) {
+	  prediction = LONG;
+	} else {
+	  continue;
+	}
+	void * site = CallSite::resolve (name);
+	if ((site != NULL) && setPrediction (site, prediction)) {
+	  loaded++;
+	}
+      }
+      fclose (f);
+      return loaded;
+    }
+
+    /// The number of objects bump-allocated from arena chunks.
+    unsigned long getArenaAllocations() const {
+      return _arenaAllocations.load();
+    }
+
+    /// The number of chunks recycled after all their objects died.
+    unsigned long getRecycledChunks() const {
+      return _recycled.load();
+    }
+
+    /// The number of sites demoted after mispredictions.
+    unsigned long getDemotions() const {
+      return _demotions.load();
+    }
+
+  private:
+
+    enum { FREE, ACTIVE, SEALED };
+
+    /// Per-thread current chunks, hashed by site slot.
+    enum { NumCurrent = 64 };
+
+    /// The slots searched for a site's current chunk.
+    enum { NumProbes = 8 };
+
+    class Site {
+    public:
+      std::atomic<void *> site;
+      std::atomic<int> prediction;
+      std::atomic<int> strikes;
+    };
+
+    class Chunk {
+    public:
+      /// Live objects, plus one while a thread allocates from it.
+      std::atomic<long> live;
+      std::atomic<int> state;
+      /// The sealedAt of the sealing already charged as a strike.
+      std::atomic<unsigned long> chargedAt;
+      std::atomic<unsigned long> sealedAt;
+      std::atomic<int> site;
+      char * bump;
+      char * end;
+      Chunk * next;
+    };
+
+    class ObjectHeader {
+    public:
+      size_t size;
+      size_t pad;
+    };
+
+    /// The chunks each thread is filling; sealed when the thread exits.
+    class ThreadChunks {
+    public:
+      ~ThreadChunks() {
+	for (int i = 0; i < NumCurrent; i++) {
+	  if (chunks[i] != NULL) {
+	    heap->seal (chunks[i]);
+	    chunks[i] = NULL;
+	  }
+	}
+      }
+      LifetimePredictingHeap * heap;
+      Chunk * chunks[NumCurrent];
+    };
+
+    static ThreadChunks& threadChunks() {
+      static thread_local ThreadChunks tc;
+      return tc;
+    }
+
+    inline bool inArena (void * ptr) const {
+      return ((char *) ptr >= _start) && ((char *) ptr < _end);
+    }
+
+    static inline Chunk * getChunk (void * ptr) {
+      return (Chunk *) ((size_t) ptr & ~(ChunkSize - 1));
+    }
+
+    inline void * arenaMalloc (size_t sz, int siteIndex) {
+      const size_t need = align<16> (sz) + sizeof(ObjectHeader);
+      ThreadChunks& tc = threadChunks();
+      tc.heap = this;
+      Chunk *& c = currentChunk (tc, siteIndex);
+      if ((c == NULL) || (c->site.load (std::memory_order_relaxed) != siteIndex) || (c->bump + need > c->end)) {
+	if (c != NULL) {
+	  seal (c);
+	}
+	c = newChunk (siteIndex);
+	if (c == NULL) {
+	  return NULL;
+	}
+      }
+      ObjectHeader * h = (ObjectHeader *) c->bump;
+      c->bump += need;
+      h->size = sz;
+      c->live.fetch_add (1, std::memory_order_relaxed);
+      _arenaAllocations.fetch_add (1, std::memory_order_relaxed);
+      return (void *) (h + 1);
+    }
+
+    /// The slot for a site's current chunk: its own, else an empty one, else the site's home slot.
+    static Chunk *& currentChunk (ThreadChunks& tc, int siteIndex) {
+      const int home = siteIndex % NumCurrent;
+      int empty = -1;
+      for (int i = 0; i < NumProbes; i++) {
+	const int slot = (home + i) % NumCurrent;
+	Chunk * c = tc.chunks[slot];
+	if (c == NULL) {
+	  if (empty < 0) {
+	    empty = slot;
+	  }
+	} else if (c->site.load (std::memory_order_relaxed) == siteIndex) {
+	  return tc.chunks[slot];
+	}
+      }
+      return tc.chunks[(empty >= 0) ? empty : home];
+    }
+
+    Chunk * newChunk (int siteIndex) {
+      Chunk * c = NULL;
+      {
+	Guard<SpinLockType> l (_lock);
+	if (_freeChunks != NULL) {
+	  c = _freeChunks;
+	  _freeChunks = c->next;
+	} else {
+	  const size_t offset = _carved.load();
+	  if ((_start == NULL) || (offset + ChunkSize > ArenaBytes)) {
+	    // Out of arena: everything falls back to SuperHeap.
+	    return NULL;
+	  }
+	  c = (Chunk *) (_start + offset);
+	  if (!MmapWrapper::commit (c, ChunkSize)) {
+	    return NULL;
+	  }
+	  // Publish the chunk only once committed, since checkForLingering reads it.
+	  _carved.store (offset + ChunkSize);
+	}
+      }
+      c->live.store (1);
+      c->sealedAt.store (0);
+      c->site.store (siteIndex);
+      c->bump = (char *) c + align<16> (sizeof(Chunk));
+      c->end = (char *) c + ChunkSize;
+      c->next = NULL;
+      c->state.store (ACTIVE, std::memory_order_release);
+      return c;
+    }
+
+    /// The allocating thread is done with this chunk.
+    void seal (Chunk * c) {
+      const unsigned long epoch = _epoch.fetch_add (1) + 1;
+      c->sealedAt.store (epoch);
+      c->state.store (SEALED, std::memory_order_release);
+      // The chunk sealed GraceChunks ago is now old enough to judge.
+      Chunk * old = _recentlySealed[epoch % GraceChunks].exchange (c);
+      if (old != NULL) {
+	checkForLingering (old);
+      }
+      release (c);
+    }
+
+    inline void release (Chunk * c) {
+      if (c->live.fetch_sub (1, std::memory_order_acq_rel) == 1) {
+	// Every object is dead: recycle the whole chunk.
+	c->state.store (FREE, std::memory_order_release);
+	Guard<SpinLockType> l (_lock);
+	c->next = _freeChunks;
+	_freeChunks = c;
+	_recycled.fetch_add (1, std::memory_order_relaxed);
+      }
+    }
+
+    /// Charge a strike to the site of a sealed chunk that is still live.
+    void checkForLingering (Chunk * c) {
+      const unsigned long sealedAt = c->sealedAt.load();
+      if ((c->state.load() != SEALED)
+	  || (c->live.load() == 0)
+	  || (_epoch.load() - sealedAt < (unsigned long) GraceChunks)) {
+	return;
+      }
+      const int site = c->site.load();
+      // The chunk may have been recycled and resealed since; every
+      // sealing has its own epoch, so an unchanged one means the site
+      // read belongs to the sealing checked above.
+      if ((c->state.load() != SEALED)
+	  || (c->sealedAt.load() != sealedAt)
+	  || (c->chargedAt.exchange (sealedAt) == sealedAt)) {
+	return;
+      }
+      Site& s = _sites[site];
+      if (s.strikes.fetch_add (1) + 1 == MaxStrikes) {
+	int expected = SHORT;
+	if (s.prediction.compare_exchange_strong (expected, LONG)) {
+	  _demotions.fetch_add (1);
+	}
+      }
+    }
+
+    static inline size_t hashSite (void * site) {
+      size_t h = (size_t) site;
+      h ^= h >> 17;
+      h *= 0x9e3779b97f4a7c15ULL;
+      return h ^ (h >> 29);
+    }
+
+    inline Site * lookupSite (void * site) {
+      size_t i = hashSite (site) % MaxSites;
+      for (int probes = 0; probes < MaxSites; probes++) {
+	void * current = _sites[i].site.load (std::memory_order_acquire);
+	if (current == site) {
+	  return &_sites[i];
+	}
+	if (current == NULL) {
+	  return NULL;
+	}
+	i = (i + 1) % MaxSites;
+      }
+      return NULL;
+    }
+
+    Site * claimSite (void * site) {
+      size_t i = hashSite (site) % MaxSites;
+      for (int probes = 0; probes < MaxSites; probes++) {
+	void * current = _sites[i].site.load (std::memory_order_acquire);
+	if (current == site) {
+	  return &_sites[i];
+	}
+	if (current == NULL) {
+	  if (_sites[i].site.compare_exchange_strong (current, site)
+	      || (current == site)) {
+	    return &_sites[i];
+	  }
+	}
+	i = (i + 1) % MaxSites;
+      }
+      return NULL;
+    }
+
+    char * _start;
+    char * _end;
+
+    /// Chunks sealed so far (the clock for lingering).
+    std::atomic<unsigned long> _epoch;
+
+    /// The last GraceChunks chunks sealed, by epoch.
+    std::atomic<Chunk *> _recentlySealed[GraceChunks];
+
+    /// Bytes of the region handed out as chunks.
+    std::atomic<size_t> _carved;
+
+    SpinLockType _lock;
+    Chunk * _freeChunks;
+
+    std::atomic<unsigned long> _arenaAllocations;
+    std::atomic<unsigned long> _recycled;
+    std::atomic<unsigned long> _demotions;
+
+    Site _sites[MaxSites];
+  };
+
+}
+
+#endif
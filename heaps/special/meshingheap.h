@@ -0,0 +1,700 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_MESHINGHEAP_H
+#define HL_MESHINGHEAP_H
+
+/**
+ * @class MeshingHeap
+ * @brief Compacts fragmented small-object pages without moving any pointer (meshing).
+ *
+ * Small objects are carved out of pages of a single size class, and
+ * every page is backed by a page of an anonymous memory file (memfd)
+ * rather than by private anonymous memory. When a program frees most
+ * of the objects on many pages, those pages stay resident. A meshing
+ * pass (run on demand by mesh(), or periodically by a background
+ * thread started with startMeshing()) looks for pairs of pages of the
+ * same class whose live-object bitmaps do not overlap, copies the
+ * live objects of one page into the other at the same offsets, and
+ * then maps the virtual page of the first onto the physical page of
+ * the second with mmap(MAP_FIXED). Both virtual addresses remain
+ * valid, every object keeps its address, and one physical page is
+ * returned to the kernel (Powers et al., "Mesh: Compacting Memory
+ * Management for C/C++ Applications", PLDI 2019).
+ *
+ * Objects are placed in a random free slot of their page, which
+ * makes non-overlapping pages likely even for regular workloads.
+ * A physical page may back at most MaxSpans virtual pages.
+ *
+ * While a page is being copied, it is write-protected; a thread that
+ * writes to it takes a fault, which a SIGSEGV handler absorbs by
+ * waiting until the remapping is complete and then retrying the
+ * write, which then lands on the merged page. Frees only touch the
+ * (out-of-line) bitmaps, so they never fault. Writes made by the
+ * kernel on the program's behalf do not fault either: a read(2) or
+ * recv(2) into an object on a page being meshed fails with EFAULT,
+ * and the caller has to retry it. All metadata is
+ * protected by a single lock; put the heap behind a per-thread cache
+ * if it is contended.
+ *
+ * Objects larger than MaxObjectSize, and allocations once the arena
+ * is exhausted, are passed to the superheap.
+ *
+ * Linux only (memfd_create, fallocate and the fault handler).
+ *
+ * @param SuperHeap The source of large objects, which must provide getSize.
+ * @param ArenaBytes The virtual address range reserved for small objects.
+ */
+
+#if defined(__linux__)
+
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+
+#include "heaps/buildingblock/freelistheap.h"
+#include "heaps/special/bumpalloc.h"
+#include "heaps/top/mmapheap.h"
+#include "locks/spinlock.h"
+#include "threads/fred.h"
+#include "utility/gcd.h"
+#include "utility/guard.h"
+#include "utility/sassert.h"
+#include "wrappers/mmapwrapper.h"
+
+#if !defined(FALLOC_FL_KEEP_SIZE)
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+#if !defined(FALLOC_FL_PUNCH_HOLE)
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+
+namespace HL {
+
+  /**
+   * @class MeshBarrier
+   * @brief The write barrier shared by all meshing heaps.
+   *
+   * Records the arenas of every MeshingHeap, and installs (once) a
+   * SIGSEGV handler that stalls writes to an arena while any heap is
+   * remapping pages. Faults outside the arenas, and faults inside one
+   * that recur with no remapping in between, go to the previously
+   * installed handler.
+   */
+
+  class MeshBarrier {
+  public:
+
+    enum { MaxArenas = 16 };
+
+    static bool registerArena (char * start, size_t length) {
+      installHandler();
+      for (int i = 0; i < MaxArenas; i++) {
+	char * unused = NULL;
+	if (arenas()[i].start.compare_exchange_strong (unused, start)) {
+	  arenas()[i].end.store (start + length, std::memory_order_release);
+	  return true;
+	}
+      }
+      return false;
+    }
+
+    static void deregisterArena (char * start) {
+      for (int i = 0; i < MaxArenas; i++) {
+	if (arenas()[i].start.load() == start) {
+	  arenas()[i].end.store (NULL, std::memory_order_release);
+	  arenas()[i].start.store (NULL, std::memory_order_release);
+	  return;
+	}
+      }
+    }
+
+    /// Writes to protected pages stall from begin() until end().
+    static inline void begin() {
+      meshing().fetch_add (1);
+    }
+
+    static inline void end() {
+      generation().fetch_add (1);
+      meshing().fetch_sub (1);
+    }
+
+  private:
+
+    class Arena {
+    public:
+      std::atomic<char *> start;
+      std::atomic<char *> end;
+    };
+
+    static Arena * arenas() {
+      static Arena a[MaxArenas];
+      return a;
+    }
+
+    static std::atomic<int>& meshing() {
+      static std::atomic<int> m (0);
+      return m;
+    }
+
+    /// The number of remappings completed so far.
+    static std::atomic<unsigned long>& generation() {
+      static std::atomic<unsigned long> g (0);
+      return g;
+    }
+
+    static struct sigaction& previous() {
+      static struct sigaction p;
+      return p;
+    }
+
+    static bool inArena (char * addr) {
+      for (int i = 0; i < MaxArenas; i++) {
+	Arena& a = arenas()[i];
+	char * start = a.start.load (std::memory_order_acquire);
+	char * end = a.end.load (std::memory_order_acquire);
+	// Skip free slots, and slots being reused under us.
+	if ((start == NULL) || (end == NULL) || (a.start.load() != start)) {
+	  continue;
+	}
+	if ((addr >= start) && (addr < end)) {
+	  return true;
+	}
+      }
+      return false;
+    }
+
+    static void installHandler() {
+      static std::atomic<bool> installed (false);
+      if (installed.exchange (true)) {
+	return;
+      }
+      struct sigaction action;
+      memset (&action, 0, sizeof(action));
+      action.sa_sigaction = handler;
+      action.sa_flags = SA_SIGINFO | SA_RESTART;
+      sigemptyset (&action.sa_mask);
+      sigaction (SIGSEGV, &action, &previous());
+    }
+
+    static void handler (int sig, siginfo_t * info, void * context) {
+      // The last arena fault this thread retried, and when.
+      static __thread char * lastFault;
+      static __thread unsigned long lastGeneration;
+      char * addr = (char *) info->si_addr;
+      if (inArena (addr)) {
+	// Arena pages are only ever read-only while being meshed:
+	// wait for the remapping to finish, then retry the write. The
+	// remapping may also have finished before we got here, so
+	// retry once even if none is in progress; a fault that recurs
+	// with no remapping in between is a genuine one.
+	const bool waited = (meshing().load() > 0);
+	while (meshing().load() > 0) {
+	  sched_yield();
+	}
+	const unsigned long g = generation().load();
+	if (waited || (addr != lastFault) || (g != lastGeneration)) {
+	  lastFault = addr;
+	  lastGeneration = g;
+	  return;
+	}
+	lastFault = NULL;
+      }
+      struct sigaction& prev = previous();
+      if (prev.sa_flags & SA_SIGINFO) {
+	prev.sa_sigaction (sig, info, context);
+      } else if ((prev.sa_handler != SIG_DFL) && (prev.sa_handler != SIG_IGN)) {
+	prev.sa_handler (sig);
+      } else {
+	// Fall back to the default action; the fault recurs on return.
+	signal (SIGSEGV, SIG_DFL);
+      }
+    }
+
+  };
+
+
+  template <class SuperHeap,
+	    size_t ArenaBytes = 1UL << 30>
+  class MeshingHeap : public SuperHeap {
+  public:
+
+    enum { PageSize = 4096 };
+    enum { MaxObjectSize = 1024 };
+    enum { ClassSpacing = 16 };
+    enum { NumClasses = MaxObjectSize / ClassSpacing };
+    enum { MaxSpans = 4 };
+    enum { MaxObjects = PageSize / ClassSpacing };
+    enum { BitmapWords = MaxObjects / 64 };
+    enum { Alignment = gcd<ClassSpacing, (int) SuperHeap::Alignment>::value };
+
+    MeshingHeap()
+      : _fd (-1),
+	_arena (NULL),
+	_pageTable (NULL),
+	_freePages (NULL),
+	_nextPage (0),
+	_numFreePages (0),
+	_numMiniHeaps (0),
+	_meshedPages (0),
+	_meshes (0),
+	_rng (88172645463325252ULL),
+	_running (false)
+    {
+      sassert<(ArenaBytes % PageSize == 0)> verifyArenaSize;
+      verifyArenaSize = verifyArenaSize;
+      for (int i = 0; i < NumClasses; i++) {
+	_current[i] = NULL;
+	_partial[i] = NULL;
+      }
+      _fd = (int) syscall (__NR_memfd_create, "hl-mesh", 1U /* MFD_CLOEXEC */);
+      if ((_fd < 0) || (ftruncate (_fd, ArenaBytes) != 0)) {
+	releaseArena();
+	return;
+      }
+      _arena = (char *) MmapWrapper::mapShared (_fd, ArenaBytes, 0);
+      _pageTable = (MiniHeap **) MmapWrapper::map (NumPages * sizeof(MiniHeap *));
+      _freePages = (uint32_t *) MmapWrapper::map (NumPages * sizeof(uint32_t));
+      if ((_arena == NULL) || (_pageTable == NULL) || (_freePages == NULL)
+	  || !MeshBarrier::registerArena (_arena, ArenaBytes)) {
+	releaseArena();
+      }
+    }
+
+    ~MeshingHeap() {
+      stopMeshing();
+      if (_arena != NULL) {
+	MeshBarrier::deregisterArena (_arena);
+      }
+      releaseArena();
+    }
+
+    inline void * malloc (size_t sz) {
+      if ((sz > MaxObjectSize) || (_arena == NULL)) {
+	return SuperHeap::malloc (sz);
+      }
+      const int c = sizeClass (sz);
+      Guard<SpinLockType> l (_lock);
+      MiniHeap * mh = _current[c];
+      if ((mh == NULL) || (mh->live == mh->numObjects)) {
+	mh = refill (c);
+	if (mh == NULL) {
+	  return SuperHeap::malloc (sz);
+	}
+      }
+      return mh->allocate (nextRandom());
+    }
+
+    inline void free (void * ptr) {
+      if (!inArena (ptr)) {
+	SuperHeap::free (ptr);
+	return;
+      }
+      const size_t page = pageOf (ptr);
+      Guard<SpinLockType> l (_lock);
+      MiniHeap * mh = _pageTable[page];
+      assert (mh != NULL);
+      const bool wasFull = (mh->live == mh->numObjects);
+      mh->release (((size_t) ptr & (PageSize - 1)) / mh->objectSize);
+      if (mh == _current[mh->sizeClass]) {
+	return;
+      }
+      if (mh->live == 0) {
+	removePartial (mh);
+	destroy (mh);
+      } else if (wasFull) {
+	insertPartial (mh);
+      }
+    }
+
+    inline size_t getSize (void * ptr) {
+      if (!inArena (ptr)) {
+	return SuperHeap::getSize (ptr);
+      }
+      Guard<SpinLockType> l (_lock);
+      MiniHeap * mh = _pageTable[pageOf (ptr)];
+      return (mh != NULL) ? mh->objectSize : 0;
+    }
+
+    /// Mesh every size class once; returns the number of pages released.
+    size_t mesh() {
+      size_t released = 0;
+      for (int c = 0; c < NumClasses; c++) {
+	Guard<SpinLockType> l (_lock);
+	released += meshClass (c);
+      }
+      return released;
+    }
+
+    /// Run mesh() every periodMs milliseconds on a background thread.
+    void startMeshing (unsigned long periodMs) {
+      if (_running.exchange (true)) {
+	return;
+      }
+      _periodMs = periodMs;
+      _mesher.create (mesherThread, this);
+    }
+
+    void stopMeshing() {
+      if (_running.exchange (false)) {
+	_mesher.join();
+      }
+    }
+
+    /// Physical pages currently holding small objects.
+    size_t getPhysicalPages() const { return _numMiniHeaps; }
+
+    /// Physical pages released by meshing since startup.
+    size_t getMeshedPages() const { return _meshedPages; }
+
+    /// The number of page pairs meshed since startup.
+    size_t getMeshes() const { return _meshes; }
+
+  private:
+
+    enum { NumPages = ArenaBytes / PageSize };
+
+    /// One physical page of objects of a single size class, and the
+    /// virtual pages (spans) mapped onto it.
+    class MiniHeap {
+    public:
+
+      void * allocate (uint64_t r) {
+	assert (live < numObjects);
+	// Start the search for a free slot at a random position.
+	size_t slot = r % numObjects;
+	while (true) {
+	  uint64_t freeBits = ~bitmap[slot / 64] & (~0ULL << (slot % 64));
+	  if (freeBits) {
+	    slot = (slot & ~63UL) + __builtin_ctzll (freeBits);
+	    if (slot < numObjects) {
+	      break;
+	    }
+	  }
+	  slot = (slot & ~63UL) + 64;
+	  if (slot >= numObjects) {
+	    slot = 0;
+	  }
+	}
+	bitmap[slot / 64] |= (1ULL << (slot % 64));
+	live++;
+	return base + slot * objectSize;
+      }
+
+      void release (size_t slot) {
+	assert (bitmap[slot / 64] & (1ULL << (slot % 64)));
+	bitmap[slot / 64] &= ~(1ULL << (slot % 64));
+	live--;
+      }
+
+      bool overlaps (const MiniHeap * other) const {
+	for (int i = 0; i < BitmapWords; i++) {
+	  if (bitmap[i] & other->bitmap[i]) {
+	    return true;
+	  }
+	}
+	return false;
+      }
+
+      int sizeClass;
+      size_t objectSize;
+      size_t numObjects;
+      size_t live;
+      uint64_t bitmap[BitmapWords];
+      /// Any one of the virtual pages; all show the same contents.
+      char * base;
+      /// The memfd page holding the objects.
+      size_t filePage;
+      size_t spans[MaxSpans];
+      int numSpans;
+      MiniHeap * prev;
+      MiniHeap * next;
+      bool inPartial;
+    };
+
+    static inline int sizeClass (size_t sz) {
+      return (sz == 0) ? 0 : (int) ((sz - 1) / ClassSpacing);
+    }
+
+    inline bool inArena (void * ptr) const {
+      return ((char *) ptr >= _arena) && ((char *) ptr < _arena + ArenaBytes);
+    }
+
+    inline size_t pageOf (void * ptr) const {
+      return ((char *) ptr - _arena) / PageSize;
+    }
+
+    /// Unmap the arena and its tables, and close the memory file.
+    void releaseArena() {
+      if (_arena != NULL) {
+	MmapWrapper::unmap (_arena, ArenaBytes);
+	_arena = NULL;
+      }
+      if (_pageTable != NULL) {
+	MmapWrapper::unmap (_pageTable, NumPages * sizeof(MiniHeap *));
+	_pageTable = NULL;
+      }
+      if (_freePages != NULL) {
+	MmapWrapper::unmap (_freePages, NumPages * sizeof(uint32_t));
+	_freePages = NULL;
+      }
+      if (_fd >= 0) {
+	close (_fd);
+	_fd = -1;
+      }
+    }
+
+    inline uint64_t nextRandom() {
+      _rng ^= _rng << 13;
+      _rng ^= _rng >> 7;
+      _rng ^= _rng << 17;
+      return _rng;
+    }
+
+    /// Replace the full (or missing) current page of a class.
+    MiniHeap * refill (int c) {
+      MiniHeap * old = _current[c];
+      if ((old != NULL) && (old->live < old->numObjects)) {
+	insertPartial (old);
+      }
+      MiniHeap * mh = _partial[c];
+      if (mh != NULL) {
+	removePartial (mh);
+      } else {
+	mh = create (c);
+      }
+      _current[c] = mh;
+      return mh;
+    }
+
+    MiniHeap * create (int c) {
+      size_t page;
+      if (_numFreePages > 0) {
+	page = _freePages[--_numFreePages];
+      } else if (_nextPage < NumPages) {
+	page = _nextPage++;
+      } else {
+	return NULL;
+      }
+      MiniHeap * mh = (MiniHeap *) _miniHeaps.malloc (sizeof(MiniHeap));
+      if (mh == NULL) {
+	_freePages[_numFreePages++] = (uint32_t) page;
+	return NULL;
+      }
+      mh->sizeClass = c;
+      mh->objectSize = (c + 1) * ClassSpacing;
+      mh->numObjects = PageSize / mh->objectSize;
+      mh->live = 0;
+      memset (mh->bitmap, 0, sizeof(mh->bitmap));
+      mh->base = _arena + page * PageSize;
+      mh->filePage = page;
+      mh->spans[0] = page;
+      mh->numSpans = 1;
+      mh->prev = mh->next = NULL;
+      mh->inPartial = false;
+      _pageTable[page] = mh;
+      _numMiniHeaps++;
+      return mh;
+    }
+
+    /// Return an empty page (and all of its spans) to the arena.
+    void destroy (MiniHeap * mh) {
+      for (int i = 0; i < mh->numSpans; i++) {
+	const size_t page = mh->spans[i];
+	if (page != mh->filePage) {
+	  // Point the virtual page back at its own (empty) file page.
+	  MmapWrapper::mapShared (_fd, PageSize, page * PageSize, _arena + page * PageSize);
+	}
+	_pageTable[page] = NULL;
+	_freePages[_numFreePages++] = (uint32_t) page;
+      }
+      punch (mh->filePage);
+      _numMiniHeaps--;
+      _miniHeaps.free (mh);
+    }
+
+    void punch (size_t filePage) {
+      fallocate (_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		 filePage * PageSize, PageSize);
+    }
+
+    void insertPartial (MiniHeap * mh) {
+      assert (!mh->inPartial);
+      MiniHeap *& head = _partial[mh->sizeClass];
+      mh->prev = NULL;
+      mh->next = head;
+      if (head != NULL) {
+	head->prev = mh;
+      }
+      head = mh;
+      mh->inPartial = true;
+    }
+
+    void removePartial (MiniHeap * mh) {
+      if (!mh->inPartial) {
+	return;
+      }
+      if (mh->prev != NULL) {
+	mh->prev->next = mh->next;
+      } else {
+	_partial[mh->sizeClass] = mh->next;
+      }
+      if (mh->next != NULL) {
+	mh->next->prev = mh->prev;
+      }
+      mh->prev = mh->next = NULL;
+      mh->inPartial = false;
+    }
+
+    /// Greedily mesh the partially-full pages of one class, a window at a time.
+    size_t meshClass (int c) {
+      size_t released = 0;
+      MiniHeap * mh = _partial[c];
+      while (mh != NULL) {
+	released += meshWindow (mh);
+      }
+      return released;
+    }
+
+    /// Mesh pairs among the next Window pages from mh on, and advance mh.
+    size_t meshWindow (MiniHeap *& mh) {
+      enum { Window = 64 };
+      MiniHeap * candidates[Window];
+      int n = 0;
+      for (; (mh != NULL) && (n < Window); mh = mh->next) {
+	candidates[n++] = mh;
+      }
+      size_t released = 0;
+      for (int i = 0; i < n; i++) {
+	if (candidates[i] == NULL) {
+	  continue;
+	}
+	for (int j = i + 1; j < n; j++) {
+	  MiniHeap * a = candidates[i];
+	  MiniHeap * b = candidates[j];
+	  if ((b == NULL)
+	      || (a->numSpans + b->numSpans > MaxSpans)
+	      || a->overlaps (b)) {
+	    continue;
+	  }
+	  // Keep the fuller page; copy the emptier one into it.
+	  if (b->live > a->live) {
+	    candidates[i] = b;
+	    b = a;
+	    a = candidates[i];
+	  }
+	  candidates[j] = NULL;
+	  meshPair (a, b);
+	  released++;
+	  if (a->live == a->numObjects) {
+	    removePartial (a);
+	    candidates[i] = NULL;
+	    break;
+	  }
+	}
+      }
+      return released;
+    }
+
+    /// Move the objects of src into dst and alias src's virtual pages to dst.
+    void meshPair (MiniHeap * dst, MiniHeap * src) {
+      MeshBarrier::begin();
+      for (int i = 0; i < src->numSpans; i++) {
+	MmapWrapper::writeProtect (_arena + src->spans[i] * PageSize, PageSize);
+      }
+      for (int w = 0; w < BitmapWords; w++) {
+	uint64_t bits = src->bitmap[w];
+	while (bits) {
+	  const size_t slot = w * 64 + __builtin_ctzll (bits);
+	  bits &= bits - 1;
+	  const size_t offset = slot * src->objectSize;
+	  memcpy (dst->base + offset, src->base + offset, src->objectSize);
+	}
+      }
+      for (int i = 0; i < src->numSpans; i++) {
+	MmapWrapper::mapShared (_fd, PageSize, dst->filePage * PageSize,
+				_arena + src->spans[i] * PageSize);
+      }
+      MeshBarrier::end();
+      punch (src->filePage);
+      for (int w = 0; w < BitmapWords; w++) {
+	dst->bitmap[w] |= src->bitmap[w];
+      }
+      dst->live += src->live;
+      for (int i = 0; i < src->numSpans; i++) {
+	dst->spans[dst->numSpans++] = src->spans[i];
+	_pageTable[src->spans[i]] = dst;
+      }
+      removePartial (src);
+      _numMiniHeaps--;
+      _meshedPages++;
+      _meshes++;
+      _miniHeaps.free (src);
+    }
+
+    static void * mesherThread (void * arg) {
+      MeshingHeap * heap = (MeshingHeap *) arg;
+      struct timespec period;
+      period.tv_sec = heap->_periodMs / 1000;
+      period.tv_nsec = (heap->_periodMs % 1000) * 1000000;
+      while (heap->_running.load()) {
+	nanosleep (&period, NULL);
+	heap->mesh();
+      }
+      return NULL;
+    }
+
+    SpinLockType _lock;
+    int _fd;
+    char * _arena;
+    MiniHeap ** _pageTable;
+    uint32_t * _freePages;
+    size_t _nextPage;
+    size_t _numFreePages;
+    size_t _numMiniHeaps;
+    size_t _meshedPages;
+    size_t _meshes;
+    uint64_t _rng;
+    MiniHeap * _current[NumClasses];
+    MiniHeap * _partial[NumClasses];
+    FreelistHeap<BumpAlloc<16384, PrivateMmapHeap> > _miniHeaps;
+    std::atomic<bool> _running;
+    unsigned long _periodMs;
+    Fred _mesher;
+  };
+
+}
+
+#endif
+
+#endif
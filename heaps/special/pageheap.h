@@ -0,0 +1,347 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_PAGEHEAP_H
+#define HL_PAGEHEAP_H
+
+/**
+ * @class PageHeap
+ * @brief A span-based page-run allocator for medium-sized objects.
+ *
+ * Carves runs of whole pages (spans) out of large chunks obtained
+ * from the superheap, so that medium objects (say, 64KB to 1MB) cost
+ * no system calls once the heap has warmed up. Free spans are kept in
+ * a set ordered by length and then by address, and allocation takes
+ * the lowest-addressed of the smallest spans that fit (address-ordered
+ * best fit), splitting off the remainder. A page map records the
+ * first and last page of every span, so a freed span coalesces with
+ * free neighbors in constant time.
+ *
+ * Free spans decay: a span left unused for DecayOps operations has
+ * its pages returned to the OS (madvise), while staying in the free
+ * set for reuse. A span formed by coalescing takes the age of its
+ * oldest backed part, so a large free run that is repeatedly split
+ * and re-merged by churn still decays. Each span counts its released
+ * pages; when a span mixing released and backed pages is split, its
+ * released pages are attributed to the remainder first, so
+ * getReleasedBytes is exact except after such splits. Requests above MaxPages pages go straight to the
+ * superheap. This layer is not thread-safe; wrap it in a LockedHeap.
+ *
+ * Typical use is as the big heap of a segregated-fits heap, with
+ * MmapHeap behind it for truly huge objects:
+ * <TT>
+ *   StrictSegHeap<..., LittleHeap, PageHeap<MmapHeap> >
+ * </TT>
+ *
+ * @param SuperHeap A page-aligned source with getSize, for chunks and huge
+ *                  objects (MmapHeap; not a SizeHeap, whose header unaligns them).
+ * @param MaxPages The largest request, in pages, served from spans.
+ * @param ChunkBytes The size of the chunks requested from the superheap.
+ * @param DecayOps The age (in malloc/free calls) at which a free span is released.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <set>
+
+#include "heaps/buildingblock/freelistheap.h"
+#include "heaps/special/bumpalloc.h"
+#include "heaps/top/mmapheap.h"
+#include "utility/myhashmap.h"
+#include "utility/releasebatcher.h"
+#include "utility/sassert.h"
+#include "wrappers/stlallocator.h"
+
+namespace HL {
+
+  template <class SuperHeap,
+	    size_t MaxPages = 256,
+	    size_t ChunkBytes = 8 * 1024 * 1024,
+	    size_t DecayOps = 1 << 16>
+  class PageHeap : public SuperHeap {
+  public:
+
+    enum { PageSize = 4096 };
+    enum { Alignment = PageSize };
+
+    PageHeap()
+      : _pageMap (PageMapBins),
+	_clock (0),
+	_mappedBytes (0),
+	_freeBytes (0),
+	_releasedBytes (0)
+    {
+      sassert<(ChunkBytes % PageSize == 0)> verifyChunkSize;
+      sassert<(MaxPages * PageSize <= ChunkBytes)> verifyMaxPages;
+      sassert<((int) SuperHeap::Alignment % PageSize == 0)> verifyPageAligned;
+      verifyChunkSize = verifyChunkSize;
+      verifyPageAligned = verifyPageAligned;
+      verifyMaxPages = verifyMaxPages;
+    }
+
+    inline void * malloc (size_t sz) {
+      const size_t pages = (sz + PageSize - 1) / PageSize;
+      if ((pages > MaxPages) || (pages == 0)) {
+	return SuperHeap::malloc (sz);
+      }
+      tick();
+      Span * s = findSpan (pages);
+      if (s == NULL) {
+	if (!grow()) {
+	  return NULL;
+	}
+	s = findSpan (pages);
+	assert (s != NULL);
+      }
+      removeFree (s);
+      if (s->pages > pages) {
+	// Return the tail to the free set.
+	Span * rest = newSpan (s->start + pages * PageSize, s->pages - pages);
+	rest->releasedPages = (s->releasedPages < rest->pages) ? s->releasedPages : rest->pages;
+	rest->freedAt = s->freedAt;
+	s->pages = pages;
+	record (s);
+	record (rest);
+	insertFree (rest);
+      }
+      s->free = false;
+      // Touching released pages backs them again.
+      s->releasedPages = 0;
+      return s->start;
+    }
+
+    inline void free (void * ptr) {
+      Span * s = _pageMap.get (ptr);
+      if ((s == NULL) || (s->start != ptr)) {
+	SuperHeap::free (ptr);
+	return;
+      }
+      assert (!s->free);
+      tick();
+      s->freedAt = _clock;
+      // Coalesce with free neighbors.
+      Span * prev = _pageMap.get (s->start - PageSize);
+      if ((prev != NULL) && prev->free && (prev->start + prev->pages * PageSize == s->start)) {
+	removeFree (prev);
+	s = merge (prev, s);
+      }
+      Span * next = _pageMap.get (s->start + s->pages * PageSize);
+      if ((next != NULL) && next->free && (next->start == s->start + s->pages * PageSize)) {
+	removeFree (next);
+	s = merge (s, next);
+      }
+      insertFree (s);
+    }
+
+    inline size_t getSize (void * ptr) {
+      Span * s = _pageMap.get (ptr);
+      if ((s == NULL) || (s->start != ptr)) {
+	return SuperHeap::getSize (ptr);
+      }
+      return s->pages * PageSize;
+    }
+
+    /// Release every free span now; returns the bytes released.
+    size_t releaseMemory() {
+      size_t released = 0;
+      while (!_backed.empty()) {
+	Span * s = *_backed.begin();
+	released += (s->pages - s->releasedPages) * PageSize;
+	release (s);
+      }
+      _releaser.flush();
+      return released;
+    }
+
+    /// Bytes obtained from the superheap for spans.
+    size_t getMappedBytes() const { return _mappedBytes; }
+
+    /// Bytes in free spans (backed or released).
+    size_t getFreeBytes() const { return _freeBytes; }
+
+    /// Bytes in free spans that have been returned to the OS.
+    size_t getReleasedBytes() const { return _releasedBytes; }
+
+  private:
+
+    enum { PageMapBins = 4093 };
+
+    class Span {
+    public:
+      char * start;
+      size_t pages;
+      bool free;
+      /// Pages returned to the OS (all of them, or none while in use).
+      size_t releasedPages;
+      /// When the span (or its oldest backed part) was freed.
+      size_t freedAt;
+    };
+
+    /// Order free spans by length, then by address.
+    class BySize {
+    public:
+      bool operator() (const Span * a, const Span * b) const {
+	if (a->pages != b->pages) {
+	  return a->pages < b->pages;
+	}
+	return a->start < b->start;
+      }
+    };
+
+    /// Order free spans with backed pages by age, then by address.
+    class ByAge {
+    public:
+      bool operator() (const Span * a, const Span * b) const {
+	if (a->freedAt != b->freedAt) {
+	  return a->freedAt < b->freedAt;
+	}
+	return a->start < b->start;
+      }
+    };
+
+    class MetaHeap : public FreelistHeap<BumpAlloc<16384, PrivateMmapHeap> > {};
+
+    typedef std::set<Span *, BySize, STLAllocator<Span *, MetaHeap> > FreeSet;
+    typedef std::set<Span *, ByAge, STLAllocator<Span *, MetaHeap> > DecaySet;
+
+    inline void tick() {
+      _clock++;
+      // Release the oldest backed free spans once they have decayed.
+      while (!_backed.empty() && (_clock - (*_backed.begin())->freedAt > DecayOps)) {
+	release (*_backed.begin());
+      }
+      _releaser.flush();
+    }
+
+    Span * findSpan (size_t pages) {
+      Span key;
+      key.start = NULL;
+      key.pages = pages;
+      typename FreeSet::iterator i = _free.lower_bound (&key);
+      if (i == _free.end()) {
+	return NULL;
+      }
+      return *i;
+    }
+
+    bool grow() {
+      char * chunk = (char *) SuperHeap::malloc (ChunkBytes);
+      if (chunk == NULL) {
+	return false;
+      }
+      assert ((uintptr_t) chunk % PageSize == 0);
+      _mappedBytes += ChunkBytes;
+      Span * s = newSpan (chunk, ChunkBytes / PageSize);
+      s->freedAt = _clock;
+      record (s);
+      insertFree (s);
+      return true;
+    }
+
+    Span * newSpan (char * start, size_t pages) {
+      Span * s = new (_spans.malloc (sizeof(Span))) Span;
+      s->start = start;
+      s->pages = pages;
+      s->free = false;
+      s->releasedPages = 0;
+      s->freedAt = 0;
+      return s;
+    }
+
+    /// Point the page map at the first and last pages of a span.
+    void record (Span * s) {
+      _pageMap.set (s->start, s);
+      _pageMap.set (s->start + (s->pages - 1) * PageSize, s);
+    }
+
+    /// Merge b (which follows a) into a single span.
+    Span * merge (Span * a, Span * b) {
+      assert (a->start + a->pages * PageSize == b->start);
+      // The boundary pages become interior.
+      if (a->pages > 1) {
+	_pageMap.erase (a->start + (a->pages - 1) * PageSize);
+      }
+      _pageMap.erase (b->start);
+      // The merged span is as old as its oldest backed part.
+      if (a->releasedPages == a->pages) {
+	a->freedAt = b->freedAt;
+      } else if ((b->releasedPages < b->pages) && (b->freedAt < a->freedAt)) {
+	a->freedAt = b->freedAt;
+      }
+      a->pages += b->pages;
+      a->releasedPages += b->releasedPages;
+      record (a);
+      _spans.free (b);
+      return a;
+    }
+
+    void insertFree (Span * s) {
+      s->free = true;
+      _free.insert (s);
+      _freeBytes += s->pages * PageSize;
+      _releasedBytes += s->releasedPages * PageSize;
+      if (s->releasedPages < s->pages) {
+	_backed.insert (s);
+      }
+    }
+
+    void removeFree (Span * s) {
+      assert (s->free);
+      _free.erase (s);
+      _freeBytes -= s->pages * PageSize;
+      _releasedBytes -= s->releasedPages * PageSize;
+      if (s->releasedPages < s->pages) {
+	_backed.erase (s);
+      }
+      s->free = false;
+    }
+
+    /// Queue a backed free span's pages for return to the OS (at the next flush).
+    void release (Span * s) {
+      assert (s->free && (s->releasedPages < s->pages));
+      _backed.erase (s);
+      // Advising already released pages again is harmless.
+      _releaser.add (s->start, s->pages * PageSize);
+      _releasedBytes += (s->pages - s->releasedPages) * PageSize;
+      s->releasedPages = s->pages;
+    }
+
+    MetaHeap _spans;
+    MyHashMap<void *, Span *, HashTableHeap> _pageMap;
+    FreeSet _free;
+    /// Free spans with backed pages, oldest first.
+    DecaySet _backed;
+    ReleaseBatcher<> _releaser;
+    size_t _clock;
+    size_t _mappedBytes;
+    size_t _freeBytes;
+    size_t _releasedBytes;
+  };
+
+}
+
+#endif
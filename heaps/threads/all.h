@@ -1,3 +1,4 @@
+#include "epochreclaimheap.h"
 #include "lockedheap.h"
 #include "phothreadheap.h"
 #include "threadheap.h"
@@ -0,0 +1,352 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_EPOCHRECLAIMHEAP_H
+#define HL_EPOCHRECLAIMHEAP_H
+
+/**
+ * @class EpochReclaimHeap
+ * @brief Adds epoch-based deferred freeing (retire) for lock-free data structures.
+ *
+ * A lock-free structure cannot free a node it has unlinked, because
+ * other threads may still be reading it. Readers bracket their
+ * accesses with enter() and leave() (or a CriticalSection), and
+ * writers retire unlinked nodes instead of freeing them. Each thread
+ * keeps retired objects in limbo bags tagged with the global epoch.
+ * The epoch advances once every thread inside a critical section has
+ * observed it, so objects retired in epoch e are unreachable once the
+ * epoch reaches e + 2; they are then released to the superheap in
+ * batches (through its freeBatch if it has one).
+ *
+ * enter() and leave() touch only the calling thread's record, and
+ * nest. Each thread tries to advance the epoch and collect its bags
+ * every CollectInterval retirements. Bags of exited threads are
+ * collected by whichever thread collects next.
+ *
+ * Thread state is shared by all instances of one instantiation, so
+ * use one instance per instantiation (a singleton or a subclass),
+ * and let it outlive the threads that use it. The superheap must be
+ * thread-safe.
+ *
+ * @param SuperHeap The heap that objects are finally freed to.
+ * @param CollectInterval Retirements between collection attempts.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "heaps/buildingblock/freelistheap.h"
+#include "heaps/special/bumpalloc.h"
+#include "heaps/threads/lockedheap.h"
+#include "heaps/top/mmapheap.h"
+#include "locks/spinlock.h"
+#include "utility/freebatch.h"
+#include "utility/guard.h"
+
+namespace HL {
+
+  template <class SuperHeap,
+	    int CollectInterval = 256>
+  class EpochReclaimHeap : public SuperHeap {
+  public:
+
+    enum { Alignment = SuperHeap::Alignment };
+
+    EpochReclaimHeap()
+      : _epoch (2),
+	_records (NULL),
+	_orphans (NULL)
+    {}
+
+    ~EpochReclaimHeap() {
+      // Everything is quiescent now: release all of limbo.
+      for (Record * r = _records.load(); r != NULL; r = r->next) {
+	if (r->current != NULL) {
+	  r->current->next = r->limbo;
+	  r->limbo = r->current;
+	  r->current = NULL;
+	}
+	r->limbo = releaseBags (r->limbo, UINT64_MAX);
+      }
+      Guard<SpinLockType> l (_orphanLock);
+      _orphans.store (releaseBags (_orphans.load(), UINT64_MAX));
+    }
+
+    /// Begin a critical section: retired objects stay valid until leave().
+    inline void enter() {
+      Record * r = record();
+      if (r->depth++ == 0) {
+	// Announce the epoch, then make sure it did not move meanwhile.
+	uint64_t epoch;
+	do {
+	  epoch = _epoch.load (std::memory_order_relaxed);
+	  r->state.store ((epoch << 1) | Active, std::memory_order_relaxed);
+	  std::atomic_thread_fence (std::memory_order_seq_cst);
+	} while (_epoch.load (std::memory_order_relaxed) != epoch);
+      }
+    }
+
+    /// End a critical section.
+    inline void leave() {
+      Record * r = record();
+      assert (r->depth > 0);
+      if (--r->depth == 0) {
+	r->state.store (0, std::memory_order_release);
+      }
+    }
+
+    /// Free ptr once no thread can be in a critical section that saw it.
+    inline void retire (void * ptr) {
+      if (ptr == NULL) {
+	return;
+      }
+      Record * r = record();
+      const uint64_t epoch = _epoch.load (std::memory_order_acquire);
+      Bag * b = r->current;
+      if ((b == NULL) || (b->epoch != epoch) || (b->count == Bag::Capacity)) {
+	if (b != NULL) {
+	  b->next = r->limbo;
+	  r->limbo = b;
+	}
+	b = newBag (epoch);
+	if (b == NULL) {
+	  // Out of memory for bookkeeping: leak rather than free too early.
+	  r->current = NULL;
+	  return;
+	}
+	r->current = b;
+      }
+      b->ptrs[b->count++] = ptr;
+      if (++r->retired >= CollectInterval) {
+	r->retired = 0;
+	collect();
+      }
+    }
+
+    /// Try to advance the epoch and release what the calling thread can.
+    void collect() {
+      tryAdvance();
+      const uint64_t epoch = _epoch.load (std::memory_order_acquire);
+      Record * r = record();
+      // Bags in limbo are newest first.
+      r->limbo = releaseBags (r->limbo, epoch);
+      if ((r->current != NULL) && (r->current->epoch + 2 <= epoch)) {
+	releaseBags (r->current, epoch);
+	r->current = NULL;
+      }
+      if (_orphans.load (std::memory_order_relaxed) != NULL) {
+	Guard<SpinLockType> l (_orphanLock);
+	_orphans.store (releaseBags (_orphans.load(), epoch));
+      }
+    }
+
+    /// Wait for a grace period: every critical section active now has
+    /// ended. Must not be called from inside a critical section.
+    void synchronize() {
+      const uint64_t target = _epoch.load() + 2;
+      while (_epoch.load() < target) {
+	tryAdvance();
+      }
+    }
+
+    /// The global epoch.
+    uint64_t getEpoch() const { return _epoch.load(); }
+
+    /// A scope during which retired objects remain valid.
+    class CriticalSection {
+    public:
+      CriticalSection (EpochReclaimHeap& h)
+	: _heap (h)
+      {
+	_heap.enter();
+      }
+      ~CriticalSection() {
+	_heap.leave();
+      }
+    private:
+      EpochReclaimHeap& _heap;
+    };
+
+  private:
+
+    enum { Active = 1 };
+
+    /// Retired objects from one epoch.
+    class Bag {
+    public:
+      enum { Capacity = 125 };
+      uint64_t epoch;
+      size_t count;
+      Bag * next;
+      void * ptrs[Capacity];
+    };
+
+    /// A thread's registration (reused after the thread exits).
+    class Record {
+    public:
+      /// The epoch observed on entry, shifted left, with Active set while inside.
+      std::atomic<uint64_t> state;
+      std::atomic<bool> inUse;
+      Record * next;
+      int depth;
+      int retired;
+      Bag * current;
+      Bag * limbo;
+    };
+
+    /// Gives the record back when the thread exits.
+    class ThreadRecord {
+    public:
+      ThreadRecord()
+	: heap (NULL),
+	  rec (NULL)
+      {}
+      ~ThreadRecord() {
+	if (rec != NULL) {
+	  heap->unregister (rec);
+	}
+      }
+      EpochReclaimHeap * heap;
+      Record * rec;
+    };
+
+    class BagHeap : public LockedHeap<SpinLockType, FreelistHeap<BumpAlloc<65536, MmapHeap> > > {};
+    class RecordHeap : public LockedHeap<SpinLockType, BumpAlloc<65536, MmapHeap> > {};
+
+    inline Record * record() {
+      static thread_local ThreadRecord tr;
+      if (tr.rec == NULL) {
+	tr.heap = this;
+	tr.rec = registerThread();
+      }
+      assert (tr.heap == this);
+      return tr.rec;
+    }
+
+    Record * registerThread() {
+      for (Record * r = _records.load(); r != NULL; r = r->next) {
+	bool expected = false;
+	if (!r->inUse.load() && r->inUse.compare_exchange_strong (expected, true)) {
+	  return r;
+	}
+      }
+      Record * r = (Record *) _recordHeap.malloc (sizeof(Record));
+      if (r == NULL) {
+	abort();
+      }
+      r->state.store (0);
+      r->inUse.store (true);
+      r->depth = 0;
+      r->retired = 0;
+      r->current = NULL;
+      r->limbo = NULL;
+      Record * head = _records.load();
+      do {
+	r->next = head;
+      } while (!_records.compare_exchange_weak (head, r));
+      return r;
+    }
+
+    void unregister (Record * r) {
+      r->state.store (0, std::memory_order_release);
+      r->depth = 0;
+      r->retired = 0;
+      if (r->current != NULL) {
+	r->current->next = r->limbo;
+	r->limbo = r->current;
+	r->current = NULL;
+      }
+      if (r->limbo != NULL) {
+	Bag * last = r->limbo;
+	while (last->next != NULL) {
+	  last = last->next;
+	}
+	Guard<SpinLockType> l (_orphanLock);
+	last->next = _orphans.load();
+	_orphans.store (r->limbo);
+	r->limbo = NULL;
+      }
+      r->inUse.store (false, std::memory_order_release);
+    }
+
+    /// Advance the epoch if every active thread has observed it.
+    void tryAdvance() {
+      uint64_t epoch = _epoch.load();
+      std::atomic_thread_fence (std::memory_order_seq_cst);
+      for (Record * r = _records.load (std::memory_order_acquire); r != NULL; r = r->next) {
+	const uint64_t state = r->state.load (std::memory_order_acquire);
+	if ((state & Active) && ((state >> 1) != epoch)) {
+	  return;
+	}
+      }
+      _epoch.compare_exchange_strong (epoch, epoch + 1);
+    }
+
+    Bag * newBag (uint64_t epoch) {
+      Bag * b = (Bag *) _bagHeap.malloc (sizeof(Bag));
+      if (b != NULL) {
+	b->epoch = epoch;
+	b->count = 0;
+	b->next = NULL;
+      }
+      return b;
+    }
+
+    /// Release the bags in a list that are safe at this epoch
+    /// (UINT64_MAX for all of them), and return the remainder.
+    Bag * releaseBags (Bag * list, uint64_t epoch) {
+      Bag * keep = NULL;
+      Bag ** tail = &keep;
+      Bag * b = list;
+      while (b != NULL) {
+	Bag * next = b->next;
+	if ((epoch == UINT64_MAX) || (b->epoch + 2 <= epoch)) {
+	  FreeBatch::release (static_cast<SuperHeap&>(*this), b->ptrs, b->count);
+	  _bagHeap.free (b);
+	} else {
+	  *tail = b;
+	  tail = &b->next;
+	  b->next = NULL;
+	}
+	b = next;
+      }
+      return keep;
+    }
+
+    std::atomic<uint64_t> _epoch;
+    std::atomic<Record *> _records;
+    SpinLockType _orphanLock;
+    /// Bags left by exited threads.
+    std::atomic<Bag *> _orphans;
+    BagHeap _bagHeap;
+    RecordHeap _recordHeap;
+  };
+
+}
+
+#endif
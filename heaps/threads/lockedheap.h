@@ -28,7 +28,9 @@
 #define HL_LOCKEDHEAP_H
 
 #include <cstddef>
+#include "utility/freebatch.h"
 #include "utility/guard.h"
+#include "utility/mallocnear.h"
 
 namespace HL {
 
@@ -38,16 +40,30 @@ namespace HL {
 
     enum { Alignment = Super::Alignment };
 
+    /// Calls are serialized (see HeapTraits).
+    typedef LockedHeap ThreadSafe;
+
     inline void * malloc (size_t sz) {
       Guard<LockType> l (thelock);
       return Super::malloc (sz);
     }
 
+    inline void * mallocNear (size_t sz, const void * hint) {
+      Guard<LockType> l (thelock);
+      return MallocNear::allocate (static_cast<Super&>(*this), sz, hint);
+    }
+
     inline void free (void * ptr) {
       Guard<LockType> l (thelock);
       Super::free (ptr);
     }
 
+    /// Free several objects under one acquisition of the lock.
+    inline void freeBatch (void ** ptrs, size_t n) {
+      Guard<LockType> l (thelock);
+      FreeBatch::release (static_cast<Super&>(*this), ptrs, n);
+    }
+
     inline size_t getSize (void * ptr) const {
       Guard<LockType> l (thelock);
       return Super::getSize (ptr);
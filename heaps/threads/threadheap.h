@@ -31,6 +31,7 @@
 #include <new>
 
 #include "threads/cpuinfo.h"
+#include "utility/mallocnear.h"
 
 #if !defined(_WIN32)
 #include <pthread.h>
@@ -66,6 +67,13 @@ namespace HL {
       return getHeap(tid)->malloc (sz);
     }
 
+    inline void * mallocNear (size_t sz, const void * hint) {
+      auto tid = Modulo<NumHeaps>::mod (CPUInfo::getThreadId());
+      assert (tid >= 0);
+      assert (tid < NumHeaps);
+      return MallocNear::allocate (*getHeap(tid), sz, hint);
+    }
+
     inline void free (void * ptr) {
       auto tid = Modulo<NumHeaps>::mod (CPUInfo::getThreadId());
       assert (tid >= 0);
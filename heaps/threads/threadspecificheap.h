@@ -34,6 +34,7 @@
 
 #include <pthread.h>
 
+#include "utility/mallocnear.h"
 #include "wrappers/mmapwrapper.h"
 
 #if defined(__clang__)
@@ -61,6 +62,10 @@ namespace HL {
       return getHeap()->malloc (sz);
     }
 
+    inline void * mallocNear (size_t sz, const void * hint) {
+      return MallocNear::allocate (*getHeap(), sz, hint);
+    }
+
     inline void free (void * ptr) {
       getHeap()->free (ptr);
     }
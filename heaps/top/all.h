@@ -1,4 +1,6 @@
+#include "asyncreleaseheap.h"
+#include "hugepageawarepageheap.h"
+#include "indexedpoolheap.h"
 #include "mallocheap.h"
 #include "mmapheap.h"
 #include "staticheap.h"
-
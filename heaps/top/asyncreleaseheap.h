@@ -0,0 +1,294 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_ASYNCRELEASEHEAP_H
+#define HL_ASYNCRELEASEHEAP_H
+
+/**
+ * @class AsyncReleaseHeap
+ * @brief A mapping source whose frees return immediately and unmap in the background.
+ *
+ * Like MmapHeap, this heap maps every object directly and tracks its
+ * size, but free does not call munmap, which can take hundreds of
+ * microseconds on a busy multi-threaded process (every core running
+ * it takes a TLB shootdown). Instead, the freed region is pushed onto
+ * a lock-free list threaded through the region itself, and a
+ * background thread takes the whole list at once, sorts it by
+ * address, merges adjacent regions, and returns each merged run to
+ * the superheap with a single call.
+ *
+ * Backpressure: once MaxOutstandingBytes are waiting to be released,
+ * further frees release synchronously. flush() releases everything
+ * queued (including a batch the background thread is working on)
+ * before returning.
+ *
+ * @param SuperHeap A page-granular, sized source (like PrivateMmapHeap) whose
+ *                  free (ptr, sz) accepts a range spanning several adjacent objects.
+ * @param MaxOutstandingBytes The bound on bytes freed but not yet released.
+ */
+
+#if !defined(_WIN32)
+
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "heaps/top/mmapheap.h"
+#include "locks/posixlock.h"
+#include "utility/guard.h"
+#include "utility/myhashmap.h"
+
+namespace HL {
+
+  template <class SuperHeap = PrivateMmapHeap,
+	    size_t MaxOutstandingBytes = 256 * 1024 * 1024>
+  class AsyncReleaseHeap : public SuperHeap {
+  public:
+
+    enum { Alignment = SuperHeap::Alignment };
+
+    AsyncReleaseHeap()
+      : _pending (NULL),
+	_outstanding (0),
+	_started (false),
+	_idle (false),
+	_running (true),
+	_batch (NULL),
+	_capacity (0),
+	_batches (0),
+	_regions (0),
+	_releases (0),
+	_syncReleases (0)
+    {
+      pthread_mutex_init (&_wakeLock, NULL);
+      pthread_cond_init (&_wake, NULL);
+    }
+
+    ~AsyncReleaseHeap() {
+      if (_started.load()) {
+	pthread_mutex_lock (&_wakeLock);
+	_running = false;
+	pthread_cond_signal (&_wake);
+	pthread_mutex_unlock (&_wakeLock);
+	pthread_join (_worker, NULL);
+      }
+      flush();
+      pthread_cond_destroy (&_wake);
+      pthread_mutex_destroy (&_wakeLock);
+    }
+
+    inline void * malloc (size_t sz) {
+      void * ptr = SuperHeap::malloc (sz);
+      if (ptr != NULL) {
+	Guard<PosixLockType> l (_mapLock);
+	_sizes.set (ptr, sz);
+      }
+      return ptr;
+    }
+
+    inline size_t getSize (void * ptr) {
+      Guard<PosixLockType> l (_mapLock);
+      return _sizes.get (ptr);
+    }
+
+    inline void free (void * ptr) {
+      size_t sz;
+      {
+	Guard<PosixLockType> l (_mapLock);
+	sz = _sizes.get (ptr);
+	_sizes.erase (ptr);
+      }
+      if (sz == 0) {
+	return;
+      }
+      // Release synchronously when too much is already waiting.
+      if (_outstanding.fetch_add (sz) + sz > MaxOutstandingBytes) {
+	_outstanding.fetch_sub (sz);
+	_syncReleases++;
+	SuperHeap::free (ptr, sz);
+	return;
+      }
+      ensureWorker();
+      // Once pushed, the region may be unmapped at any moment: don't touch it.
+      Region * r = (Region *) ptr;
+      Region * head = _pending.load (std::memory_order_relaxed);
+      r->size = sz;
+      do {
+	r->next = head;
+      } while (!_pending.compare_exchange_weak (head, r, std::memory_order_release));
+      if ((head == NULL) && _idle.load()) {
+	// The worker is waiting for work.
+	pthread_mutex_lock (&_wakeLock);
+	pthread_cond_signal (&_wake);
+	pthread_mutex_unlock (&_wakeLock);
+      }
+    }
+
+    /// Release everything freed so far before returning.
+    void flush() {
+      drain();
+    }
+
+    /// Bytes freed but not yet released.
+    size_t getOutstandingBytes() const { return _outstanding.load(); }
+
+    /// Batches taken off the queue.
+    size_t getBatches() const { return _batches; }
+
+    /// Regions released asynchronously.
+    size_t getRegions() const { return _regions; }
+
+    /// Calls to the superheap's free for those regions (after merging).
+    size_t getReleases() const { return _releases; }
+
+    /// Frees released synchronously because of backpressure.
+    size_t getSyncReleases() const { return _syncReleases.load(); }
+
+  private:
+
+    /// How long the worker waits between batches.
+    enum { BatchDelayNs = 1000000 };
+
+    /// A freed region, queued in place.
+    class Region {
+    public:
+      Region * next;
+      size_t size;
+    };
+
+    void ensureWorker() {
+      if (_started.load (std::memory_order_acquire)) {
+	return;
+      }
+      Guard<PosixLockType> l (_mapLock);
+      if (!_started.load()) {
+	pthread_create (&_worker, NULL, worker, this);
+	_started.store (true, std::memory_order_release);
+      }
+    }
+
+    static void * worker (void * arg) {
+      AsyncReleaseHeap * heap = (AsyncReleaseHeap *) arg;
+      while (true) {
+	pthread_mutex_lock (&heap->_wakeLock);
+	heap->_idle = true;
+	while ((heap->_pending.load() == NULL) && heap->_running) {
+	  pthread_cond_wait (&heap->_wake, &heap->_wakeLock);
+	}
+	heap->_idle = false;
+	const bool running = heap->_running;
+	pthread_mutex_unlock (&heap->_wakeLock);
+	if (!running) {
+	  return NULL;
+	}
+	heap->drain();
+	// Let the next batch accumulate; frees meanwhile need no wakeup.
+	struct timespec delay = { 0, BatchDelayNs };
+	nanosleep (&delay, NULL);
+      }
+    }
+
+    static bool byAddress (const Region * a, const Region * b) {
+      return a < b;
+    }
+
+    /// Take every queued region, merge adjacent ones, and release them.
+    void drain() {
+      Guard<PosixLockType> l (_drainLock);
+      Region * list = _pending.exchange (NULL, std::memory_order_acquire);
+      if (list == NULL) {
+	return;
+      }
+      size_t n = 0;
+      for (Region * r = list; r != NULL; r = r->next) {
+	n++;
+      }
+      if (n > _capacity) {
+	if (_batch != NULL) {
+	  SuperHeap::free (_batch, _capacity * sizeof(Region *));
+	}
+	_capacity = std::max (n, (size_t) SuperHeap::Alignment / sizeof(Region *));
+	_batch = (Region **) SuperHeap::malloc (_capacity * sizeof(Region *));
+      }
+      size_t i = 0;
+      for (Region * r = list; r != NULL; r = r->next) {
+	_batch[i++] = r;
+      }
+      std::sort (_batch, _batch + n, byAddress);
+      size_t released = 0;
+      i = 0;
+      while (i < n) {
+	char * start = (char *) _batch[i];
+	size_t length = roundUp (_batch[i]->size);
+	size_t j = i + 1;
+	while ((j < n) && ((char *) _batch[j] == start + length)) {
+	  length += roundUp (_batch[j]->size);
+	  j++;
+	}
+	for (size_t k = i; k < j; k++) {
+	  released += _batch[k]->size;
+	}
+	SuperHeap::free (start, length);
+	_releases++;
+	i = j;
+      }
+      _outstanding.fetch_sub (released);
+      _regions += n;
+      _batches++;
+    }
+
+    /// The extent actually mapped for an object of this size.
+    static inline size_t roundUp (size_t sz) {
+      return (sz + CPUInfo::PageSize - 1) & ~((size_t) CPUInfo::PageSize - 1);
+    }
+
+    std::atomic<Region *> _pending;
+    std::atomic<size_t> _outstanding;
+    std::atomic<bool> _started;
+    std::atomic<bool> _idle;
+    bool _running;
+    pthread_t _worker;
+    pthread_mutex_t _wakeLock;
+    pthread_cond_t _wake;
+    PosixLockType _mapLock;
+    MyHashMap<void *, size_t, HashTableHeap> _sizes;
+    PosixLockType _drainLock;
+    Region ** _batch;
+    size_t _capacity;
+    size_t _batches;
+    size_t _regions;
+    size_t _releases;
+    std::atomic<size_t> _syncReleases;
+  };
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,632 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_HUGEPAGEAWAREPAGEHEAP_H
+#define HL_HUGEPAGEAWAREPAGEHEAP_H
+
+/**
+ * @class HugePageAwarePageHeap
+ * @brief A page-run source that packs allocations into 2MB hugepages.
+ *
+ * In the spirit of tcmalloc's Temeraire (Hunter et al., OSDI 2021).
+ * Runs of up to one hugepage (small-object spans, medium objects) are
+ * carved out of 2MB-aligned, MADV_HUGEPAGE regions. Each region
+ * tracks which of its 4K pages are in use, and allocation always
+ * picks the fullest region with a long enough free run, so that
+ * allocations concentrate on few hugepages and the rest drain
+ * completely.
+ *
+ * Memory is returned to the OS in whole hugepages: an empty region
+ * goes to a small cache (MaxCachedHugepages), and beyond that it is
+ * released with madvise. Up to MaxReleasedHugepages released regions
+ * keep their address space for reuse; any more are unmapped, so the
+ * heap's address space stays proportional to its peak footprint.
+ * Partially filled regions are kept intact,
+ * unless releaseMemory() cannot otherwise free what was asked for,
+ * in which case it subreleases free runs of the emptiest ones (which
+ * breaks them up into small pages).
+ *
+ * Larger requests get whole, aligned hugepages: a run of adjacent
+ * empty ones if the cache or released list holds one, or else a fresh
+ * mapping. The unused tail of the last is donated to the region pool,
+ * so rounding up wastes no memory, and freeing a large object returns
+ * its hugepages to the cache like any other empty region.
+ *
+ * getStats() reports usage and hugepage coverage: the fraction of
+ * allocated bytes that lie on intact (never subreleased) hugepages.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "heaps/buildingblock/freelistheap.h"
+#include "heaps/special/bumpalloc.h"
+#include "heaps/top/mmapheap.h"
+#include "locks/spinlock.h"
+#include "utility/guard.h"
+#include "utility/myhashmap.h"
+#include "utility/releasebatcher.h"
+#include "wrappers/mmapwrapper.h"
+
+namespace HL {
+
+  template <class LockType = SpinLockType,
+	    int MaxCachedHugepages = 8,
+	    int MaxReleasedHugepages = 64>
+  class HugePageAwarePageHeap {
+  public:
+
+    enum { PageSize = 4096 };
+    enum { HugePageSize = 2 * 1024 * 1024 };
+    enum { PagesPerHugePage = HugePageSize / PageSize };
+    enum { Alignment = PageSize };
+
+    /// Usage counters, in bytes.
+    class Stats {
+    public:
+      /// Bytes handed out.
+      size_t allocated;
+      /// Bytes handed out that lie on intact hugepages.
+      size_t allocatedOnHugepages;
+      /// Free but backed bytes inside partially filled hugepages.
+      size_t partialFree;
+      /// Empty hugepages kept backed for reuse.
+      size_t cached;
+      /// Bytes returned to the OS (empty hugepages and subreleased pages).
+      size_t released;
+      /// The number of hugepages holding allocations.
+      size_t hugepages;
+      /// Of those, the number with subreleased pages.
+      size_t brokenHugepages;
+
+      double coverage() const {
+	return allocated ? (double) allocatedOnHugepages / (double) allocated : 1.0;
+      }
+    };
+
+    HugePageAwarePageHeap()
+      : _full (NULL),
+	_cached (NULL),
+	_numCached (0),
+	_released (NULL),
+	_numReleased (0),
+	_largeBytes (0)
+    {
+      for (int i = 0; i < NumBuckets; i++) {
+	_buckets[i] = NULL;
+      }
+    }
+
+    inline void * malloc (size_t sz) {
+      const size_t pages = (sz + PageSize - 1) / PageSize;
+      if (pages == 0) {
+	return NULL;
+      }
+      Guard<LockType> l (_lock);
+      if (pages <= PagesPerHugePage) {
+	return allocatePages (pages);
+      }
+      return allocateLarge (pages);
+    }
+
+    inline void free (void * ptr) {
+      if (ptr == NULL) {
+	return;
+      }
+      Guard<LockType> l (_lock);
+      HugePage * hp = _hugepages.get (hugepageOf (ptr));
+      if (hp != NULL) {
+	const size_t page = ((char *) ptr - hp->base) / PageSize;
+	freePages (hp, page, hp->runLength[page]);
+      } else {
+	freeLarge (ptr);
+      }
+      _releaser.flush();
+    }
+
+    inline size_t getSize (void * ptr) {
+      Guard<LockType> l (_lock);
+      HugePage * hp = _hugepages.get (hugepageOf (ptr));
+      if (hp != NULL) {
+	return (size_t) hp->runLength[((char *) ptr - hp->base) / PageSize] * PageSize;
+      }
+      return _large.get (ptr) * PageSize;
+    }
+
+    /// Return at least bytes to the OS if possible; returns the amount released.
+    size_t releaseMemory (size_t bytes) {
+      Guard<LockType> l (_lock);
+      size_t released = 0;
+      // Whole empty hugepages first.
+      while ((released < bytes) && (_cached != NULL)) {
+	HugePage * hp = _cached;
+	takeEmptyHugePage (hp);
+	released += (PagesPerHugePage - hp->releasedPages) * PageSize;
+	releaseHugePage (hp);
+      }
+      // Then break up the emptiest partially filled hugepages.
+      for (int b = 0; (b < NumBuckets) && (released < bytes); b++) {
+	for (HugePage * hp = _buckets[b]; (hp != NULL) && (released < bytes); hp = hp->next) {
+	  released += subrelease (hp);
+	}
+      }
+      _releaser.flush();
+      return released;
+    }
+
+    Stats getStats() {
+      Guard<LockType> l (_lock);
+      Stats s;
+      memset (&s, 0, sizeof(s));
+      for (int b = 0; b < NumBuckets; b++) {
+	for (HugePage * hp = _buckets[b]; hp != NULL; hp = hp->next) {
+	  countHugePage (hp, s);
+	}
+      }
+      for (HugePage * hp = _full; hp != NULL; hp = hp->next) {
+	countHugePage (hp, s);
+      }
+      for (HugePage * hp = _cached; hp != NULL; hp = hp->next) {
+	s.cached += (PagesPerHugePage - hp->releasedPages) * PageSize;
+	s.released += hp->releasedPages * PageSize;
+      }
+      s.released += _numReleased * HugePageSize;
+      s.allocated += _largeBytes;
+      s.allocatedOnHugepages += _largeBytes;
+      return s;
+    }
+
+    void dump (FILE * f) {
+      Stats s = getStats();
+      fprintf (f, "HugePageAwarePageHeap: %lu bytes allocated on %lu hugepages (%lu broken), coverage %.1f%%\n",
+	       (unsigned long) s.allocated, (unsigned long) s.hugepages,
+	       (unsigned long) s.brokenHugepages, 100.0 * s.coverage());
+      fprintf (f, "  partial free %lu, cached %lu, released %lu\n",
+	       (unsigned long) s.partialFree, (unsigned long) s.cached, (unsigned long) s.released);
+    }
+
+  private:
+
+    enum { BitmapWords = PagesPerHugePage / 64 };
+
+    /// Regions are bucketed by the number of pages in use (fullest last).
+    enum { NumBuckets = 64 };
+
+    /// One 2MB region.
+    class HugePage {
+    public:
+      char * base;
+      /// Pages in use.
+      uint64_t used[BitmapWords];
+      /// Free pages returned to the OS.
+      uint64_t released[BitmapWords];
+      /// The length of each allocated run, at its first page.
+      uint16_t runLength[PagesPerHugePage];
+      int usedPages;
+      int releasedPages;
+      int longestFree;
+      int bucket;
+      /// Empty and on the released list (rather than the cache).
+      bool isReleased;
+      HugePage * prev;
+      HugePage * next;
+    };
+
+    static inline bool test (const uint64_t * bits, size_t i) {
+      return (bits[i / 64] >> (i % 64)) & 1;
+    }
+
+    static inline void setRange (uint64_t * bits, size_t start, size_t n, bool value) {
+      for (size_t i = start; i < start + n; i++) {
+	if (value) {
+	  bits[i / 64] |= (1ULL << (i % 64));
+	} else {
+	  bits[i / 64] &= ~(1ULL << (i % 64));
+	}
+      }
+    }
+
+    static inline void * hugepageOf (void * ptr) {
+      return (void *) ((uintptr_t) ptr & ~((uintptr_t) HugePageSize - 1));
+    }
+
+    /// Find the lowest free run of at least n pages, and the longest free run.
+    static int findRun (const HugePage * hp, size_t n, int& longest) {
+      int found = -1;
+      int runStart = 0;
+      int runLength = 0;
+      longest = 0;
+      for (int w = 0; w < BitmapWords; w++) {
+	const uint64_t word = hp->used[w];
+	if (word == 0) {
+	  if (runLength == 0) {
+	    runStart = w * 64;
+	  }
+	  runLength += 64;
+	} else {
+	  for (int i = 0; i < 64; i++) {
+	    if (word & (1ULL << i)) {
+	      runLength = 0;
+	    } else {
+	      if (runLength == 0) {
+		runStart = w * 64 + i;
+	      }
+	      runLength++;
+	    }
+	    if ((found < 0) && (runLength >= (int) n)) {
+	      found = runStart;
+	    }
+	    if (runLength > longest) {
+	      longest = runLength;
+	    }
+	  }
+	  continue;
+	}
+	if ((found < 0) && (runLength >= (int) n)) {
+	  found = runStart;
+	}
+	if (runLength > longest) {
+	  longest = runLength;
+	}
+      }
+      return found;
+    }
+
+    static int bucketOf (const HugePage * hp) {
+      return (hp->usedPages * NumBuckets) / PagesPerHugePage;
+    }
+
+    void link (HugePage *& head, HugePage * hp) {
+      hp->prev = NULL;
+      hp->next = head;
+      if (head != NULL) {
+	head->prev = hp;
+      }
+      head = hp;
+    }
+
+    void unlink (HugePage *& head, HugePage * hp) {
+      if (hp->prev != NULL) {
+	hp->prev->next = hp->next;
+      } else {
+	head = hp->next;
+      }
+      if (hp->next != NULL) {
+	hp->next->prev = hp->prev;
+      }
+      hp->prev = hp->next = NULL;
+    }
+
+    /// The list a region in use belongs on: full, or bucketed by fill.
+    HugePage *& listOf (HugePage * hp) {
+      if (hp->bucket == NumBuckets) {
+	return _full;
+      }
+      return _buckets[hp->bucket];
+    }
+
+    void refile (HugePage * hp) {
+      unlink (listOf (hp), hp);
+      hp->bucket = (hp->usedPages == PagesPerHugePage) ? (int) NumBuckets : bucketOf (hp);
+      link (listOf (hp), hp);
+    }
+
+    void * allocatePages (size_t n) {
+      // Fullest region first.
+      for (int b = NumBuckets - 1; b >= 0; b--) {
+	for (HugePage * hp = _buckets[b]; hp != NULL; hp = hp->next) {
+	  if (hp->longestFree >= (int) n) {
+	    return allocateFrom (hp, n);
+	  }
+	}
+      }
+      HugePage * hp = getEmptyHugePage();
+      if (hp == NULL) {
+	return NULL;
+      }
+      hp->bucket = 0;
+      link (_buckets[0], hp);
+      _hugepages.set (hp->base, hp);
+      return allocateFrom (hp, n);
+    }
+
+    void * allocateFrom (HugePage * hp, size_t n) {
+      int longest;
+      const int start = findRun (hp, n, longest);
+      assert (start >= 0);
+      setRange (hp->used, start, n, true);
+      hp->runLength[start] = (uint16_t) n;
+      hp->usedPages += (int) n;
+      // Reusing subreleased pages backs them again.
+      for (size_t i = start; i < start + n; i++) {
+	if (test (hp->released, i)) {
+	  hp->released[i / 64] &= ~(1ULL << (i % 64));
+	  hp->releasedPages--;
+	}
+      }
+      findRun (hp, PagesPerHugePage + 1, hp->longestFree);
+      refile (hp);
+      return hp->base + start * PageSize;
+    }
+
+    void freePages (HugePage * hp, size_t start, size_t n) {
+      assert (n > 0);
+      assert (test (hp->used, start));
+      setRange (hp->used, start, n, false);
+      hp->runLength[start] = 0;
+      hp->usedPages -= (int) n;
+      if (hp->usedPages == 0) {
+	unlink (listOf (hp), hp);
+	_hugepages.erase (hp->base);
+	putEmptyHugePage (hp);
+	return;
+      }
+      findRun (hp, PagesPerHugePage + 1, hp->longestFree);
+      refile (hp);
+    }
+
+    /// An empty region: cached, then previously released, then fresh.
+    HugePage * getEmptyHugePage() {
+      HugePage * hp = (_cached != NULL) ? _cached : _released;
+      if (hp != NULL) {
+	takeEmptyHugePage (hp);
+      } else {
+	char * base = mapHugePages (1);
+	if (base == NULL) {
+	  return NULL;
+	}
+	hp = newHugePage (base);
+	if (hp == NULL) {
+	  MmapWrapper::unmap (base, HugePageSize);
+	  return NULL;
+	}
+      }
+      resetHugePage (hp);
+      return hp;
+    }
+
+    HugePage * newHugePage (char * base) {
+      HugePage * hp = (HugePage *) _descriptors.malloc (sizeof(HugePage));
+      if (hp != NULL) {
+	hp->base = base;
+	hp->releasedPages = 0;
+      }
+      return hp;
+    }
+
+    void resetHugePage (HugePage * hp) {
+      memset (hp->used, 0, sizeof(hp->used));
+      memset (hp->released, 0, sizeof(hp->released));
+      memset (hp->runLength, 0, sizeof(hp->runLength));
+      hp->usedPages = 0;
+      hp->releasedPages = 0;
+      hp->longestFree = PagesPerHugePage;
+      hp->prev = hp->next = NULL;
+    }
+
+    /// Take an empty region off the cache or the released list.
+    void takeEmptyHugePage (HugePage * hp) {
+      if (hp->isReleased) {
+	unlink (_released, hp);
+	_numReleased--;
+      } else {
+	unlink (_cached, hp);
+	_numCached--;
+      }
+      _empty.erase (hp->base);
+    }
+
+    void putEmptyHugePage (HugePage * hp) {
+      if (_numCached < MaxCachedHugepages) {
+	hp->isReleased = false;
+	link (_cached, hp);
+	_numCached++;
+	_empty.set (hp->base, hp);
+      } else {
+	releaseHugePage (hp);
+      }
+    }
+
+    /// Return an empty region's memory, keeping its address space up to a limit.
+    void releaseHugePage (HugePage * hp) {
+      if (_numReleased < (size_t) MaxReleasedHugepages) {
+	_releaser.add (hp->base, HugePageSize);
+	hp->isReleased = true;
+	link (_released, hp);
+	_numReleased++;
+	_empty.set (hp->base, hp);
+      } else {
+	// Pending advice may cover this region: issue it before unmapping.
+	_releaser.flush();
+	MmapWrapper::unmap (hp->base, HugePageSize);
+	_descriptors.free (hp);
+      }
+    }
+
+    /// Take count adjacent empty regions off the cache or released list.
+    char * takeEmptyRun (size_t count) {
+      for (int list = 0; list < 2; list++) {
+	for (HugePage * hp = (list == 0) ? _cached : _released; hp != NULL; hp = hp->next) {
+	  size_t i = 1;
+	  while ((i < count) && (_empty.get (hp->base + i * HugePageSize) != NULL)) {
+	    i++;
+	  }
+	  if (i == count) {
+	    char * base = hp->base;
+	    for (i = 0; i < count; i++) {
+	      HugePage * h = _empty.get (base + i * HugePageSize);
+	      takeEmptyHugePage (h);
+	      _descriptors.free (h);
+	    }
+	    return base;
+	  }
+	}
+      }
+      return NULL;
+    }
+
+    /// Release the free runs of a partially filled region.
+    size_t subrelease (HugePage * hp) {
+      size_t released = 0;
+      size_t i = 0;
+      while (i < PagesPerHugePage) {
+	if (test (hp->used, i) || test (hp->released, i)) {
+	  i++;
+	  continue;
+	}
+	size_t j = i;
+	while ((j < PagesPerHugePage) && !test (hp->used, j) && !test (hp->released, j)) {
+	  j++;
+	}
+	_releaser.add (hp->base + i * PageSize, (j - i) * PageSize);
+	setRange (hp->released, i, j - i, true);
+	hp->releasedPages += (int) (j - i);
+	released += (j - i) * PageSize;
+	i = j;
+      }
+      return released;
+    }
+
+    void countHugePage (const HugePage * hp, Stats& s) {
+      const size_t used = hp->usedPages * PageSize;
+      s.hugepages++;
+      s.allocated += used;
+      if (hp->releasedPages == 0) {
+	s.allocatedOnHugepages += used;
+      } else {
+	s.brokenHugepages++;
+      }
+      s.partialFree += (PagesPerHugePage - hp->usedPages - hp->releasedPages) * PageSize;
+      s.released += hp->releasedPages * PageSize;
+    }
+
+    /// Map hugepage-aligned memory and ask for transparent hugepages.
+    static char * mapHugePages (size_t count) {
+      const size_t sz = count * HugePageSize;
+      char * ptr = (char *) MmapWrapper::map (sz + HugePageSize);
+      if (ptr == NULL) {
+	return NULL;
+      }
+      char * aligned = (char *) (((uintptr_t) ptr + HugePageSize - 1) & ~((uintptr_t) HugePageSize - 1));
+      if (aligned > ptr) {
+	MmapWrapper::unmap (ptr, aligned - ptr);
+      }
+      if (aligned + sz < ptr + sz + HugePageSize) {
+	MmapWrapper::unmap (aligned + sz, (ptr + sz + HugePageSize) - (aligned + sz));
+      }
+#if defined(MADV_HUGEPAGE)
+      madvise (aligned, sz, MADV_HUGEPAGE);
+#endif
+      return aligned;
+    }
+
+    /// Whole hugepages for a large request; the tail of the last is donated.
+    void * allocateLarge (size_t pages) {
+      const size_t count = (pages + PagesPerHugePage - 1) / PagesPerHugePage;
+      char * base = takeEmptyRun (count);
+      if (base == NULL) {
+	base = mapHugePages (count);
+	if (base == NULL) {
+	  return NULL;
+	}
+      }
+      const size_t tailPages = pages - (count - 1) * PagesPerHugePage;
+      HugePage * hp = NULL;
+      if (tailPages < PagesPerHugePage) {
+	hp = newHugePage (base + (count - 1) * HugePageSize);
+	if (hp != NULL) {
+	  resetHugePage (hp);
+	  setRange (hp->used, 0, tailPages, true);
+	  hp->usedPages = (int) tailPages;
+	  findRun (hp, PagesPerHugePage + 1, hp->longestFree);
+	  hp->bucket = bucketOf (hp);
+	  link (_buckets[hp->bucket], hp);
+	  _hugepages.set (hp->base, hp);
+	}
+      }
+      _large.set (base, pages);
+      // A donated tail's pages are counted with its region.
+      _largeBytes += ((hp != NULL) ? count - 1 : count) * HugePageSize;
+      return base;
+    }
+
+    void freeLarge (void * ptr) {
+      const size_t pages = _large.get (ptr);
+      if (pages == 0) {
+	return;
+      }
+      _large.erase (ptr);
+      const size_t count = (pages + PagesPerHugePage - 1) / PagesPerHugePage;
+      const size_t tailPages = pages - (count - 1) * PagesPerHugePage;
+      char * last = (char *) ptr + (count - 1) * HugePageSize;
+      HugePage * hp = (tailPages < PagesPerHugePage) ? _hugepages.get (last) : NULL;
+      _largeBytes -= ((hp != NULL) ? count - 1 : count) * HugePageSize;
+      // The whole hugepages become empty regions, kept for reuse.
+      for (size_t i = 0; i < count - 1; i++) {
+	putEmptyRegion ((char *) ptr + i * HugePageSize);
+      }
+      if (hp != NULL) {
+	// The last hugepage is shared with donated small runs.
+	hp->runLength[0] = (uint16_t) tailPages;
+	freePages (hp, 0, tailPages);
+      } else {
+	putEmptyRegion (last);
+      }
+    }
+
+    void putEmptyRegion (char * base) {
+      HugePage * hp = newHugePage (base);
+      if (hp == NULL) {
+	MmapWrapper::unmap (base, HugePageSize);
+	return;
+      }
+      putEmptyHugePage (hp);
+    }
+
+    class DescriptorHeap : public FreelistHeap<BumpAlloc<65536, PrivateMmapHeap> > {};
+
+    LockType _lock;
+    ReleaseBatcher<> _releaser;
+    DescriptorHeap _descriptors;
+    MyHashMap<void *, HugePage *, HashTableHeap> _hugepages;
+    MyHashMap<void *, size_t, HashTableHeap> _large;
+    /// The cached and released regions, by base address.
+    MyHashMap<void *, HugePage *, HashTableHeap> _empty;
+    HugePage * _buckets[NumBuckets];
+    HugePage * _full;
+    HugePage * _cached;
+    int _numCached;
+    HugePage * _released;
+    size_t _numReleased;
+    /// Allocated bytes in whole hugepages of large objects.
+    size_t _largeBytes;
+  };
+
+}
+
+#endif
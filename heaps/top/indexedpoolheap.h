@@ -0,0 +1,278 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_INDEXEDPOOLHEAP_H
+#define HL_INDEXEDPOOLHEAP_H
+
+/**
+ * @class IndexedPoolHeap
+ * @brief A pool of fixed-size objects named by 32-bit indices as well as pointers.
+ *
+ * Reserves one contiguous range for MaxObjects objects up front and
+ * commits it CommitBytes at a time as the pool grows, so an unused
+ * reservation costs only address space. Because the objects lie at
+ * fixed offsets from one base, each has a 32-bit index (from 1; 0 is
+ * the null index) that converts to and from its address with one
+ * multiply or divide. Node-heavy structures can store indices instead
+ * of 8-byte pointers; see PoolHandle below.
+ *
+ * Freed objects go on a free list threaded through the objects
+ * themselves as indices. Objects are never decommitted.
+ * Not thread-safe (wrap it in a LockedHeap).
+ *
+ * @param ObjectSize The size of every object (at least 4 bytes).
+ * @param MaxObjects The capacity of the reservation (less than 2^32).
+ * @param CommitBytes How much to commit at a time (a multiple of the page size).
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <new>
+#include <utility>
+
+#include "utility/gcd.h"
+#include "utility/sassert.h"
+#include "utility/singleton.h"
+#include "wrappers/mmapwrapper.h"
+
+namespace HL {
+
+  template <size_t ObjectSize,
+	    size_t MaxObjects,
+	    size_t CommitBytes = 64 * 1024>
+  class IndexedPoolHeap {
+  public:
+
+    /// Objects are rounded up to a multiple of 4 (8 from 8 bytes on).
+    enum { SlotSize = (ObjectSize < 8) ? ((ObjectSize + 3) & ~3) : ((ObjectSize + 7) & ~7) };
+    enum { Alignment = gcd<SlotSize, 16>::value };
+
+    /// The index that names no object.
+    enum { NullIndex = 0 };
+
+    IndexedPoolHeap()
+      : _freeList (NullIndex),
+	_next (1),
+	_committed (0),
+	_inUse (0)
+    {
+      sassert<(ObjectSize >= sizeof(uint32_t))> verifyHoldsIndex;
+      sassert<((size_t) SlotSize >= ObjectSize)> verifySlotHoldsObject;
+      sassert<(MaxObjects < ((size_t) 1 << 32))> verifyIndexFits;
+      sassert<(CommitBytes % MmapWrapper::Size == 0)> verifyCommitGranularity;
+      verifyHoldsIndex = verifyHoldsIndex;
+      verifySlotHoldsObject = verifySlotHoldsObject;
+      verifyIndexFits = verifyIndexFits;
+      verifyCommitGranularity = verifyCommitGranularity;
+      // Slot 0 backs the null index and is never handed out.
+      _base = (char *) MmapWrapper::reserve (ReservedBytes);
+    }
+
+    ~IndexedPoolHeap() {
+      if (_base != NULL) {
+	MmapWrapper::unmap (_base, ReservedBytes);
+      }
+    }
+
+    inline void * malloc (size_t sz) {
+      if (sz > ObjectSize) {
+	return NULL;
+      }
+      const uint32_t index = allocateIndex();
+      return (index == NullIndex) ? NULL : toPointer (index);
+    }
+
+    inline void free (void * ptr) {
+      if (ptr != NULL) {
+	freeIndex (toIndex (ptr));
+      }
+    }
+
+    inline size_t getSize (void *) const {
+      return ObjectSize;
+    }
+
+    /// Allocate an object by index (NullIndex when the pool is exhausted).
+    inline uint32_t allocateIndex() {
+      uint32_t index = _freeList;
+      if (index != NullIndex) {
+	_freeList = *((uint32_t *) toPointer (index));
+      } else {
+	if (_next > MaxObjects) {
+	  return NullIndex;
+	}
+	index = _next;
+	if (((size_t) index + 1) * SlotSize > _committed) {
+	  if (!commitMore()) {
+	    return NullIndex;
+	  }
+	}
+	_next++;
+      }
+      _inUse++;
+      return index;
+    }
+
+    inline void freeIndex (uint32_t index) {
+      assert ((index != NullIndex) && (index < _next));
+      *((uint32_t *) toPointer (index)) = _freeList;
+      _freeList = index;
+      _inUse--;
+    }
+
+    inline void * toPointer (uint32_t index) const {
+      return (index == NullIndex) ? NULL : _base + (size_t) index * SlotSize;
+    }
+
+    inline uint32_t toIndex (const void * ptr) const {
+      if (ptr == NULL) {
+	return NullIndex;
+      }
+      assert (contains (ptr));
+      return (uint32_t) (((const char *) ptr - _base) / SlotSize);
+    }
+
+    /// True iff ptr is an object in this pool.
+    inline bool contains (const void * ptr) const {
+      const size_t offset = (const char *) ptr - _base;
+      return ((const char *) ptr >= _base) && (offset < _committed) && (offset % SlotSize == 0);
+    }
+
+    /// Objects currently allocated.
+    size_t getObjects() const { return _inUse; }
+
+    /// Bytes committed so far.
+    size_t getCommittedBytes() const { return _committed; }
+
+  private:
+
+    static const size_t ReservedBytes =
+      ((MaxObjects + 1) * (size_t) SlotSize + MmapWrapper::Size - 1) & ~((size_t) MmapWrapper::Size - 1);
+
+    // Disable copying and assignment.
+    IndexedPoolHeap (const IndexedPoolHeap&);
+    IndexedPoolHeap& operator= (const IndexedPoolHeap&);
+
+    bool commitMore() {
+      if ((_base == NULL) || (_committed >= ReservedBytes)) {
+	return false;
+      }
+      size_t amount = CommitBytes;
+      if (_committed + amount > ReservedBytes) {
+	amount = ReservedBytes - _committed;
+      }
+      if (!MmapWrapper::commit (_base + _committed, amount)) {
+	return false;
+      }
+      _committed += amount;
+      return true;
+    }
+
+    char * _base;
+
+    /// The first free object, by index.
+    uint32_t _freeList;
+
+    /// The next never-used index.
+    uint32_t _next;
+
+    size_t _committed;
+    size_t _inUse;
+  };
+
+
+  /**
+   * @class PoolHandle
+   * @brief A 32-bit reference to a T in a per-type IndexedPoolHeap (a compressed pointer).
+   *
+   * All handles of one type share singleton<Pool>, so a handle is just
+   * an index and dereferences with one multiply-add.
+   *
+   * <TT>
+   *   class NodeArena : public IndexedPoolHeap<sizeof(Node), 1 << 24> {};<BR>
+   *   typedef PoolHandle<Node, NodeArena> NodeRef;<BR>
+   *   NodeRef n = NodeRef::create (args);<BR>
+   *   n->next = NodeRef();<BR>
+   *   NodeRef::destroy (n);<BR>
+   * </TT>
+   */
+
+  template <class T, class Pool>
+  class PoolHandle {
+  public:
+
+    PoolHandle()
+      : _index (Pool::NullIndex)
+    {}
+
+    explicit PoolHandle (uint32_t index)
+      : _index (index)
+    {}
+
+    /// Construct a T in the pool (a null handle if the pool is exhausted).
+    template <class... Args>
+    static PoolHandle create (Args&&... args) {
+      sassert<(sizeof(T) <= (size_t) Pool::SlotSize)> verifyFits;
+      verifyFits = verifyFits;
+      const uint32_t index = pool().allocateIndex();
+      if (index != Pool::NullIndex) {
+	new (pool().toPointer (index)) T (std::forward<Args>(args)...);
+      }
+      return PoolHandle (index);
+    }
+
+    static void destroy (PoolHandle h) {
+      if (h) {
+	h->~T();
+	pool().freeIndex (h._index);
+      }
+    }
+
+    /// The handle of an object in the pool.
+    static PoolHandle fromPointer (const T * ptr) {
+      return PoolHandle (pool().toIndex (ptr));
+    }
+
+    inline T * get() const { return (T *) pool().toPointer (_index); }
+    inline T * operator->() const { return get(); }
+    inline T& operator*() const { return *get(); }
+    inline uint32_t index() const { return _index; }
+    inline explicit operator bool() const { return _index != Pool::NullIndex; }
+    inline bool operator== (const PoolHandle& other) const { return _index == other._index; }
+    inline bool operator!= (const PoolHandle& other) const { return _index != other._index; }
+
+    static Pool& pool() {
+      return singleton<Pool>::getInstance();
+    }
+
+  private:
+    uint32_t _index;
+  };
+
+}
+
+#endif
@@ -52,6 +52,9 @@ namespace HL {
 
     enum { Alignment = MallocInfo::Alignment };
 
+    /// The system allocator is thread-safe (see HeapTraits).
+    typedef MallocHeap ThreadSafe;
+
     inline void * malloc (size_t sz) {
       return ::malloc (sz);
     }
@@ -77,8 +77,9 @@ namespace HL {
   class PrivateMmapHeap {
   public:
 
-    /// All memory from here is zeroed.
-    enum { ZeroMemory = 1 };
+    /// All memory from here is zeroed, and any thread may call it (see HeapTraits).
+    typedef PrivateMmapHeap ZeroMemory;
+    typedef PrivateMmapHeap ThreadSafe;
 
     enum { Alignment = MmapWrapper::Alignment };
 
@@ -148,12 +149,7 @@ namespace HL {
 
   private:
 
-    // Note: we never reclaim memory obtained for MyHeap, even when
-    // this heap is destroyed.
-    class MyHeap : public LockedHeap<PosixLockType, FreelistHeap<BumpAlloc<16384, PrivateMmapHeap> > > {
-    };
-
-    typedef MyHashMap<void *, size_t, MyHeap> mapType;
+    typedef MyHashMap<void *, size_t, HashTableHeap> mapType;
 
   protected:
     mapType MyMap;
@@ -164,6 +160,9 @@ namespace HL {
 
     enum { Alignment = PrivateMmapHeap::Alignment };
 
+    typedef MmapHeap ZeroMemory;
+    typedef MmapHeap ThreadSafe;
+
     inline void * malloc (size_t sz) {
       void * ptr = PrivateMmapHeap::malloc (sz);
       MyMapLock.lock();
@@ -180,6 +179,26 @@ namespace HL {
       return sz;
     }
 
+#if defined(__linux__)
+    /// Grow or shrink a mapping without moving it, if the pages after it are free.
+    inline bool tryResize (void * ptr, size_t sz) {
+      MyMapLock.lock();
+      const size_t oldSize = MyMap.get (ptr);
+      bool resized = false;
+      if (oldSize != 0) {
+	const size_t oldLength = roundUp (oldSize);
+	const size_t newLength = roundUp (sz);
+	resized = (oldLength == newLength) ||
+	  (mremap (ptr, oldLength, newLength, 0) != MAP_FAILED);
+	if (resized) {
+	  MyMap.set (ptr, sz);
+	}
+      }
+      MyMapLock.unlock();
+      return resized;
+    }
+#endif
+
 #if 0
     // WORKAROUND: apparent gcc bug.
     void free (void * ptr, size_t sz) {
@@ -195,6 +214,12 @@ namespace HL {
       MyMap.erase (ptr);
       MyMapLock.unlock();
     }
+
+  private:
+
+    static inline size_t roundUp (size_t sz) {
+      return (sz + CPUInfo::PageSize - 1) & ~((size_t) CPUInfo::PageSize - 1);
+    }
 #endif
   };
 
@@ -10,3 +10,4 @@
 #include "traceheap.h"
 
 
+#include "trimmableheap.h"
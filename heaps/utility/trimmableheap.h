@@ -0,0 +1,174 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_TRIMMABLEHEAP_H
+#define HL_TRIMMABLEHEAP_H
+
+/**
+ * @class TrimmableHeap
+ * @brief Registers a locked heap's cache with the HeapRegistry, so it is cleared under memory pressure.
+ *
+ * On construction, registers a trim function that takes the heap's
+ * lock and calls clear() (as provided by FreelistHeap, SegHeap and
+ * friends); on destruction, unregisters it. SuperHeap must provide
+ * lock() and unlock() (as LockedHeap does) guarding the same state
+ * that clear() empties. Lower priorities are trimmed first. The
+ * bytes a trim reports are the drop in getMemoryHeld() (as SegHeap
+ * provides), or 0 if the heap does not track what it holds.
+ *
+ * Note that SegHeap::clear and StrictSegHeap::clear drain their
+ * little heaps until they return NULL, so those must be pure caches
+ * such as AdaptHeap, as in:
+ * <TT>
+ *   TrimmableHeap<LockedHeap<SpinLockType,
+ *                            KingsleyHeap<AdaptHeap<DLList, Top>, Top> >, 1>
+ * </TT>
+ *
+ * @class TrimmablePageHeap
+ * @brief Registers a page heap with the HeapRegistry, so it returns free pages to the OS under memory pressure.
+ *
+ * Like TrimmableHeap, but trimming calls releaseMemory(bytes) (as
+ * HugePageAwarePageHeap provides) or releaseMemory() (as PageHeap
+ * does), which report the bytes they released. SuperHeap must
+ * provide lock() and unlock() unless it locks itself, as in:
+ * <TT>
+ *   TrimmablePageHeap<LockedHeap<SpinLockType, PageHeap<MmapHeap> > >
+ *   TrimmablePageHeap<HugePageAwarePageHeap<> >
+ * </TT>
+ */
+
+#include <cstddef>
+
+#include "utility/heapregistry.h"
+
+namespace HL {
+
+  namespace trimmable {
+
+    // Each pair prefers the first overload (int) when it compiles.
+
+    template <class Heap>
+    auto memoryHeld (Heap& h, int) -> decltype ((size_t) h.getMemoryHeld()) {
+      return h.getMemoryHeld();
+    }
+
+    template <class Heap>
+    size_t memoryHeld (Heap&, long) {
+      return 0;
+    }
+
+    template <class Heap>
+    auto releaseMemory (Heap& h, size_t bytes, int) -> decltype ((size_t) h.releaseMemory (bytes)) {
+      return h.releaseMemory (bytes);
+    }
+
+    template <class Heap>
+    size_t releaseMemory (Heap& h, size_t, long) {
+      return h.releaseMemory();
+    }
+
+    template <class Heap>
+    auto lock (Heap& h, int) -> decltype (h.lock()) {
+      h.lock();
+    }
+
+    template <class Heap>
+    void lock (Heap&, long) {}
+
+    template <class Heap>
+    auto unlock (Heap& h, int) -> decltype (h.unlock()) {
+      h.unlock();
+    }
+
+    template <class Heap>
+    void unlock (Heap&, long) {}
+
+  }
+
+  template <class SuperHeap, int Priority = 0>
+  class TrimmableHeap : public SuperHeap {
+  public:
+
+    TrimmableHeap()
+      : _handle (HeapRegistry::add (trim, this, Priority))
+    {}
+
+    ~TrimmableHeap() {
+      HeapRegistry::remove (_handle);
+    }
+
+  private:
+
+    // Prevent copying (the registry holds a pointer to this heap).
+    TrimmableHeap (const TrimmableHeap&);
+    TrimmableHeap& operator= (const TrimmableHeap&);
+
+    /// Clearing releases everything, whatever was asked for.
+    static size_t trim (void * heap, size_t) {
+      SuperHeap& h = *((TrimmableHeap *) heap);
+      h.lock();
+      const size_t before = trimmable::memoryHeld (h, 0);
+      h.clear();
+      const size_t after = trimmable::memoryHeld (h, 0);
+      h.unlock();
+      return (before > after) ? before - after : 0;
+    }
+
+    const int _handle;
+  };
+
+  template <class SuperHeap, int Priority = 0>
+  class TrimmablePageHeap : public SuperHeap {
+  public:
+
+    TrimmablePageHeap()
+      : _handle (HeapRegistry::add (trim, this, Priority))
+    {}
+
+    ~TrimmablePageHeap() {
+      HeapRegistry::remove (_handle);
+    }
+
+  private:
+
+    // Prevent copying (the registry holds a pointer to this heap).
+    TrimmablePageHeap (const TrimmablePageHeap&);
+    TrimmablePageHeap& operator= (const TrimmablePageHeap&);
+
+    static size_t trim (void * heap, size_t bytes) {
+      SuperHeap& h = *((TrimmablePageHeap *) heap);
+      trimmable::lock (h, 0);
+      const size_t released = trimmable::releaseMemory (h, bytes, 0);
+      trimmable::unlock (h, 0);
+      return released;
+    }
+
+    const int _handle;
+  };
+
+}
+
+#endif
@@ -0,0 +1,123 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   libtuned.cpp
+ * @brief  One point in the autotuner's search space, as a malloc replacement.
+ *
+ * The composition is chosen at compile time by the autotune script:
+ *
+ *   HL_TUNE_CLASSES  the size-class table (HL::KingsleyClasses, HL::FineClasses)
+ *   HL_TUNE_CHUNK    the chunk size requested from the OS
+ *   HL_TUNE_HEAPS    the number of locked heaps
+ *   HL_TUNE_LOCK     the lock type (HL::SpinLockType, HL::PosixLockType)
+ *   HL_TUNE_CACHE    1 for a per-thread heap, 0 otherwise
+ *
+ * At exit, the peak resident set size (in kilobytes) is appended to
+ * the file named by $HL_AUTOTUNE_RESULT, if set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+volatile int anyThreadCreated = 1;
+
+#include "heaplayers.h"
+
+#ifndef HL_TUNE_CLASSES
+#define HL_TUNE_CLASSES HL::KingsleyClasses
+#endif
+#ifndef HL_TUNE_CHUNK
+#define HL_TUNE_CHUNK 65536
+#endif
+#ifndef HL_TUNE_HEAPS
+#define HL_TUNE_HEAPS 1
+#endif
+#ifndef HL_TUNE_LOCK
+#define HL_TUNE_LOCK HL::SpinLockType
+#endif
+#ifndef HL_TUNE_CACHE
+#define HL_TUNE_CACHE 0
+#endif
+
+class TheCustomHeapType :
+  public HL::TunedHeap<HL_TUNE_CLASSES,
+		       HL_TUNE_CHUNK,
+		       HL_TUNE_HEAPS,
+		       HL_TUNE_LOCK,
+		       HL_TUNE_CACHE>::Heap {};
+
+inline static TheCustomHeapType * getCustomHeap (void) {
+  static char thBuf[sizeof(TheCustomHeapType)];
+  static TheCustomHeapType * th = new (thBuf) TheCustomHeapType;
+  return th;
+}
+
+extern "C" {
+
+  void * xxmalloc (size_t sz) {
+    return getCustomHeap()->malloc (sz);
+  }
+
+  void xxfree (void * ptr) {
+    getCustomHeap()->free (ptr);
+  }
+
+  size_t xxmalloc_usable_size (void * ptr) {
+    return getCustomHeap()->getSize (ptr);
+  }
+
+  void xxmalloc_lock (void) {}
+
+  void xxmalloc_unlock (void) {}
+
+}
+
+#include "wrappers/wrapper.cpp"
+
+// Report the peak RSS to the autotuner. Uses only stack buffers and
+// raw file descriptors, since the heap may be in any state by now.
+__attribute__((destructor))
+static void reportResult (void) {
+  const char * fname = getenv ("HL_AUTOTUNE_RESULT");
+  if (fname == NULL) {
+    return;
+  }
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  char buf[64];
+  int len = snprintf (buf, sizeof(buf), "%ld\n", (long) usage.ru_maxrss);
+  int fd = open (fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd >= 0) {
+    if (write (fd, buf, len) != len) {
+      // Nothing to be done.
+    }
+    close (fd);
+  }
+}
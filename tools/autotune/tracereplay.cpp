@@ -0,0 +1,94 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   tracereplay.cpp
+ * @brief  Replays a TraceHeap or LogHeap trace through malloc and free.
+ *
+ * Usage: tracereplay <tracefile> [repetitions]
+ *
+ * Run it under LD_PRELOAD (as the autotune script does) to measure a
+ * malloc replacement against a recorded workload. Addresses in the
+ * trace are mapped to the objects allocated during the replay; frees
+ * of addresses the trace never allocated are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unordered_map>
+
+#include "utility/tracefile.h"
+
+int
+main (int argc, char * argv[])
+{
+  if (argc < 2) {
+    fprintf (stderr, "Usage: %s <tracefile> [repetitions]\n", argv[0]);
+    return 1;
+  }
+  int repetitions = (argc > 2) ? atoi (argv[2]) : 1;
+  unsigned long mallocs = 0;
+  unsigned long frees = 0;
+
+  for (int i = 0; i < repetitions; i++) {
+    HL::TraceReader trace (argv[1]);
+    if (!trace.is_open()) {
+      fprintf (stderr, "Could not open %s.\n", argv[1]);
+      return 1;
+    }
+    std::unordered_map<unsigned long, void *> live;
+    HL::TraceEvent e;
+    while (trace.next (e)) {
+      if (e.op == HL::TraceEvent::MALLOC) {
+	void * ptr = malloc (e.size);
+	if (ptr != NULL) {
+	  // Touch the object, as the traced program would have.
+	  memset (ptr, 0, e.size);
+	}
+	// A reused address means the trace lost a free; don't leak over it.
+	void *& slot = live[e.address];
+	free (slot);
+	slot = ptr;
+	mallocs++;
+      } else if (e.op == HL::TraceEvent::FREE) {
+	auto it = live.find (e.address);
+	if (it != live.end()) {
+	  free (it->second);
+	  live.erase (it);
+	  frees++;
+	}
+      }
+    }
+    for (auto& entry : live) {
+      free (entry.second);
+    }
+  }
+
+  printf ("# replayed %lu mallocs, %lu frees\n", mallocs, frees);
+  return 0;
+}
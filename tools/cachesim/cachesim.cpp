@@ -0,0 +1,447 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   cachesim.cpp
+ * @brief  Simulates the cache and TLB behavior of a heap's object placement.
+ *
+ * Replays a TraceHeap/LogHeap trace through one heap composition and
+ * feeds the addresses the application would touch into a hierarchy of
+ * set-associative LRU caches and a TLB. By default every object is
+ * written in full when allocated; access samples ("A" lines) in the
+ * trace are mapped into the replayed object that contains them.
+ *
+ * Usage: cachesim [options] <composition> <tracefile>
+ *
+ *   -c size,line,ways   add a cache level (default: 32768,64,8 and 1048576,64,16)
+ *   -t entries,ways     the TLB (default: 64,4)
+ *   -p pagesize         the page size (default: 4096)
+ *   -w events           events per working-set window (default: 10000)
+ *   -n                  do not touch objects when they are allocated
+ *
+ * Accesses made by the heap to its own metadata are not simulated.
+ * Run under "setarch -R" so that the heap sees the same addresses
+ * from run to run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "heaplayers.h"
+#include "utility/tracefile.h"
+
+using namespace HL;
+
+
+/**
+ * @class CacheModel
+ * @brief A set-associative cache with LRU replacement.
+ */
+
+class CacheModel {
+public:
+
+  CacheModel (size_t size, size_t lineSize, int ways)
+    : _lineShift (ilog2 (lineSize)),
+      _ways (ways),
+      _numSets (size / (lineSize * ways) ? size / (lineSize * ways) : 1),
+      _tags (_numSets * ways, ~0UL),
+      _stamps (_numSets * ways, 0),
+      _clock (0),
+      _accesses (0),
+      _misses (0),
+      _size (size),
+      _lineSize (lineSize)
+  {}
+
+  /// Access the line holding addr; returns true on a hit.
+  bool access (unsigned long addr) {
+    const unsigned long line = addr >> _lineShift;
+    const size_t base = (line % _numSets) * _ways;
+    _clock++;
+    _accesses++;
+    size_t victim = base;
+    for (size_t i = base; i < base + _ways; i++) {
+      if (_tags[i] == line) {
+	_stamps[i] = _clock;
+	return true;
+      }
+      if (_stamps[i] < _stamps[victim]) {
+	victim = i;
+      }
+    }
+    _misses++;
+    _tags[victim] = line;
+    _stamps[victim] = _clock;
+    return false;
+  }
+
+  size_t lineSize() const { return _lineSize; }
+
+  void report (const char * name) const {
+    printf ("%s (%lu bytes, %lu-byte lines, %d-way): %lu accesses, %lu misses, miss rate %.4f\n",
+	    name, (unsigned long) _size, (unsigned long) _lineSize, _ways,
+	    _accesses, _misses,
+	    _accesses ? (double) _misses / (double) _accesses : 0.0);
+  }
+
+private:
+  const unsigned int _lineShift;
+  const int _ways;
+  const size_t _numSets;
+  std::vector<unsigned long> _tags;
+  std::vector<unsigned long> _stamps;
+  unsigned long _clock;
+  unsigned long _accesses;
+  unsigned long _misses;
+  const size_t _size;
+  const size_t _lineSize;
+};
+
+
+/// Feeds accesses through the cache levels and the TLB, and tracks
+/// which lines and pages are touched.
+class MemorySystem {
+public:
+
+  MemorySystem (std::vector<CacheModel>& caches, CacheModel& tlb, size_t pageSize)
+    : _caches (caches),
+      _tlb (tlb),
+      _lineShift (ilog2 (caches[0].lineSize())),
+      _pageShift (ilog2 (pageSize))
+  {}
+
+  /// Touch every line in [addr, addr + sz).
+  void touch (unsigned long addr, size_t sz) {
+    if (sz == 0) {
+      sz = 1;
+    }
+    const unsigned long first = addr >> _lineShift;
+    const unsigned long last = (addr + sz - 1) >> _lineShift;
+    for (unsigned long line = first; line <= last; line++) {
+      const unsigned long a = line << _lineShift;
+      _tlb.access (a);
+      for (size_t i = 0; i < _caches.size(); i++) {
+	if (_caches[i].access (a)) {
+	  break;
+	}
+      }
+      _lines.insert (line);
+      _windowLines.insert (line);
+      _pages.insert (a >> _pageShift);
+      _windowPages.insert (a >> _pageShift);
+    }
+  }
+
+  size_t lines() const { return _lines.size(); }
+  size_t pages() const { return _pages.size(); }
+  size_t windowLines() const { return _windowLines.size(); }
+  size_t windowPages() const { return _windowPages.size(); }
+
+  void endWindow() {
+    _windowLines.clear();
+    _windowPages.clear();
+  }
+
+private:
+  std::vector<CacheModel>& _caches;
+  CacheModel& _tlb;
+  const unsigned int _lineShift;
+  const unsigned int _pageShift;
+  std::unordered_set<unsigned long> _lines;
+  std::unordered_set<unsigned long> _pages;
+  std::unordered_set<unsigned long> _windowLines;
+  std::unordered_set<unsigned long> _windowPages;
+};
+
+
+// The compositions under test.
+
+class KingsleyTop : public SizeHeap<UniqueHeap<ZoneHeap<MmapHeap, 65536> > > {};
+
+/// Size classes share one chunk source, so they interleave in memory.
+class KingsleyComposition :
+  public ANSIWrapper<KingsleyHeap<AdaptHeap<DLList, KingsleyTop>, KingsleyTop> > {};
+
+/// The same, with chunk starts rotated across cache-line colors.
+class KingsleyColorTop : public SizeHeap<UniqueHeap<ZoneHeap<ColorHeap<MmapHeap>, 65536> > > {};
+
+class KingsleyColorComposition :
+  public ANSIWrapper<KingsleyHeap<AdaptHeap<DLList, KingsleyColorTop>, KingsleyColorTop> > {};
+
+/// Every size class bumps through chunks of its own, as in a slab allocator.
+class SlabComposition :
+  public ANSIWrapper<KingsleyHeap<FreelistHeap<SizeHeap<BumpAlloc<65536, MmapHeap, 16> > >,
+				  SizeHeap<MmapHeap> > > {};
+
+class FineComposition :
+  public TunedHeap<FineClasses, 65536, 1, SpinLockType, false>::Heap {};
+
+class ZoneComposition :
+  public ANSIWrapper<SizeHeap<ZoneHeap<MmapHeap, 65536> > > {};
+
+class MallocComposition :
+  public MallocHeap {};
+
+
+class Options {
+public:
+  std::vector<CacheModel> caches;
+  size_t tlbEntries;
+  int tlbWays;
+  size_t pageSize;
+  unsigned long window;
+  bool touchOnMalloc;
+};
+
+
+class Object {
+public:
+  char * ptr;
+  size_t size;
+};
+
+
+template <class TheHeap>
+static int simulate (const char * name, const char * tracefile, Options& opts)
+{
+  TraceReader trace (tracefile);
+  if (!trace.is_open()) {
+    fprintf (stderr, "Could not open %s.\n", tracefile);
+    return 1;
+  }
+
+  static char heapBuf[sizeof(TheHeap)];
+  TheHeap * heap = new (heapBuf) TheHeap;
+
+  CacheModel tlb (opts.tlbEntries * opts.pageSize, opts.pageSize, opts.tlbWays);
+  MemorySystem mem (opts.caches, tlb, opts.pageSize);
+
+  // Live objects, keyed by their address in the traced run.
+  std::map<unsigned long, Object> live;
+  size_t liveBytes = 0;
+
+  unsigned long events = 0;
+  unsigned long unmapped = 0;
+  unsigned long windows = 0;
+  double sumWindowPages = 0, sumWindowLines = 0, sumDensity = 0;
+  size_t maxWindowPages = 0;
+
+  TraceEvent e;
+  while (trace.next (e)) {
+    events++;
+    switch (e.op) {
+    case TraceEvent::MALLOC:
+      {
+	char * ptr = (char *) heap->malloc (e.size);
+	if (ptr == NULL) {
+	  break;
+	}
+	// A reused address means the trace lost a free.
+	auto it = live.find (e.address);
+	if (it != live.end()) {
+	  liveBytes -= it->second.size;
+	  heap->free (it->second.ptr);
+	}
+	Object& o = live[e.address];
+	o.ptr = ptr;
+	o.size = e.size;
+	liveBytes += e.size;
+	if (opts.touchOnMalloc) {
+	  mem.touch ((unsigned long) ptr, e.size);
+	}
+      }
+      break;
+    case TraceEvent::FREE:
+      {
+	auto it = live.find (e.address);
+	if (it != live.end()) {
+	  liveBytes -= it->second.size;
+	  heap->free (it->second.ptr);
+	  live.erase (it);
+	}
+      }
+      break;
+    case TraceEvent::ACCESS:
+      {
+	// Find the object holding this address in the traced run.
+	auto it = live.upper_bound (e.address);
+	if (it != live.begin()) {
+	  --it;
+	  const unsigned long offset = e.address - it->first;
+	  if (offset < it->second.size) {
+	    mem.touch ((unsigned long) it->second.ptr + offset, e.size);
+	    break;
+	  }
+	}
+	unmapped++;
+      }
+      break;
+    }
+
+    if (events % opts.window == 0) {
+      // How densely do the live objects fill the pages they occupy?
+      std::unordered_set<unsigned long> livePages;
+      for (auto& entry : live) {
+	const unsigned long start = (unsigned long) entry.second.ptr;
+	const size_t sz = entry.second.size ? entry.second.size : 1;
+	for (unsigned long p = start / opts.pageSize; p <= (start + sz - 1) / opts.pageSize; p++) {
+	  livePages.insert (p);
+	}
+      }
+      if (livePages.size()) {
+	sumDensity += (double) liveBytes / (double) (livePages.size() * opts.pageSize);
+      }
+      sumWindowPages += mem.windowPages();
+      sumWindowLines += mem.windowLines();
+      if (mem.windowPages() > maxWindowPages) {
+	maxWindowPages = mem.windowPages();
+      }
+      windows++;
+      mem.endWindow();
+    }
+  }
+
+  printf ("# composition: %s, trace: %s, events: %lu\n", name, tracefile, events);
+  char levelName[32];
+  for (size_t i = 0; i < opts.caches.size(); i++) {
+    sprintf (levelName, "L%lu", (unsigned long) (i + 1));
+    opts.caches[i].report (levelName);
+  }
+  tlb.report ("TLB");
+  printf ("lines touched: %lu, pages touched: %lu\n",
+	  (unsigned long) mem.lines(), (unsigned long) mem.pages());
+  if (windows) {
+    printf ("per %lu-event window: %.1f lines, %.1f pages (max %lu), live-page density %.3f\n",
+	    opts.window, sumWindowLines / windows, sumWindowPages / windows,
+	    (unsigned long) maxWindowPages, sumDensity / windows);
+  }
+  if (unmapped) {
+    printf ("access samples outside any live object: %lu\n", unmapped);
+  }
+  return 0;
+}
+
+
+class Composition {
+public:
+  const char * name;
+  int (*run) (const char *, const char *, Options&);
+};
+
+static const Composition compositions[] = {
+  { "kingsley",       simulate<KingsleyComposition> },
+  { "kingsley-color", simulate<KingsleyColorComposition> },
+  { "slab",           simulate<SlabComposition> },
+  { "fine",           simulate<FineComposition> },
+  { "zone",           simulate<ZoneComposition> },
+  { "malloc",         simulate<MallocComposition> }
+};
+
+enum { NUM_COMPOSITIONS = sizeof(compositions) / sizeof(Composition) };
+
+
+static void usage (const char * prog) {
+  fprintf (stderr, "Usage: %s [-c size,line,ways]... [-t entries,ways] [-p pagesize] [-w events] [-n] <composition> <tracefile>\n", prog);
+  fprintf (stderr, "Compositions:");
+  for (int i = 0; i < NUM_COMPOSITIONS; i++) {
+    fprintf (stderr, " %s", compositions[i].name);
+  }
+  fprintf (stderr, "\n");
+}
+
+static bool powerOfTwo (unsigned long v) {
+  return v && !(v & (v - 1));
+}
+
+int
+main (int argc, char * argv[])
+{
+  Options opts;
+  opts.tlbEntries = 64;
+  opts.tlbWays = 4;
+  opts.pageSize = CPUInfo::PageSize;
+  opts.window = 10000;
+  opts.touchOnMalloc = true;
+
+  int c;
+  unsigned long size, line, ways;
+  while ((c = getopt (argc, argv, "c:t:p:w:n")) != -1) {
+    switch (c) {
+    case 'c':
+      if (sscanf (optarg, "%lu,%lu,%lu", &size, &line, &ways) != 3
+	  || !powerOfTwo (line) || (ways == 0)) {
+	fprintf (stderr, "Bad cache specification: %s\n", optarg);
+	return 1;
+      }
+      opts.caches.push_back (CacheModel (size, line, ways));
+      break;
+    case 't':
+      if (sscanf (optarg, "%lu,%lu", &size, &ways) != 2 || (ways == 0)) {
+	fprintf (stderr, "Bad TLB specification: %s\n", optarg);
+	return 1;
+      }
+      opts.tlbEntries = size;
+      opts.tlbWays = ways;
+      break;
+    case 'p':
+      opts.pageSize = strtoul (optarg, NULL, 10);
+      break;
+    case 'w':
+      opts.window = strtoul (optarg, NULL, 10);
+      break;
+    case 'n':
+      opts.touchOnMalloc = false;
+      break;
+    default:
+      usage (argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind < 2 || !powerOfTwo (opts.pageSize) || (opts.window == 0)) {
+    usage (argv[0]);
+    return 1;
+  }
+  if (opts.caches.empty()) {
+    opts.caches.push_back (CacheModel (32768, 64, 8));
+    opts.caches.push_back (CacheModel (1048576, 64, 16));
+  }
+
+  for (int i = 0; i < NUM_COMPOSITIONS; i++) {
+    if (strcmp (argv[optind], compositions[i].name) == 0) {
+      return compositions[i].run (compositions[i].name, argv[optind + 1], opts);
+    }
+  }
+  fprintf (stderr, "Unknown composition: %s\n", argv[optind]);
+  return 1;
+}
@@ -0,0 +1,68 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   compositions.h
+ * @brief  The heap compositions built into libselectable.
+ *
+ * Each HL_COMPOSITION(name, Type) entry is instantiated in the library
+ * and can be chosen at startup by name. To A/B a new variant, add its
+ * class here and an entry to the list; the first entry is the default.
+ */
+
+#ifndef HL_SELECTABLE_COMPOSITIONS_H
+#define HL_SELECTABLE_COMPOSITIONS_H
+
+#include "heaplayers.h"
+
+namespace Compositions {
+
+  using namespace HL;
+
+  class KingsleyTop : public SizeHeap<UniqueHeap<ZoneHeap<MmapHeap, 65536> > > {};
+
+  /// libkingsley's composition, behind one lock; its free lists are
+  /// cleared by hl_release_free_memory, malloc_trim and the scavenger.
+  class Kingsley :
+    public TrimmableHeap<LockedHeap<SpinLockType,
+				    ANSIWrapper<KingsleyHeap<AdaptHeap<DLList, KingsleyTop>, KingsleyTop> > > > {};
+
+  /// Finer size classes, one locked heap.
+  class Fine :
+    public TunedHeap<FineClasses, 65536, 1, SpinLockType, 0>::Heap {};
+
+  /// Finer size classes, four heaps and a per-thread cache.
+  class FineCached :
+    public TunedHeap<FineClasses, 65536, 4, SpinLockType, 1>::Heap {};
+
+}
+
+#define HL_COMPOSITIONS(HL_COMPOSITION)			\
+  HL_COMPOSITION(kingsley, Compositions::Kingsley)	\
+  HL_COMPOSITION(fine, Compositions::Fine)		\
+  HL_COMPOSITION(finecached, Compositions::FineCached)
+
+#endif
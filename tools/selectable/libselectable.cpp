@@ -0,0 +1,316 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * @file   libselectable.cpp
+ * @brief  A malloc replacement containing several compositions, one chosen at startup.
+ *
+ * Every composition listed in compositions.h is compiled in. The one
+ * used is named by $HL_COMPOSITION or, failing that, by the first
+ * word of the file named by $HL_COMPOSITION_CONFIG (by default
+ * /etc/heaplayers/composition); otherwise the first in the list.
+ *
+ * The choice is made once, by a constructor or by the first call if
+ * that comes earlier, and published as function pointers: xxmalloc,
+ * xxfree and xxmalloc_usable_size each make one indirect call to the
+ * chosen composition. (The choice reads the environment and a file,
+ * so it cannot be made by an ifunc resolver, which runs during
+ * relocation, before libc is initialized.)
+ *
+ * If $HL_SCAVENGER_MS is set, a HeapRegistry scavenger checks memory
+ * pressure that often and trims the compositions that registered
+ * (see compositions.h); hl_release_free_memory() and malloc_trim()
+ * trim them on demand.
+ *
+ * Each composition counts its calls and requested bytes. At exit, if
+ * $HL_COMPOSITION_STATS names a file, a line tagged with the
+ * composition's name is appended to it:
+ *
+ *   composition=fine pid=1234 mallocs=... frees=... bytes=... peak_rss_kb=... seconds=...
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <atomic>
+
+volatile int anyThreadCreated = 1;
+
+#include "compositions.h"
+
+namespace {
+
+  /// Call counts, spread over cache lines by thread to limit contention.
+  class Stats {
+  public:
+    enum { Shards = 64 };
+
+    inline void countMalloc (size_t sz) {
+      Shard& s = shard();
+      s.mallocs.fetch_add (1, std::memory_order_relaxed);
+      s.bytes.fetch_add (sz, std::memory_order_relaxed);
+    }
+
+    inline void countFree() {
+      shard().frees.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    void totals (size_t& mallocs, size_t& frees, size_t& bytes) const {
+      mallocs = frees = bytes = 0;
+      for (int i = 0; i < Shards; i++) {
+	mallocs += _shards[i].mallocs.load();
+	frees += _shards[i].frees.load();
+	bytes += _shards[i].bytes.load();
+      }
+    }
+
+  private:
+    class Shard {
+    public:
+      std::atomic<size_t> mallocs;
+      std::atomic<size_t> frees;
+      std::atomic<size_t> bytes;
+      char pad[64 - 3 * sizeof(std::atomic<size_t>)];
+    };
+
+    /// This thread's shard, handed out round robin.
+    inline Shard& shard() {
+      static std::atomic<unsigned int> nextShard (0);
+      static thread_local int shard = (int) (nextShard.fetch_add (1) % Shards);
+      return _shards[shard];
+    }
+
+    Shard _shards[Shards];
+  };
+
+  enum {
+#define HL_INDEX(name, Type) Index_##name,
+    HL_COMPOSITIONS(HL_INDEX)
+#undef HL_INDEX
+    NumCompositions
+  };
+
+  Stats theStats[NumCompositions];
+
+  /// The entry points of one composition, with its own instance and stats.
+  template <class Heap, int Index>
+  class Selectable {
+  public:
+    static void * malloc (size_t sz) {
+      theStats[Index].countMalloc (sz);
+      return getHeap()->malloc (sz);
+    }
+    static void free (void * ptr) {
+      if (ptr != NULL) {
+	theStats[Index].countFree();
+	getHeap()->free (ptr);
+      }
+    }
+    static size_t usableSize (void * ptr) {
+      return (ptr == NULL) ? 0 : getHeap()->getSize (ptr);
+    }
+  private:
+    static Heap * getHeap() {
+      static char buf[sizeof(Heap)];
+      static Heap * h = new (buf) Heap;
+      return h;
+    }
+  };
+
+  class Composition {
+  public:
+    const char * name;
+    void * (*malloc) (size_t);
+    void (*free) (void *);
+    size_t (*usableSize) (void *);
+  };
+
+  const Composition theCompositions[NumCompositions] = {
+#define HL_ENTRY(name, Type)						\
+    { #name,								\
+      &Selectable<Type, Index_##name>::malloc,				\
+      &Selectable<Type, Index_##name>::free,				\
+      &Selectable<Type, Index_##name>::usableSize },
+    HL_COMPOSITIONS(HL_ENTRY)
+#undef HL_ENTRY
+  };
+
+  struct timespec startTime;
+
+  /// Read the first word of a file into buf (without allocating).
+  bool readConfig (const char * fname, char * buf, size_t len) {
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    ssize_t n = read (fd, buf, len - 1);
+    close (fd);
+    if (n <= 0) {
+      return false;
+    }
+    buf[n] = '\0';
+    char * word = buf;
+    while ((*word == ' ') || (*word == '\t') || (*word == '\n')) {
+      word++;
+    }
+    size_t w = strcspn (word, " \t\r\n");
+    memmove (buf, word, w);
+    buf[w] = '\0';
+    return w > 0;
+  }
+
+  int chooseComposition() {
+    char buf[128];
+    const char * name = getenv ("HL_COMPOSITION");
+    if (name == NULL) {
+      const char * config = getenv ("HL_COMPOSITION_CONFIG");
+      if (readConfig ((config != NULL) ? config : "/etc/heaplayers/composition", buf, sizeof(buf))) {
+	name = buf;
+      }
+    }
+    if (name != NULL) {
+      for (int i = 0; i < NumCompositions; i++) {
+	if (strcmp (name, theCompositions[i].name) == 0) {
+	  return i;
+	}
+      }
+      const char msg[] = "libselectable: unknown composition; using the default.\n";
+      if (write (2, msg, sizeof(msg) - 1) < 0) {
+	// Nothing to be done.
+      }
+    }
+    return 0;
+  }
+
+  void * chooseMalloc (size_t);
+  void chooseFree (void *);
+  size_t chooseUsableSize (void *);
+
+  /// The chosen composition's entry points (until then, functions that choose).
+  void * (* theMalloc) (size_t) = chooseMalloc;
+  void (* theFree) (void *) = chooseFree;
+  size_t (* theUsableSize) (void *) = chooseUsableSize;
+
+  /// The chosen composition (decided on the first call).
+  int selected() {
+    static int choice = -1;
+    if (choice < 0) {
+      clock_gettime (CLOCK_MONOTONIC, &startTime);
+      const int c = chooseComposition();
+      theMalloc = theCompositions[c].malloc;
+      theFree = theCompositions[c].free;
+      theUsableSize = theCompositions[c].usableSize;
+      choice = c;
+    }
+    return choice;
+  }
+
+  void * chooseMalloc (size_t sz) {
+    return theCompositions[selected()].malloc (sz);
+  }
+
+  void chooseFree (void * ptr) {
+    theCompositions[selected()].free (ptr);
+  }
+
+  size_t chooseUsableSize (void * ptr) {
+    return theCompositions[selected()].usableSize (ptr);
+  }
+
+  /// Choose before main, once libc is ready, so calls go straight to the composition.
+  __attribute__((constructor))
+  void chooseAtStartup() {
+    selected();
+    const char * period = getenv ("HL_SCAVENGER_MS");
+    if ((period != NULL) && (atol (period) > 0)) {
+      HL::HeapRegistry::startScavenger (atol (period));
+    }
+  }
+
+}
+
+extern "C" {
+
+  void * xxmalloc (size_t sz) {
+    return theMalloc (sz);
+  }
+
+  void xxfree (void * ptr) {
+    theFree (ptr);
+  }
+
+  size_t xxmalloc_usable_size (void * ptr) {
+    return theUsableSize (ptr);
+  }
+
+  void xxmalloc_lock (void) {}
+
+  void xxmalloc_unlock (void) {}
+
+  /// The name of the composition in use.
+  const char * hl_composition_name (void) {
+    return theCompositions[selected()].name;
+  }
+
+}
+
+#include "wrappers/wrapper.cpp"
+
+// Append this process's stats, tagged with the composition, to
+// $HL_COMPOSITION_STATS. Uses only stack buffers and raw file
+// descriptors, since the heap may be in any state by now.
+__attribute__((destructor))
+static void reportStats (void) {
+  const char * fname = getenv ("HL_COMPOSITION_STATS");
+  if (fname == NULL) {
+    return;
+  }
+  const int index = selected();
+  size_t mallocs, frees, bytes;
+  theStats[index].totals (mallocs, frees, bytes);
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  const double seconds = (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) * 1e-9;
+  char buf[256];
+  int len = snprintf (buf, sizeof(buf),
+		      "composition=%s pid=%d mallocs=%zu frees=%zu bytes=%zu peak_rss_kb=%ld seconds=%.3f\n",
+		      theCompositions[index].name, (int) getpid(), mallocs, frees, bytes,
+		      (long) usage.ru_maxrss, seconds);
+  int fd = open (fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd >= 0) {
+    if (write (fd, buf, len) != len) {
+      // Nothing to be done.
+    }
+    close (fd);
+  }
+}
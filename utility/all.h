@@ -4,20 +4,28 @@
 #include "bins4k.h"
 #include "bins64k.h"
 #include "bins8k.h"
+#include "callsite.h"
 #include "checkpoweroftwo.h"
 #include "dllist.h"
 #include "dynarray.h"
 #include "exactlyone.h"
+#include "freebatch.h"
 #include "freesllist.h"
 #include "hash.h"
+#include "heapregistry.h"
+#include "heaptraits.h"
 #include "ilog2.h"
 #include "gcd.h"
 #include "guard.h"
 #include "istrue.h"
 #include "lcm.h"
+#include "mallocnear.h"
 #include "modulo.h"
 #include "myhashmap.h"
+#include "rangemap.h"
+#include "releasebatcher.h"
 #include "sassert.h"
 #include "sllist.h"
 #include "timer.h"
+#include "tracefile.h"
 
@@ -0,0 +1,139 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_CALLSITE_H
+#define HL_CALLSITE_H
+
+/**
+ * @class CallSite
+ * @brief Names allocation sites in a form that survives address-space randomization.
+ *
+ * A site (a return address) is written as "module+0xoffset", where
+ * module is the base name of the executable or shared object holding
+ * it, so that profiles written by one run can be loaded by the next.
+ * Sites that cannot be attributed to a module (and all sites off
+ * Linux) are written as raw addresses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <dlfcn.h>
+#include <link.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HL_RETURN_ADDRESS() _ReturnAddress()
+#else
+/// The return address of the current function, i.e., its call site.
+#define HL_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+namespace HL {
+
+  class CallSite {
+  public:
+
+    /// Write the portable name of a site into buf.
+    static void format (void * site, char * buf, size_t len) {
+#if defined(__linux__)
+      Dl_info info;
+      if (dladdr (site, &info) && info.dli_fname && info.dli_fbase) {
+	snprintf (buf, len, "%s+0x%lx",
+		  baseName (info.dli_fname),
+		  (unsigned long) ((char *) site - (char *) info.dli_fbase));
+	return;
+      }
+#endif
+      snprintf (buf, len, "0x%lx", (unsigned long) site);
+    }
+
+    /// Resolve a name written by format back to an address in this
+    /// process; returns NULL if its module is not loaded.
+    static void * resolve (const char * name) {
+      const char * plus = strrchr (name, '+');
+      if (plus == NULL) {
+	return (void *) strtoul (name, NULL, 16);
+      }
+#if defined(__linux__)
+      Lookup l;
+      size_t len = (size_t) (plus - name);
+      if (len >= sizeof(l.module)) {
+	return NULL;
+      }
+      memcpy (l.module, name, len);
+      l.module[len] = '\0';
+      l.base = 0;
+      dl_iterate_phdr (findModule, &l);
+      if (l.base != 0) {
+	return (void *) (l.base + strtoul (plus + 1, NULL, 16));
+      }
+#endif
+      return NULL;
+    }
+
+  private:
+
+    static const char * baseName (const char * path) {
+      const char * slash = strrchr (path, '/');
+      return slash ? slash + 1 : path;
+    }
+
+#if defined(__linux__)
+    class Lookup {
+    public:
+      char module[256];
+      unsigned long base;
+    };
+
+    static int findModule (struct dl_phdr_info * info, size_t, void * data) {
+      Lookup * l = (Lookup *) data;
+      // Ask the loader which file the first loaded segment belongs to,
+      // so that the base and the name match what format reported.
+      for (int i = 0; i < info->dlpi_phnum; i++) {
+	if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+	  Dl_info dinfo;
+	  void * addr = (void *) (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+	  if (dladdr (addr, &dinfo) && dinfo.dli_fname && dinfo.dli_fbase
+	      && (strcmp (baseName (dinfo.dli_fname), l->module) == 0)) {
+	    l->base = (unsigned long) dinfo.dli_fbase;
+	    return 1;
+	  }
+	  return 0;
+	}
+      }
+      return 0;
+    }
+#endif
+
+  };
+
+}
+
+#endif
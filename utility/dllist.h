@@ -69,6 +69,20 @@ public:
     return (Entry *) e;
   }
 
+  /// Unlink the first of the first maxScan entries that lies in
+  /// the same nearBytes-aligned block as hint (NULL if none does).
+  inline Entry * getNear (const void * hint, size_t nearBytes, int maxScan) {
+    Entry * e = head.next;
+    for (int i = 0; (i < maxScan) && (e != &head); i++) {
+      if (((size_t) e ^ (size_t) hint) < nearBytes) {
+	e->remove();
+	return e;
+      }
+      e = e->next;
+    }
+    return NULL;
+  }
+
   /// Remove one item from the list.
   inline void remove (Entry * e) {
     e->remove();
@@ -0,0 +1,82 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_FREEBATCH_H
+#define HL_FREEBATCH_H
+
+/**
+ * @class FreeBatch
+ * @brief Batch frees: release many objects to a heap at once.
+ *
+ * A heap that can free several objects more cheaply than one at a
+ * time (taking its lock once, say) provides
+ *
+ * @code
+ *  void freeBatch (void ** ptrs, size_t n);
+ * @endcode
+ *
+ * Layers that accumulate frees hand them over through
+ * FreeBatch::release, which calls free on each object when the heap
+ * has no freeBatch. As with MallocNear, an inherited freeBatch is
+ * only used if it is declared by the same class as the heap's free
+ * (see HeapTraits), so that it cannot skip a layer's own free.
+ */
+
+#include <cstddef>
+#include <type_traits>
+
+#include "utility/heaptraits.h"
+
+namespace HL {
+
+  class FreeBatch {
+  public:
+
+    /// Free the n objects in ptrs to heap h.
+    template <class Heap>
+    static inline void release (Heap& h, void ** ptrs, size_t n) {
+      dispatch (h, ptrs, n, std::integral_constant<bool, HeapTraits<Heap>::HasFreeBatch>());
+    }
+
+  private:
+
+    template <class Heap>
+    static inline void dispatch (Heap& h, void ** ptrs, size_t n, std::true_type) {
+      h.freeBatch (ptrs, n);
+    }
+
+    template <class Heap>
+    static inline void dispatch (Heap& h, void ** ptrs, size_t n, std::false_type) {
+      for (size_t i = 0; i < n; i++) {
+	h.free (ptrs[i]);
+      }
+    }
+
+  };
+
+}
+
+#endif
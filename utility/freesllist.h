@@ -42,6 +42,21 @@ public:
     return const_cast<Entry *>(e);
   }
   
+  /// Unlink the first of the first maxScan entries that lies in
+  /// the same nearBytes-aligned block as hint (NULL if none does).
+  inline Entry * getNear (const void * hint, size_t nearBytes, int maxScan) {
+    Entry * prev = &head;
+    for (int i = 0; (i < maxScan) && (prev->next != NULL); i++) {
+      Entry * e = prev->next;
+      if (((size_t) e ^ (size_t) hint) < nearBytes) {
+	prev->next = e->next;
+	return e;
+      }
+      prev = e;
+    }
+    return NULL;
+  }
+
   inline void insert (void * e) {
     Entry * entry = reinterpret_cast<Entry *>(e);
     entry->next = head.next;
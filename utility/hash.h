@@ -5,6 +5,7 @@
 
 #include <cstdlib>
 #include <stdlib.h>
+#include <stdint.h>
 
 namespace HL {
 
@@ -14,19 +15,30 @@ namespace HL {
     static size_t hash (Key k);
   };
   
+  /// A 64-bit finalizer (from MurmurHash3): every input bit affects every output bit.
+  inline size_t mixBits (uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (size_t) x;
+  }
+
   template <>
   class Hash<size_t> {
   public:
-    static inline size_t hash (void * v) {
-      return (size_t) v;
+    static inline size_t hash (size_t v) {
+      return mixBits (v);
     }
   };
   
+  /// Pointers are mostly aligned and clustered, so their bits must be mixed.
   template <>
   class Hash<void *> {
   public:
     static inline size_t hash (void * v) {
-      return (size_t) ((size_t) v);
+      return mixBits ((uint64_t) (uintptr_t) v);
     }
   };
   
@@ -34,7 +46,7 @@ namespace HL {
   class Hash<int> {
   public:
     static inline size_t hash (int v) {
-      return (size_t) v;
+      return mixBits ((uint64_t) (unsigned int) v);
     }
   };
 
@@ -0,0 +1,382 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_HEAPREGISTRY_H
+#define HL_HEAPREGISTRY_H
+
+/**
+ * @class HeapRegistry
+ * @brief A process-wide list of heap caches that can be trimmed under memory pressure.
+ *
+ * Heaps (usually through TrimmableHeap) register a trim function with
+ * a priority; trim() calls them in ascending priority order, so
+ * caches that are cheapest to refill should register with the lowest
+ * priority. A trim function returns the number of bytes it released,
+ * or 0 if it cannot tell; trimming stops once the known total reaches
+ * the amount asked for.
+ *
+ * startScavenger() runs a background thread that trims when the
+ * process's cgroup (found through /proc/self/cgroup) or the nearest
+ * ancestor with a limit is close to that limit (memory.current
+ * against memory.max, or the cgroup v1 equivalents) or when the
+ * kernel reports memory stalls (the "some avg10" figure of
+ * /proc/pressure/memory). releaseFreeMemory() (exported to C as
+ * hl_release_free_memory, and by malloc_trim, in wrapper.cpp) trims
+ * everything immediately.
+ *
+ * Trim functions are called with the registry locked: they must not
+ * register or unregister heaps.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "locks/spinlock.h"
+#include "utility/guard.h"
+
+namespace HL {
+
+  class HeapRegistry {
+  public:
+
+    typedef size_t (*TrimFunction) (void * heap, size_t bytes);
+
+    enum { MaxEntries = 256 };
+
+    /// Register a heap; returns a handle for remove(), or -1 if the registry is full.
+    static int add (TrimFunction trim, void * heap, int priority) {
+      State& s = state();
+      Guard<SpinLockType> l (s.lock);
+      int slot = -1;
+      for (int i = 0; i < MaxEntries; i++) {
+	if (s.entries[i].trim == NULL) {
+	  slot = i;
+	  break;
+	}
+      }
+      if (slot < 0) {
+	return -1;
+      }
+      s.entries[slot].trim = trim;
+      s.entries[slot].heap = heap;
+      s.entries[slot].priority = priority;
+      // Keep the trimming order sorted by priority (stable for equal ones).
+      int pos = s.numOrdered;
+      while ((pos > 0) && (s.entries[s.order[pos - 1]].priority > priority)) {
+	s.order[pos] = s.order[pos - 1];
+	pos--;
+      }
+      s.order[pos] = slot;
+      s.numOrdered++;
+      return slot;
+    }
+
+    static void remove (int handle) {
+      if ((handle < 0) || (handle >= MaxEntries)) {
+	return;
+      }
+      State& s = state();
+      Guard<SpinLockType> l (s.lock);
+      int j = 0;
+      for (int i = 0; i < s.numOrdered; i++) {
+	if (s.order[i] != handle) {
+	  s.order[j++] = s.order[i];
+	}
+      }
+      s.numOrdered = j;
+      s.entries[handle].trim = NULL;
+      s.entries[handle].heap = NULL;
+    }
+
+    /// Trim registered heaps in priority order; returns the bytes known to be released.
+    static size_t trim (size_t bytes) {
+      State& s = state();
+      Guard<SpinLockType> l (s.lock);
+      size_t released = 0;
+      for (int i = 0; (i < s.numOrdered) && (released < bytes); i++) {
+	Entry& e = s.entries[s.order[i]];
+	released += e.trim (e.heap, bytes - released);
+      }
+      s.trims++;
+      return released;
+    }
+
+    /// Trim every registered heap.
+    static size_t releaseFreeMemory() {
+      return trim ((size_t) -1);
+    }
+
+    /// The number of trims (forced or by the scavenger) so far.
+    static size_t getTrims() {
+      return state().trims;
+    }
+
+    /// The memory use and limit of the process's cgroup (or of its
+    /// nearest limited ancestor); false if unavailable or unlimited.
+    static bool readMemoryUsage (size_t& current, size_t& limit) {
+      char dir[PathLength];
+      if (cgroupDirectory (NULL, "/sys/fs/cgroup", dir)
+	  && readLimit (dir, sizeof("/sys/fs/cgroup") - 1,
+			"memory.current", "memory.max", current, limit)) {
+	return true;
+      }
+      if (cgroupDirectory ("memory", "/sys/fs/cgroup/memory", dir)
+	  && readLimit (dir, sizeof("/sys/fs/cgroup/memory") - 1,
+			"memory.usage_in_bytes", "memory.limit_in_bytes", current, limit)) {
+	return true;
+      }
+      return false;
+    }
+
+    /// The share of the last 10 seconds some task stalled on memory (percent), or -1.
+    static double readMemoryPressure() {
+      FILE * f = fopen ("/proc/pressure/memory", "r");
+      if (f == NULL) {
+	return -1.0;
+      }
+      double avg10 = -1.0;
+      char buf[256];
+      while (fgets (buf, sizeof(buf), f)) {
+	if (strncmp (buf, "some ", 5) == 0) {
+	  const char * p = strstr (buf, "avg10=");
+	  if (p != NULL) {
+	    avg10 = strtod (p + 6, NULL);
+	  }
+	  break;
+	}
+      }
+      fclose (f);
+      return avg10;
+    }
+
+#if !defined(_WIN32)
+
+    /**
+     * Start the scavenger thread, which every periodMs trims down to
+     * usageThreshold of the cgroup limit when above it, and trims
+     * everything when memory pressure exceeds pressureThreshold.
+     */
+    static bool startScavenger (unsigned long periodMs = 1000,
+				double usageThreshold = 0.9,
+				double pressureThreshold = 10.0) {
+      State& s = state();
+      Guard<SpinLockType> l (s.lock);
+      if (s.scavenging) {
+	return false;
+      }
+      s.periodMs = periodMs;
+      s.usageThreshold = usageThreshold;
+      s.pressureThreshold = pressureThreshold;
+      s.scavenging = true;
+      if (pthread_create (&s.scavenger, NULL, scavenge, NULL) != 0) {
+	s.scavenging = false;
+	return false;
+      }
+      return true;
+    }
+
+    static void stopScavenger() {
+      State& s = state();
+      {
+	Guard<SpinLockType> l (s.lock);
+	if (!s.scavenging) {
+	  return;
+	}
+	s.scavenging = false;
+      }
+      pthread_join (s.scavenger, NULL);
+    }
+
+#endif
+
+  private:
+
+    class Entry {
+    public:
+      TrimFunction trim;
+      void * heap;
+      int priority;
+    };
+
+    class State {
+    public:
+      State()
+	: numOrdered (0),
+	  trims (0),
+	  scavenging (false),
+	  periodMs (0),
+	  usageThreshold (0),
+	  pressureThreshold (0)
+      {
+	memset (entries, 0, sizeof(entries));
+      }
+      SpinLockType lock;
+      Entry entries[MaxEntries];
+      /// Slots in trimming order.
+      int order[MaxEntries];
+      int numOrdered;
+      size_t trims;
+      bool scavenging;
+      unsigned long periodMs;
+      double usageThreshold;
+      double pressureThreshold;
+#if !defined(_WIN32)
+      pthread_t scavenger;
+#endif
+    };
+
+    static State& state() {
+      // Never destroyed, so heaps may unregister at exit.
+      static char buf[sizeof(State)];
+      static State * s = new (buf) State;
+      return *s;
+    }
+
+    enum { PathLength = 512 };
+
+    /**
+     * Put the directory of the process's cgroup into dir, given the
+     * hierarchy's mount point: the unified (v2) hierarchy if
+     * controller is NULL, otherwise the v1 hierarchy that has it.
+     */
+    static bool cgroupDirectory (const char * controller, const char * mount, char * dir) {
+      FILE * f = fopen ("/proc/self/cgroup", "r");
+      if (f == NULL) {
+	return false;
+      }
+      bool found = false;
+      char line[PathLength];
+      // Each line reads hierarchy-id:controller,...:path.
+      while (!found && fgets (line, sizeof(line), f)) {
+	char * controllers = strchr (line, ':');
+	char * path = (controllers != NULL) ? strchr (controllers + 1, ':') : NULL;
+	if (path == NULL) {
+	  continue;
+	}
+	*controllers++ = '\0';
+	*path++ = '\0';
+	path[strcspn (path, "\n")] = '\0';
+	if (controller == NULL) {
+	  found = (strcmp (line, "0") == 0) && (*controllers == '\0');
+	} else {
+	  for (char * c = strtok (controllers, ","); (c != NULL) && !found; c = strtok (NULL, ",")) {
+	    found = (strcmp (c, controller) == 0);
+	  }
+	}
+	if (found) {
+	  // The root cgroup is "/"; drop it so paths don't double the slash.
+	  if (strcmp (path, "/") == 0) {
+	    path[0] = '\0';
+	  }
+	  found = (snprintf (dir, PathLength, "%s%s", mount, path) < PathLength);
+	}
+      }
+      fclose (f);
+      return found;
+    }
+
+    /**
+     * Read the usage and limit of the cgroup in dir or, if it has no
+     * limit, of its nearest ancestor (down to the first rootLength
+     * characters of dir, the mount point) that has one. cgroup v2
+     * reports "max" and v1 a huge number when there is no limit.
+     */
+    static bool readLimit (char * dir, size_t rootLength,
+			   const char * usageFile, const char * limitFile,
+			   size_t& current, size_t& limit) {
+      char fname[PathLength + 32];
+      while (true) {
+	snprintf (fname, sizeof(fname), "%s/%s", dir, limitFile);
+	if (readNumber (fname, limit) && (limit < ((size_t) 1 << 60))) {
+	  snprintf (fname, sizeof(fname), "%s/%s", dir, usageFile);
+	  return readNumber (fname, current);
+	}
+	char * slash = strrchr (dir, '/');
+	if ((slash == NULL) || ((size_t) (slash - dir) < rootLength)) {
+	  return false;
+	}
+	*slash = '\0';
+      }
+    }
+
+    static bool readNumber (const char * fname, size_t& value) {
+      FILE * f = fopen (fname, "r");
+      if (f == NULL) {
+	return false;
+      }
+      char buf[64];
+      bool ok = (fgets (buf, sizeof(buf), f) != NULL) && (buf[0] >= '0') && (buf[0] <= '9');
+      if (ok) {
+	value = strtoull (buf, NULL, 10);
+      }
+      fclose (f);
+      return ok;
+    }
+
+#if !defined(_WIN32)
+
+    static void * scavenge (void *) {
+      State& s = state();
+      while (true) {
+	struct timespec period;
+	period.tv_sec = s.periodMs / 1000;
+	period.tv_nsec = (s.periodMs % 1000) * 1000000;
+	nanosleep (&period, NULL);
+	{
+	  Guard<SpinLockType> l (s.lock);
+	  if (!s.scavenging) {
+	    return NULL;
+	  }
+	}
+	size_t current, limit;
+	if (readMemoryUsage (current, limit)) {
+	  const size_t target = (size_t) (s.usageThreshold * (double) limit);
+	  if (current > target) {
+	    trim (current - target);
+	    continue;
+	  }
+	}
+	if (readMemoryPressure() > s.pressureThreshold) {
+	  releaseFreeMemory();
+	}
+      }
+    }
+
+#endif
+
+  };
+
+}
+
+#endif
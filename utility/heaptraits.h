@@ -0,0 +1,237 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_HEAPTRAITS_H
+#define HL_HEAPTRAITS_H
+
+/**
+ * @class HeapTraits
+ * @brief Compile-time description of what a heap (a stack of layers) can do.
+ *
+ * Layers use these traits to pick the fastest path their superheap
+ * supports, with no cost at run time:
+ *
+ *   Alignment     Heap::Alignment (1 if undeclared).
+ *   HasGetSize    getSize (ptr) is callable.
+ *   HasSizedFree  free (ptr, sz) is callable.
+ *   HasMallocNear mallocNear (sz, hint) (see MallocNear).
+ *   HasFreeBatch  freeBatch (ptrs, n) (see FreeBatch).
+ *   HasTryResize  bool tryResize (ptr, sz): resize in place if possible.
+ *   HasContains   bool contains (const void * ptr): ptr came from this heap.
+ *   ZeroMemory    malloc returns zero-filled memory.
+ *   ThreadSafe    malloc and free may be called concurrently.
+ *
+ * getSize and sized free follow the ordinary rules of inheritance.
+ * The others are extensions that a layer inheriting them might
+ * bypass (adding headers, taking locks, recycling memory), so they
+ * count only if they belong to the same class as the heap's malloc
+ * (for freeBatch, its free).
+ * A class announces ZeroMemory or ThreadSafe by naming itself:
+ *
+ * @code
+ *  typedef PrivateMmapHeap ZeroMemory;
+ * @endcode
+ *
+ * which holds for a heap only while its malloc is that class's malloc.
+ */
+
+#include <cstddef>
+#include <type_traits>
+
+namespace HL {
+
+  namespace heaptraits {
+
+    // The class that declares a member function.
+    template <class C, class R, class... Args>
+    C * memberClass (R (C::*)(Args...));
+
+    template <class C, class R, class... Args>
+    C * memberClass (R (C::*)(Args...) const);
+
+    // Static member functions carry no class, so two of them
+    // always count as declared together.
+    template <class R, class... Args>
+    void * memberClass (R (*)(Args...));
+
+    // A heap's malloc (size_t) and free (void *), picked out of any
+    // overloads (such as malloc (sz, site) or free (ptr, sz)) without
+    // losing the class that declares them.
+    template <class C>
+    constexpr auto mallocFunction (void * (C::*f)(size_t)) -> decltype(f) { return f; }
+
+    template <class C>
+    constexpr auto mallocFunction (void * (C::*f)(size_t) const) -> decltype(f) { return f; }
+
+    constexpr auto mallocFunction (void * (*f)(size_t)) -> decltype(f) { return f; }
+
+    template <class C>
+    constexpr auto freeFunction (void (C::*f)(void *)) -> decltype(f) { return f; }
+
+    template <class C>
+    constexpr auto freeFunction (void (C::*f)(void *) const) -> decltype(f) { return f; }
+
+    constexpr auto freeFunction (void (*f)(void *)) -> decltype(f) { return f; }
+
+#define HL_HEAPTRAITS_DETECT(Name, Expression)				\
+    template <class Heap>						\
+    static auto Name (int) -> decltype (Expression, std::true_type()); \
+    template <class Heap>						\
+    static std::false_type Name (long);
+
+    // Is the member declared by the same class as Base (malloc or free)?
+#define HL_HEAPTRAITS_SAME_CLASS(Name, Member, Base)			\
+    template <class Heap>						\
+    static auto Name (int)						\
+      -> typename std::is_same<decltype(memberClass (Base##Function (&Heap::Base))), \
+			       decltype(memberClass (&Heap::Member))>::type; \
+    template <class Heap>						\
+    static std::false_type Name (long);
+
+    class Detect {
+    public:
+      HL_HEAPTRAITS_DETECT(alignment, (int) Heap::Alignment)
+      HL_HEAPTRAITS_DETECT(getSize, std::declval<Heap&>().getSize ((void *) 0))
+      HL_HEAPTRAITS_DETECT(sizedFree, std::declval<Heap&>().free ((void *) 0, (size_t) 0))
+      HL_HEAPTRAITS_SAME_CLASS(mallocNear, mallocNear, malloc)
+      HL_HEAPTRAITS_SAME_CLASS(freeBatch, freeBatch, free)
+      HL_HEAPTRAITS_SAME_CLASS(tryResize, tryResize, malloc)
+      HL_HEAPTRAITS_SAME_CLASS(contains, contains, malloc)
+      HL_HEAPTRAITS_DETECT(zeroMemory, (typename Heap::ZeroMemory *) 0)
+      HL_HEAPTRAITS_DETECT(threadSafe, (typename Heap::ThreadSafe *) 0)
+
+      // Do both Heap and Tag have a malloc (size_t)?
+      template <class Heap, class Tag>
+      static auto mallocs (int)
+	-> decltype (mallocFunction (&Heap::malloc), mallocFunction (&Tag::malloc), std::true_type());
+      template <class Heap, class Tag>
+      static std::false_type mallocs (long);
+    };
+
+#undef HL_HEAPTRAITS_DETECT
+#undef HL_HEAPTRAITS_SAME_CLASS
+
+    template <class Heap, bool Declared = decltype(Detect::alignment<Heap> (0))::value>
+    class AlignmentOf {
+    public:
+      enum { value = Heap::Alignment };
+    };
+
+    template <class Heap>
+    class AlignmentOf<Heap, false> {
+    public:
+      enum { value = 1 };
+    };
+
+    template <class A, class B>
+    constexpr bool sameFunction (A a, B b, typename std::enable_if<std::is_same<A, B>::value>::type * = 0) {
+      return a == b;
+    }
+
+    template <class A, class B>
+    constexpr bool sameFunction (A, B, typename std::enable_if<!std::is_same<A, B>::value>::type * = 0) {
+      return false;
+    }
+
+    /// Is Heap's malloc the malloc of the class named by Tag?
+    template <class Heap, class Tag,
+	      bool Declared = decltype(Detect::mallocs<Heap, Tag> (0))::value>
+    class MallocOf {
+    public:
+      enum { value = sameFunction (mallocFunction (&Heap::malloc), mallocFunction (&Tag::malloc)) };
+    };
+
+    template <class Heap, class Tag>
+    class MallocOf<Heap, Tag, false> {
+    public:
+      enum { value = false };
+    };
+
+    template <class Heap, bool Declared = decltype(Detect::zeroMemory<Heap> (0))::value>
+    class ZeroMemoryOf {
+    public:
+      enum { value = MallocOf<Heap, typename Heap::ZeroMemory>::value };
+    };
+
+    template <class Heap>
+    class ZeroMemoryOf<Heap, false> {
+    public:
+      enum { value = false };
+    };
+
+    template <class Heap, bool Declared = decltype(Detect::threadSafe<Heap> (0))::value>
+    class ThreadSafeOf {
+    public:
+      enum { value = MallocOf<Heap, typename Heap::ThreadSafe>::value };
+    };
+
+    template <class Heap>
+    class ThreadSafeOf<Heap, false> {
+    public:
+      enum { value = false };
+    };
+
+  }
+
+  template <class Heap>
+  class HeapTraits {
+  private:
+    typedef heaptraits::Detect D;
+  public:
+    enum { Alignment = heaptraits::AlignmentOf<Heap>::value };
+    enum { HasGetSize = decltype(D::getSize<Heap> (0))::value };
+    enum { HasSizedFree = decltype(D::sizedFree<Heap> (0))::value };
+    enum { HasMallocNear = decltype(D::mallocNear<Heap> (0))::value };
+    enum { HasFreeBatch = decltype(D::freeBatch<Heap> (0))::value };
+    enum { HasTryResize = decltype(D::tryResize<Heap> (0))::value };
+    enum { HasContains = decltype(D::contains<Heap> (0))::value };
+    enum { ZeroMemory = heaptraits::ZeroMemoryOf<Heap>::value };
+    enum { ThreadSafe = heaptraits::ThreadSafeOf<Heap>::value };
+  };
+
+#if defined(__cpp_concepts)
+
+  /// The minimal heap interface.
+  template <class H>
+  concept Heap = requires (H h, size_t sz, void * ptr) {
+    h.free (ptr);
+    requires std::is_convertible<decltype(h.malloc (sz)), void *>::value;
+  };
+
+  template <class H>
+  concept SizedHeap = Heap<H> && HeapTraits<H>::HasGetSize;
+
+  template <class H>
+  concept ZeroMemoryHeap = Heap<H> && HeapTraits<H>::ZeroMemory;
+
+  template <class H>
+  concept ThreadSafeHeap = Heap<H> && HeapTraits<H>::ThreadSafe;
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_MALLOCNEAR_H
+#define HL_MALLOCNEAR_H
+
+/**
+ * @class MallocNear
+ * @brief Placement hints: allocate an object near another one.
+ *
+ * A heap that can honor hints provides
+ *
+ * @code
+ *  void * mallocNear (size_t sz, const void * hint);
+ * @endcode
+ *
+ * which returns memory on the same page as hint if it can, and any
+ * memory otherwise. Layers reach their superheap's mallocNear through
+ * MallocNear::allocate, which falls back to malloc when the heap has
+ * none.
+ *
+ * Because layers inherit from one another, a mallocNear inherited
+ * from below may skip the work that a layer's own malloc does (adding
+ * a header, taking a lock). It is therefore only used if it is
+ * declared by the same class as the heap's malloc.
+ */
+
+#include <cstddef>
+#include <type_traits>
+
+#include "utility/heaptraits.h"
+
+namespace HL {
+
+  class MallocNear {
+  public:
+
+    /// Objects in the same NearBytes-aligned block count as near.
+    enum { NearBytes = 4096 };
+
+    /// The number of free-list entries to examine for a near one.
+    enum { MaxScan = 16 };
+
+    static inline bool isNear (const void * ptr, const void * hint) {
+      return (((size_t) ptr ^ (size_t) hint) < (size_t) NearBytes);
+    }
+
+    /// Allocate sz bytes from heap h, near hint if h supports it.
+    template <class Heap>
+    static inline void * allocate (Heap& h, size_t sz, const void * hint) {
+      return dispatch (h, sz, hint, std::integral_constant<bool, HeapTraits<Heap>::HasMallocNear>());
+    }
+
+  private:
+
+    template <class Heap>
+    static inline void * dispatch (Heap& h, size_t sz, const void * hint, std::true_type) {
+      return h.mallocNear (sz, hint);
+    }
+
+    template <class Heap>
+    static inline void * dispatch (Heap& h, size_t sz, const void *, std::false_type) {
+      return h.malloc (sz);
+    }
+
+  };
+
+}
+
+#endif
@@ -28,13 +28,77 @@
 */
 
 
+/**
+ * @class MyHashMap
+ * @brief A resizable open-addressing hash map (Swiss-table style), for allocator metadata.
+ *
+ * Entries live in one flat table, with a parallel array of one-byte
+ * control words: empty, deleted, or seven bits of the entry's hash.
+ * A lookup hashes the key once, then scans the control bytes of a
+ * group of 16 slots at a time (with one SSE2 comparison where
+ * available), comparing keys only on a seven-bit match; probing
+ * moves between groups quadratically and stops at the first group
+ * with an empty slot.
+ *
+ * The table doubles when it is 7/8 full (counting deleted slots).
+ * Growth is incremental: the new table takes all insertions, the old
+ * one is still searched, and every update moves a few old entries
+ * across, so no single operation rehashes the whole map.
+ *
+ * Key and Value must be trivially copyable, and get returns Value(0)
+ * for missing keys. Tables are allocated from Allocator, which must
+ * handle objects of any size (the table is reallocated as it grows):
+ * HashTableHeap maps them directly. Not thread-safe; see
+ * ShardedHashMap for concurrent use.
+ */
+
 #include <assert.h>
-#include <new>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "hash.h"
+#include "locks/spinlock.h"
+#include "utility/guard.h"
+#include "wrappers/mmapwrapper.h"
 
 namespace HL {
 
+  /**
+   * @class HashTableHeap
+   * @brief A self-contained source of hash tables, mapped directly from the OS.
+   *
+   * Usable by MmapHeap and other sources that cannot depend on a heap.
+   */
+
+  class HashTableHeap {
+  public:
+
+    enum { Alignment = 16 };
+
+    inline void * malloc (size_t sz) {
+      const size_t total = sz + Header;
+      char * ptr = (char *) MmapWrapper::map (total);
+      if (ptr == NULL) {
+	return NULL;
+      }
+      *((size_t *) ptr) = total;
+      return ptr + Header;
+    }
+
+    inline void free (void * ptr) {
+      char * base = (char *) ptr - Header;
+      MmapWrapper::unmap (base, *((size_t *) base));
+    }
+
+  private:
+    enum { Header = 16 };
+  };
+
+
   template <typename Key,
 	    typename Value,
 	    class Allocator>
@@ -43,98 +107,337 @@ namespace HL {
   public:
 
     MyHashMap (unsigned int size = INITIAL_NUM_BINS)
-      : _numBins (size)
+      : _migrated (0)
     {
-      assert (_numBins > 0);
-      void * buf = _allocator.malloc (sizeof(ListNodePtr) * _numBins); 
-      _bins = new (buf) ListNodePtr[_numBins];
-      for (unsigned int i = 0 ; i < _numBins; i++) {
-	_bins[i] = NULL;
+      size_t capacity = GroupSize;
+      while (capacity * 7 / 8 < size) {
+	capacity *= 2;
       }
+      allocate (_table, capacity);
+      _old.ctrl = NULL;
+      _old.slots = NULL;
+      _old.capacity = 0;
+      _old.size = 0;
+      _old.deleted = 0;
+    }
+
+    ~MyHashMap() {
+      release (_table);
+      release (_old);
     }
 
     void set (Key k, Value v) {
-      unsigned int binIndex = (unsigned int) (Hash<Key>::hash(k) % _numBins);
-      ListNode * l = _bins[binIndex];
-      while (l != NULL) {
-	if (l->key == k) {
-	  l->value = v;
+      const size_t h = Hash<Key>::hash (k);
+      Slot * s = find (_table, k, h);
+      if (s != NULL) {
+	s->value = v;
+	return;
+      }
+      if (migrating()) {
+	erase (_old, k, h);
+	migrate (MigrateSlots);
+      }
+      if (_table.size + _table.deleted + 1 > _table.capacity * 7 / 8) {
+	grow();
+	if (_table.size + _table.deleted >= _table.capacity) {
+	  // Out of memory and out of room.
 	  return;
 	}
-	l = l->next;
       }
-      // Didn't find it.
-      insert (k, v);
+      insert (_table, k, v, h);
     }
 
     Value get (Key k) {
-      unsigned int binIndex = (unsigned int) (Hash<Key>::hash(k) % _numBins);
-      ListNode * l = _bins[binIndex];
-      while (l != NULL) {
-	if (l->key == k) {
-	  return l->value;
-	}
-	l = l->next;
+      const size_t h = Hash<Key>::hash (k);
+      Slot * s = find (_table, k, h);
+      if ((s == NULL) && migrating()) {
+	s = find (_old, k, h);
       }
-      // Didn't find it.
-      return 0;
+      if (s == NULL) {
+	// Didn't find it.
+	return 0;
+      }
+      return s->value;
     }
 
     void erase (Key k) {
-      unsigned int binIndex = (unsigned int) (Hash<Key>::hash(k) % _numBins);
-      ListNode * curr = _bins[binIndex];
-      ListNode * prev = NULL;
-      while (curr != NULL) {
-	if (curr->key == k) {
-	  // Found it.
-	  if (curr != _bins[binIndex]) {
-	    assert (prev->next == curr);
-	    prev->next = prev->next->next;
-	    _allocator.free (curr);
-	  } else {
-	    ListNode * n = _bins[binIndex]->next;
-	    _allocator.free (_bins[binIndex]);
-	    _bins[binIndex] = n;
+      const size_t h = Hash<Key>::hash (k);
+      erase (_table, k, h);
+      if (migrating()) {
+	erase (_old, k, h);
+	migrate (MigrateSlots);
+      }
+    }
+
+    /// The number of entries.
+    size_t size() const {
+      return _table.size + _old.size;
+    }
+
+  private:
+
+    enum { INITIAL_NUM_BINS = 511 };
+
+    enum { GroupSize = 16 };
+
+    /// Old slots moved to the new table per update while growing.
+    enum { MigrateSlots = 32 };
+
+    enum { Empty = -128, Deleted = -2 };
+
+    class Slot {
+    public:
+      Key key;
+      Value value;
+    };
+
+    class Table {
+    public:
+      /// One control byte per slot: Empty, Deleted, or 7 hash bits.
+      int8_t * ctrl;
+      Slot * slots;
+      size_t capacity;
+      size_t size;
+      size_t deleted;
+    };
+
+    /// The low seven bits pick candidates within a group.
+    static inline int8_t h2 (size_t h) {
+      return (int8_t) (h & 0x7f);
+    }
+
+    /// The remaining bits pick the first group to probe.
+    static inline size_t h1 (size_t h) {
+      return h >> 7;
+    }
+
+    /// Bit i is set if control byte i of the group equals c.
+    static inline unsigned int match (const int8_t * group, int8_t c) {
+#if defined(__SSE2__)
+      const __m128i g = _mm_loadu_si128 ((const __m128i *) group);
+      return (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (g, _mm_set1_epi8 (c)));
+#else
+      unsigned int bits = 0;
+      for (int i = 0; i < GroupSize; i++) {
+	bits |= (unsigned int) (group[i] == c) << i;
+      }
+      return bits;
+#endif
+    }
+
+    /// Bit i is set if slot i of the group is empty or deleted.
+    static inline unsigned int matchFree (const int8_t * group) {
+#if defined(__SSE2__)
+      // Only Empty and Deleted have the sign bit set.
+      const __m128i g = _mm_loadu_si128 ((const __m128i *) group);
+      return (unsigned int) _mm_movemask_epi8 (g);
+#else
+      unsigned int bits = 0;
+      for (int i = 0; i < GroupSize; i++) {
+	bits |= (unsigned int) (group[i] < 0) << i;
+      }
+      return bits;
+#endif
+    }
+
+    static inline int lowestBit (unsigned int bits) {
+      return __builtin_ctz (bits);
+    }
+
+    bool migrating() const {
+      return _old.capacity != 0;
+    }
+
+    void allocate (Table& t, size_t capacity) {
+      // Control bytes, then the (aligned) slots.
+      const size_t ctrlBytes = (capacity + 15) & ~(size_t) 15;
+      char * buf = (char *) _allocator.malloc (ctrlBytes + capacity * sizeof(Slot));
+      t.ctrl = (int8_t *) buf;
+      t.slots = (Slot *) (buf + ctrlBytes);
+      t.capacity = (buf != NULL) ? capacity : 0;
+      t.size = 0;
+      t.deleted = 0;
+      if (buf != NULL) {
+	memset (t.ctrl, Empty, capacity);
+      }
+    }
+
+    void release (Table& t) {
+      if (t.capacity != 0) {
+	_allocator.free (t.ctrl);
+	t.capacity = 0;
+	t.size = 0;
+	t.deleted = 0;
+      }
+    }
+
+    Slot * find (Table& t, Key k, size_t h) {
+      if (t.capacity == 0) {
+	return NULL;
+      }
+      const size_t mask = t.capacity / GroupSize - 1;
+      size_t g = h1 (h) & mask;
+      for (size_t step = 1; step <= mask + 1; step++) {
+	const int8_t * group = t.ctrl + g * GroupSize;
+	unsigned int bits = match (group, h2 (h));
+	while (bits) {
+	  const size_t i = g * GroupSize + lowestBit (bits);
+	  if (t.slots[i].key == k) {
+	    return &t.slots[i];
 	  }
+	  bits &= bits - 1;
+	}
+	if (match (group, Empty)) {
+	  return NULL;
+	}
+	// Triangular steps visit every group of a power-of-two table.
+	g = (g + step) & mask;
+      }
+      return NULL;
+    }
+
+    /// Insert a key known to be absent.
+    void insert (Table& t, Key k, Value v, size_t h) {
+      const size_t mask = t.capacity / GroupSize - 1;
+      size_t g = h1 (h) & mask;
+      for (size_t step = 1; ; step++) {
+	const unsigned int bits = matchFree (t.ctrl + g * GroupSize);
+	if (bits) {
+	  const size_t i = g * GroupSize + lowestBit (bits);
+	  if (t.ctrl[i] == Deleted) {
+	    t.deleted--;
+	  }
+	  t.ctrl[i] = h2 (h);
+	  t.slots[i].key = k;
+	  t.slots[i].value = v;
+	  t.size++;
 	  return;
 	}
-	prev = curr;
-	curr = curr->next;
+	g = (g + step) & mask;
       }
     }
 
+    void erase (Table& t, Key k, size_t h) {
+      Slot * s = find (t, k, h);
+      if (s == NULL) {
+	return;
+      }
+      const size_t i = s - t.slots;
+      // A group with an empty slot ends every probe that reaches it,
+      // so the slot can become empty rather than a tombstone.
+      if (match (t.ctrl + (i & ~(size_t) (GroupSize - 1)), Empty)) {
+	t.ctrl[i] = Empty;
+      } else {
+	t.ctrl[i] = Deleted;
+	t.deleted++;
+      }
+      t.size--;
+    }
 
-  private:
+    /// Start moving to a larger table (or a clean one, if mostly tombstones).
+    void grow() {
+      if (migrating()) {
+	migrate (_old.capacity);
+      }
+      size_t capacity = _table.capacity;
+      if (_table.size + 1 > capacity * 7 / 16) {
+	capacity *= 2;
+      }
+      Table fresh;
+      allocate (fresh, capacity);
+      if (fresh.capacity == 0) {
+	return;
+      }
+      _old = _table;
+      _table = fresh;
+      _migrated = 0;
+      migrate (MigrateSlots);
+    }
 
-    void insert (Key k, Value v) {
-      unsigned int binIndex = (unsigned int) (Hash<Key>::hash(k) % _numBins);
-      void * ptr = _allocator.malloc (sizeof(ListNode));
-      if (ptr) {
-	ListNode * l = new (ptr) ListNode;
-	l->key = k;
-	l->value = v;
-	l->next = _bins[binIndex];
-	_bins[binIndex] = l;
+    /// Move up to n slots' worth of old entries into the new table.
+    void migrate (size_t n) {
+      while ((n-- > 0) && (_migrated < _old.capacity)) {
+	const size_t i = _migrated++;
+	if (_old.ctrl[i] >= 0) {
+	  const Slot& s = _old.slots[i];
+	  insert (_table, s.key, s.value, Hash<Key>::hash (s.key));
+	  _old.ctrl[i] = Deleted;
+	  _old.size--;
+	}
+      }
+      if (_migrated == _old.capacity) {
+	release (_old);
       }
     }
 
-    enum { INITIAL_NUM_BINS = 511 };
+    Table _table;
+    /// The table being drained while growing (capacity 0 otherwise).
+    Table _old;
+    size_t _migrated;
+    Allocator _allocator;
+  };
+
+
+  /**
+   * @class ShardedHashMap
+   * @brief A MyHashMap split into independently locked shards, for concurrent use.
+   */
+
+  template <typename Key,
+	    typename Value,
+	    class Allocator,
+	    int Shards = 16,
+	    class LockType = SpinLockType>
+  class ShardedHashMap {
+  public:
+
+    void set (Key k, Value v) {
+      Shard& s = shard (k);
+      Guard<LockType> l (s.lock);
+      s.map.set (k, v);
+    }
+
+    Value get (Key k) {
+      Shard& s = shard (k);
+      Guard<LockType> l (s.lock);
+      return s.map.get (k);
+    }
 
-    class ListNode {
+    void erase (Key k) {
+      Shard& s = shard (k);
+      Guard<LockType> l (s.lock);
+      s.map.erase (k);
+    }
+
+    size_t size() {
+      size_t n = 0;
+      for (int i = 0; i < Shards; i++) {
+	Guard<LockType> l (_shards[i].lock);
+	n += _shards[i].map.size();
+      }
+      return n;
+    }
+
+  private:
+
+    class Shard {
     public:
-      ListNode (void)
-	: next (NULL)
+      Shard()
+	: map (64)
       {}
-      Key key;
-      Value value;
-      ListNode * next;
+      LockType lock;
+      MyHashMap<Key, Value, Allocator> map;
+      // Keep shards on separate cache lines.
+      char pad[64];
     };
 
-    unsigned long 	_numBins;
+    inline Shard& shard (Key k) {
+      // The top bits, which MyHashMap's probing barely uses.
+      const size_t h = Hash<Key>::hash (k);
+      return _shards[(h >> (sizeof(size_t) * 8 - 8)) % Shards];
+    }
 
-    typedef ListNode * 	ListNodePtr;
-    ListNodePtr * 	_bins;
-    Allocator 		_allocator;
+    Shard _shards[Shards];
   };
 
 }
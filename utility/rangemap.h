@@ -0,0 +1,465 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_RANGEMAP_H
+#define HL_RANGEMAP_H
+
+/**
+ * @class RangeMap
+ * @brief Maps page-granular address ranges to values, with lock-free lookups.
+ *
+ * Answers "which region contains this address" for layers that carve
+ * up the address space (arena ownership, mapping sizes, and so on).
+ * Ranges are whole pages (2^PageShift bytes) and may not overlap.
+ *
+ * Ranges of up to MaxRadixPages pages are recorded in a three-level
+ * radix tree over page numbers (12 bits per level, covering a 48-bit
+ * address space), one slot per page, so a lookup is three dependent
+ * loads. Larger ranges, and ranges beyond 48 bits, go to a sorted
+ * array searched by bisection; it is replaced (copy-on-write) by
+ * every insertion or removal, which suits its intended occupants:
+ * few, huge and long-lived.
+ *
+ * Lookups take no locks: radix nodes are never freed while the map
+ * lives, and removed range records and replaced arrays are recycled
+ * only once no reader can still see them (two alternating reader
+ * counts, as in a minimal RCU, in shards handed out to threads round
+ * robin so that readers on different threads do not contend). Updates
+ * are serialized by a lock, and a removal waits for the lookups in
+ * flight. A lookup that races with the removal of the range it finds
+ * may return either answer.
+ *
+ * @param Value A trivially copyable value; lookups of unmapped addresses return Value(0).
+ * @param Allocator A heap for objects of any size (nodes, records and arrays).
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "heaps/buildingblock/freelistheap.h"
+#include "heaps/special/bumpalloc.h"
+#include "locks/spinlock.h"
+#include "utility/guard.h"
+#include "utility/myhashmap.h"
+
+namespace HL {
+
+  template <class Value,
+	    class Allocator = HashTableHeap,
+	    int PageShift = 12,
+	    size_t MaxRadixPages = 4096>
+  class RangeMap {
+  public:
+
+    enum { PageSize = 1 << PageShift };
+
+    RangeMap()
+      : _size (0),
+	_epoch (0)
+    {
+      _root = (std::atomic<Node *> *) allocateZeroed (NodeEntries * sizeof(std::atomic<Node *>));
+      _huge.store (NULL);
+      for (int i = 0; i < ReaderShards; i++) {
+	_readers[i].count[0].store (0);
+	_readers[i].count[1].store (0);
+      }
+    }
+
+    ~RangeMap() {
+      for (size_t i = 0; i < NodeEntries; i++) {
+	Node * mid = _root[i].load();
+	if (mid == NULL) {
+	  continue;
+	}
+	for (size_t j = 0; j < NodeEntries; j++) {
+	  Node * leaf = mid->child[j].load();
+	  if (leaf != NULL) {
+	    _allocator.free (leaf);
+	  }
+	}
+	_allocator.free (mid);
+      }
+      _allocator.free (_root);
+      HugeArray * h = _huge.load();
+      if (h != NULL) {
+	_allocator.free (h);
+      }
+    }
+
+    /// Map [start, start + length) to v; false if it overlaps an existing range.
+    bool insert (void * start, size_t length, Value v) {
+      const uintptr_t first = pageOf (start);
+      const uintptr_t pages = (length + PageSize - 1) >> PageShift;
+      if (pages == 0) {
+	return false;
+      }
+      Guard<SpinLockType> l (_lock);
+      if (overlaps (first, pages)) {
+	return false;
+      }
+      if ((pages > MaxRadixPages) || ((first + pages) > MaxRadixPage)) {
+	if (!insertHuge (first, pages, v)) {
+	  return false;
+	}
+      } else {
+	Range * r = (Range *) _records.malloc (sizeof(Range));
+	if (r == NULL) {
+	  return false;
+	}
+	r->first = first;
+	r->pages = pages;
+	r->value = v;
+	for (uintptr_t p = first; p < first + pages; p++) {
+	  std::atomic<Range *> * slot = leafSlot (p, true);
+	  if (slot == NULL) {
+	    // Out of memory: undo.
+	    clearSlots (first, p - first);
+	    _records.free (r);
+	    return false;
+	  }
+	  slot->store (r, std::memory_order_release);
+	}
+      }
+      _size++;
+      return true;
+    }
+
+    /// Remove the range that starts at start; false if there is none.
+    bool erase (void * start) {
+      const uintptr_t first = pageOf (start);
+      Guard<SpinLockType> l (_lock);
+      std::atomic<Range *> * slot = leafSlot (first, false);
+      Range * r = (slot != NULL) ? slot->load() : NULL;
+      if ((r != NULL) && (r->first == first)) {
+	clearSlots (r->first, r->pages);
+	// Readers may still hold r; recycle it once they are done.
+	synchronize();
+	_records.free (r);
+	_size--;
+	return true;
+      }
+      if (eraseHuge (first)) {
+	_size--;
+	return true;
+      }
+      return false;
+    }
+
+    /// Find the range containing addr; returns false if there is none.
+    bool find (const void * addr, Value& v, void ** start = NULL, size_t * length = NULL) {
+      const uintptr_t page = pageOf (addr);
+      ReaderCount& readers = _readers[readerShard()];
+      const size_t e = enter (readers);
+      bool result = false;
+      std::atomic<Range *> * slot = leafSlot (page, false);
+      Range * r = (slot != NULL) ? slot->load (std::memory_order_acquire) : NULL;
+      if (r != NULL) {
+	result = found (r->first, r->pages, r->value, v, start, length);
+      } else if (_huge.load (std::memory_order_relaxed) != NULL) {
+	result = findHuge (page, v, start, length);
+      }
+      readers.count[e & 1].fetch_sub (1);
+      return result;
+    }
+
+    /// The value of the range containing addr, or Value(0).
+    Value get (const void * addr) {
+      Value v = 0;
+      find (addr, v);
+      return v;
+    }
+
+    /// The number of ranges.
+    size_t size() const { return _size; }
+
+  private:
+
+    enum { LevelBits = 12 };
+    enum { ReaderShards = 64 };
+    enum { NodeEntries = 1 << LevelBits };
+
+    /// Page numbers below this use the radix tree.
+    static const uintptr_t MaxRadixPage = (uintptr_t) 1 << (3 * LevelBits);
+
+    class Range {
+    public:
+      uintptr_t first;
+      uintptr_t pages;
+      Value value;
+    };
+
+    /// An interior node points to nodes; a leaf's children are range records.
+    class Node {
+    public:
+      std::atomic<Node *> child[NodeEntries];
+    };
+
+    /// Reader counts for even and odd epochs, one cache line per shard.
+    class ReaderCount {
+    public:
+      std::atomic<size_t> count[2];
+      char pad[64 - 2 * sizeof(std::atomic<size_t>)];
+    };
+
+    class HugeRange {
+    public:
+      uintptr_t first;
+      uintptr_t pages;
+      Value value;
+    };
+
+    /// An immutable, sorted array of huge ranges.
+    class HugeArray {
+    public:
+      size_t count;
+      HugeRange entries[1];
+    };
+
+    static inline uintptr_t pageOf (const void * addr) {
+      return (uintptr_t) addr >> PageShift;
+    }
+
+    static bool found (uintptr_t first, uintptr_t pages, Value value,
+		       Value& v, void ** start, size_t * length) {
+      v = value;
+      if (start != NULL) {
+	*start = (void *) (first << PageShift);
+      }
+      if (length != NULL) {
+	*length = pages << PageShift;
+      }
+      return true;
+    }
+
+    void * allocateZeroed (size_t sz) {
+      void * ptr = _allocator.malloc (sz);
+      if (ptr != NULL) {
+	memset (ptr, 0, sz);
+      }
+      return ptr;
+    }
+
+    /// The leaf slot for a page (creating the path if asked), or NULL.
+    std::atomic<Range *> * leafSlot (uintptr_t page, bool create) {
+      if (page >= MaxRadixPage) {
+	return NULL;
+      }
+      std::atomic<Node *>& top = _root[page >> (2 * LevelBits)];
+      Node * mid = top.load (std::memory_order_acquire);
+      if (mid == NULL) {
+	if (!create || ((mid = (Node *) allocateZeroed (sizeof(Node))) == NULL)) {
+	  return NULL;
+	}
+	top.store (mid, std::memory_order_release);
+      }
+      std::atomic<Node *>& midSlot = mid->child[(page >> LevelBits) & (NodeEntries - 1)];
+      Node * leaf = midSlot.load (std::memory_order_acquire);
+      if (leaf == NULL) {
+	if (!create || ((leaf = (Node *) allocateZeroed (sizeof(Node))) == NULL)) {
+	  return NULL;
+	}
+	midSlot.store (leaf, std::memory_order_release);
+      }
+      // Leaves hold range records in the same (pointer-sized) slots.
+      return (std::atomic<Range *> *) &leaf->child[page & (NodeEntries - 1)];
+    }
+
+    void clearSlots (uintptr_t first, uintptr_t pages) {
+      for (uintptr_t p = first; p < first + pages; p++) {
+	leafSlot (p, false)->store (NULL, std::memory_order_release);
+      }
+    }
+
+    bool overlaps (uintptr_t first, uintptr_t pages) {
+      for (uintptr_t p = first; (p < first + pages) && (p < MaxRadixPage); p++) {
+	std::atomic<Range *> * slot = leafSlot (p, false);
+	if ((slot != NULL) && (slot->load() != NULL)) {
+	  return true;
+	}
+	if (slot == NULL) {
+	  // Skip to the next leaf.
+	  p |= NodeEntries - 1;
+	}
+      }
+      HugeArray * h = _huge.load();
+      if (h != NULL) {
+	for (size_t i = 0; i < h->count; i++) {
+	  if ((h->entries[i].first < first + pages) && (first < h->entries[i].first + h->entries[i].pages)) {
+	    return true;
+	  }
+	}
+      }
+      return false;
+    }
+
+    /// This thread's reader shard, handed out round robin.
+    static int readerShard() {
+      static std::atomic<unsigned int> nextShard (0);
+      static thread_local int shard = (int) (nextShard.fetch_add (1) % ReaderShards);
+      return shard;
+    }
+
+    /// Count this reader in the current epoch, which it returns.
+    size_t enter (ReaderCount& readers) {
+      while (true) {
+	const size_t e = _epoch.load();
+	readers.count[e & 1].fetch_add (1);
+	if (_epoch.load() == e) {
+	  return e;
+	}
+	readers.count[e & 1].fetch_sub (1);
+      }
+    }
+
+    /// Wait until no reader can still see anything unpublished before the call.
+    void synchronize() {
+      const size_t e = _epoch.fetch_add (1);
+      for (int i = 0; i < ReaderShards; i++) {
+	while (_readers[i].count[e & 1].load() != 0) {
+	  // Wait for readers that started in the previous epoch.
+	}
+      }
+    }
+
+    /// Bisect for the huge range containing page (readers already counted).
+    bool findHuge (uintptr_t page, Value& v, void ** start, size_t * length) {
+      bool result = false;
+      HugeArray * h = _huge.load (std::memory_order_acquire);
+      if (h != NULL) {
+	size_t lo = 0;
+	size_t hi = h->count;
+	while (lo < hi) {
+	  const size_t mid = (lo + hi) / 2;
+	  if (h->entries[mid].first + h->entries[mid].pages <= page) {
+	    lo = mid + 1;
+	  } else {
+	    hi = mid;
+	  }
+	}
+	if ((lo < h->count) && (h->entries[lo].first <= page)) {
+	  const HugeRange& r = h->entries[lo];
+	  result = found (r.first, r.pages, r.value, v, start, length);
+	}
+      }
+      return result;
+    }
+
+    /// Publish a new huge array, then free the old one once unobserved.
+    void replaceHuge (HugeArray * fresh) {
+      HugeArray * old = _huge.exchange (fresh, std::memory_order_acq_rel);
+      synchronize();
+      if (old != NULL) {
+	_allocator.free (old);
+      }
+    }
+
+    HugeArray * allocateHuge (size_t count) {
+      if (count == 0) {
+	return NULL;
+      }
+      HugeArray * h = (HugeArray *) _allocator.malloc (sizeof(HugeArray) + (count - 1) * sizeof(HugeRange));
+      if (h != NULL) {
+	h->count = count;
+      }
+      return h;
+    }
+
+    bool insertHuge (uintptr_t first, uintptr_t pages, Value v) {
+      HugeArray * old = _huge.load();
+      const size_t n = (old != NULL) ? old->count : 0;
+      HugeArray * fresh = allocateHuge (n + 1);
+      if (fresh == NULL) {
+	return false;
+      }
+      size_t j = 0;
+      bool placed = false;
+      for (size_t i = 0; i < n; i++) {
+	if (!placed && (first < old->entries[i].first)) {
+	  fresh->entries[j].first = first;
+	  fresh->entries[j].pages = pages;
+	  fresh->entries[j].value = v;
+	  j++;
+	  placed = true;
+	}
+	fresh->entries[j++] = old->entries[i];
+      }
+      if (!placed) {
+	fresh->entries[j].first = first;
+	fresh->entries[j].pages = pages;
+	fresh->entries[j].value = v;
+      }
+      replaceHuge (fresh);
+      return true;
+    }
+
+    bool eraseHuge (uintptr_t first) {
+      HugeArray * old = _huge.load();
+      if (old == NULL) {
+	return false;
+      }
+      size_t k = 0;
+      while ((k < old->count) && (old->entries[k].first != first)) {
+	k++;
+      }
+      if (k == old->count) {
+	return false;
+      }
+      HugeArray * fresh = NULL;
+      if (old->count > 1) {
+	fresh = allocateHuge (old->count - 1);
+	if (fresh == NULL) {
+	  return false;
+	}
+	size_t j = 0;
+	for (size_t i = 0; i < old->count; i++) {
+	  if (i != k) {
+	    fresh->entries[j++] = old->entries[i];
+	  }
+	}
+      }
+      replaceHuge (fresh);
+      return true;
+    }
+
+    class RecordHeap : public FreelistHeap<BumpAlloc<65536, Allocator> > {};
+
+    Allocator _allocator;
+    /// Range records are reused once no reader can see them.
+    RecordHeap _records;
+    SpinLockType _lock;
+    std::atomic<Node *> * _root;
+    std::atomic<HugeArray *> _huge;
+    size_t _size;
+    std::atomic<size_t> _epoch;
+    ReaderCount _readers[ReaderShards];
+  };
+
+}
+
+#endif
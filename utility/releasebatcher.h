@@ -0,0 +1,262 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_RELEASEBATCHER_H
+#define HL_RELEASEBATCHER_H
+
+/**
+ * @class ReleaseBatcher
+ * @brief Collects ranges to return to the OS and releases them in as few system calls as possible.
+ *
+ * Layers that purge free memory tend to do it one span or page run
+ * at a time, and each madvise is a system call (and, for a
+ * multi-threaded process, a TLB shootdown). Add every candidate range
+ * with add(), then call flush(): the ranges are sorted, adjacent and
+ * overlapping ones are merged, and each merged run is advised once.
+ * Where the kernel supports process_madvise on the calling process
+ * (Linux 5.10+; any advice since 6.13), all the runs of a batch are
+ * submitted in a single vectored call.
+ *
+ * A full batcher flushes itself. Memory added must not be reused
+ * until the next flush(), so layers should flush before releasing
+ * their lock.
+ *
+ * @param Capacity The number of ranges held before an automatic flush.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "wrappers/mmapwrapper.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+// These numbers are shared by all architectures.
+#if !defined(SYS_pidfd_open)
+#define SYS_pidfd_open 434
+#endif
+#if !defined(SYS_process_madvise)
+#define SYS_process_madvise 440
+#endif
+#endif
+
+namespace HL {
+
+  template <int Capacity = 256>
+  class ReleaseBatcher {
+  public:
+
+#if defined(__linux__)
+    ReleaseBatcher (int advice = MADV_DONTNEED)
+#else
+    ReleaseBatcher (int advice = 0)
+#endif
+      : _advice (advice),
+	_count (0),
+	_ranges (0),
+	_bytes (0),
+	_syscalls (0)
+    {}
+
+    ~ReleaseBatcher() {
+      flush();
+    }
+
+    /// Queue a range for release; flushes when the batch is full.
+    inline void add (void * ptr, size_t sz) {
+      if (sz == 0) {
+	return;
+      }
+      if (_count == Capacity) {
+	flush();
+      }
+      _batch[_count].start = (char *) ptr;
+      _batch[_count].end = (char *) ptr + sz;
+      _count++;
+      _ranges++;
+    }
+
+    /// Release every queued range; returns the number of bytes released.
+    size_t flush() {
+      if (_count == 0) {
+	return 0;
+      }
+      std::sort (_batch, _batch + _count, byStart);
+      // Merge adjacent and overlapping ranges in place.
+      int runs = 0;
+      for (int i = 1; i < _count; i++) {
+	if (_batch[i].start <= _batch[runs].end) {
+	  if (_batch[i].end > _batch[runs].end) {
+	    _batch[runs].end = _batch[i].end;
+	  }
+	} else {
+	  _batch[++runs] = _batch[i];
+	}
+      }
+      runs++;
+      size_t bytes = 0;
+      for (int i = 0; i < runs; i++) {
+	bytes += _batch[i].end - _batch[i].start;
+      }
+      releaseRuns (runs);
+      _bytes += bytes;
+      _count = 0;
+      return bytes;
+    }
+
+    /// Ranges added since construction.
+    size_t getRanges() const { return _ranges; }
+
+    /// Bytes released since construction.
+    size_t getBytes() const { return _bytes; }
+
+    /// System calls issued since construction.
+    size_t getSyscalls() const { return _syscalls; }
+
+    /// System calls avoided by merging and vectoring (one per range otherwise).
+    size_t getSyscallsSaved() const {
+      return (_ranges >= _syscalls) ? (_ranges - _syscalls) : 0;
+    }
+
+  private:
+
+    class Range {
+    public:
+      char * start;
+      char * end;
+    };
+
+    static bool byStart (const Range& a, const Range& b) {
+      return a.start < b.start;
+    }
+
+    void adviseRun (const Range& r) {
+      _syscalls++;
+#if defined(__linux__)
+      madvise (r.start, r.end - r.start, _advice);
+#else
+      _mmap.release (r.start, r.end - r.start);
+#endif
+    }
+
+#if defined(__linux__)
+
+    enum { MaxVector = 1024 };
+
+    /// A pidfd for this process, or -1 if process_madvise is unusable.
+    static int selfPidfd() {
+      static std::atomic<int> fd (-2);
+      static std::atomic<pid_t> owner (0);
+      // A child inherits the parent's pidfd, which names the parent.
+      const pid_t pid = getpid();
+      int f = fd.load();
+      if ((f == -2) || ((f >= 0) && (owner.load() != pid))) {
+	f = (int) syscall (SYS_pidfd_open, pid, 0);
+	if (f < 0) {
+	  f = -1;
+	}
+	owner = pid;
+	fd = f;
+      }
+      return f;
+    }
+
+    static std::atomic<bool>& vectorUnsupported() {
+      static std::atomic<bool> unsupported (false);
+      return unsupported;
+    }
+
+    void releaseRuns (int runs) {
+      int i = 0;
+      if ((runs > 1) && !vectorUnsupported().load()) {
+	const int pidfd = selfPidfd();
+	while ((pidfd >= 0) && (i < runs)) {
+	  struct iovec iov[MaxVector];
+	  const int n = std::min (runs - i, (int) MaxVector);
+	  size_t total = 0;
+	  for (int k = 0; k < n; k++) {
+	    iov[k].iov_base = _batch[i + k].start;
+	    iov[k].iov_len = _batch[i + k].end - _batch[i + k].start;
+	    total += iov[k].iov_len;
+	  }
+	  const long advised = syscall (SYS_process_madvise, pidfd, iov, (size_t) n, _advice, 0U);
+	  _syscalls++;
+	  if (advised < 0) {
+	    if ((errno == ENOSYS) || (errno == EINVAL) || (errno == EPERM) || (errno == EBADF)) {
+	      // Old kernel, or advice not supported: don't try again.
+	      vectorUnsupported() = true;
+	    }
+	    break;
+	  }
+	  if ((size_t) advised < total) {
+	    // Partial: skip the runs that were advised, and finish one by one.
+	    size_t done = advised;
+	    while (done >= (size_t) (_batch[i].end - _batch[i].start)) {
+	      done -= _batch[i].end - _batch[i].start;
+	      i++;
+	    }
+	    _batch[i].start += done;
+	    break;
+	  }
+	  i += n;
+	}
+      }
+      for (; i < runs; i++) {
+	adviseRun (_batch[i]);
+      }
+    }
+
+#else
+
+    void releaseRuns (int runs) {
+      for (int i = 0; i < runs; i++) {
+	adviseRun (_batch[i]);
+      }
+    }
+
+    MmapWrapper _mmap;
+
+#endif
+
+    int _advice;
+    int _count;
+    Range _batch[Capacity];
+    size_t _ranges;
+    size_t _bytes;
+    size_t _syscalls;
+  };
+
+}
+
+#endif
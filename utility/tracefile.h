@@ -0,0 +1,141 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_TRACEFILE_H
+#define HL_TRACEFILE_H
+
+/**
+ * @class TraceReader
+ * @brief Reads back the allocation traces written by TraceHeap and LogHeap.
+ *
+ * Both formats are accepted, line by line:
+ *
+ * @code
+ *  M 0	24	0x602010        (TraceHeap: heap number, size, address)
+ *  F 0	0x602010
+ *  M	24	0x602010        (LogHeap: size, address)
+ *  F	0x602010
+ * @endcode
+ *
+ * Memory access samples, if recorded, use the layout of a malloc
+ * line with an "A" tag (the size is the width of the access):
+ *
+ * @code
+ *  A 0	8	0x602018
+ * @endcode
+ *
+ * Lines that are none of these are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace HL {
+
+  class TraceEvent {
+  public:
+    enum { MALLOC, FREE, ACCESS };
+    int op;
+    size_t size;
+    unsigned long address;
+  };
+
+  class TraceReader {
+  public:
+
+    TraceReader (const char * fname)
+      : _file (fopen (fname, "r")),
+	_line (0)
+    {}
+
+    ~TraceReader() {
+      if (_file != NULL) {
+	fclose (_file);
+      }
+    }
+
+    bool is_open() const {
+      return (_file != NULL);
+    }
+
+    /// The number of the last line read (for error messages).
+    unsigned long line() const {
+      return _line;
+    }
+
+    /// Read the next event; returns false at the end of the trace.
+    bool next (TraceEvent& e) {
+      char buf[256];
+      while (_file && fgets (buf, sizeof(buf), _file)) {
+	_line++;
+	if (parse (buf, e)) {
+	  return true;
+	}
+      }
+      return false;
+    }
+
+  private:
+
+    TraceReader (const TraceReader&);
+    TraceReader& operator=(const TraceReader&);
+
+    static bool parse (char * buf, TraceEvent& e) {
+      char * fields[4];
+      int n = 0;
+      for (char * tok = strtok (buf, " \t\r\n");
+	   (tok != NULL) && (n < 4);
+	   tok = strtok (NULL, " \t\r\n")) {
+	fields[n++] = tok;
+      }
+      if (n < 2) {
+	return false;
+      }
+      // The address is always the last field, the size (if any) the one before it.
+      const bool isMalloc = (strcmp (fields[0], "M") == 0);
+      if ((isMalloc || strcmp (fields[0], "A") == 0) && n >= 3) {
+	e.op = isMalloc ? TraceEvent::MALLOC : TraceEvent::ACCESS;
+	e.size = strtoul (fields[n-2], NULL, 10);
+	e.address = strtoul (fields[n-1], NULL, 16);
+	return true;
+      }
+      if (strcmp (fields[0], "F") == 0) {
+	e.op = TraceEvent::FREE;
+	e.size = 0;
+	e.address = strtoul (fields[n-1], NULL, 16);
+	return true;
+      }
+      return false;
+    }
+
+    FILE * _file;
+    unsigned long _line;
+  };
+
+}
+
+#endif
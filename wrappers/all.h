@@ -1,4 +1,5 @@
 #include "ansiwrapper.h"
 #include "macinterpose.h"
 #include "mmapwrapper.h"
+#include "nodepoolallocator.h"
 #include "stlallocator.h"
@@ -6,8 +6,12 @@
 #include <assert.h>
 #include <string.h>
 
+#include <type_traits>
+
 #include "utility/gcd.h"
+#include "utility/heaptraits.h"
 #include "utility/istrue.h"
+#include "utility/mallocnear.h"
 #include "utility/sassert.h"
 #include "mallocinfo.h"
 
@@ -18,6 +22,10 @@
  *
  * Implements all prescribed ANSI behavior, including zero-sized
  * requests & aligned request sizes to a double word (or long word).
+ *
+ * Uses the superheap's capabilities (see HeapTraits) where it has
+ * them: calloc skips clearing memory that is known to be zero, and
+ * realloc resizes in place with tryResize and frees by size.
  */
 
 namespace HL {
@@ -32,28 +40,23 @@ namespace HL {
     }
 
     inline void * malloc (size_t sz) {
-      // Prevent integer underflows. This maximum should (and
-      // currently does) provide more than enough slack to compensate for any
-      // rounding below (in the alignment section).
-      if (sz > HL::MallocInfo::MaxSize) {
+      if (!normalize (sz)) {
 	return 0;
       }
-      if (sz < HL::MallocInfo::MinSize) {
-      	sz = HL::MallocInfo::MinSize;
-      }
-      // Enforce alignment requirements: round up allocation sizes if needed.
-      // NOTE: Alignment needs to be a power of two.
-      sassert<(HL::MallocInfo::Alignment & (HL::MallocInfo::Alignment - 1)) == 0> powTwo;
-      powTwo = powTwo;
-
-      // Enforce alignment.
-      sz = (sz + HL::MallocInfo::Alignment - 1UL) &
-	~(HL::MallocInfo::Alignment - 1UL);
-
       auto * ptr = SuperHeap::malloc (sz);
       assert ((size_t) ptr % HL::MallocInfo::Alignment == 0);
       return ptr;
     }
+
+    /// Allocate, preferring memory on the same page as hint.
+    inline void * mallocNear (size_t sz, const void * hint) {
+      if (!normalize (sz)) {
+	return 0;
+      }
+      auto * ptr = MallocNear::allocate (static_cast<SuperHeap&>(*this), sz, hint);
+      assert ((size_t) ptr % HL::MallocInfo::Alignment == 0);
+      return ptr;
+    }
  
     inline void free (void * ptr) {
       if (ptr != 0) {
@@ -63,7 +66,7 @@ namespace HL {
 
     inline void * calloc (size_t s1, size_t s2) {
       auto * ptr = (char *) malloc (s1 * s2);
-      if (ptr) {
+      if (ptr && !HeapTraits<SuperHeap>::ZeroMemory) {
       	memset (ptr, 0, s1 * s2);
       }
       return (void *) ptr;
@@ -83,6 +86,12 @@ namespace HL {
     	return ptr;
       }
 
+      size_t newSize = sz;
+      if (normalize (newSize) &&
+	  resizeInPlace (ptr, newSize, std::integral_constant<bool, HeapTraits<SuperHeap>::HasTryResize>())) {
+	return ptr;
+      }
+
       // Allocate a new block of size sz.
       auto * buf = malloc (sz);
 
@@ -95,7 +104,9 @@ namespace HL {
       }
 
       // Free the old block.
-      free (ptr);
+      if (buf) {
+	freeSized (ptr, objSize, std::integral_constant<bool, HeapTraits<SuperHeap>::HasSizedFree>());
+      }
       return buf;
     }
   
@@ -106,6 +117,46 @@ namespace HL {
 	return 0;
       }
     }
+
+  private:
+
+    inline bool resizeInPlace (void * ptr, size_t sz, std::true_type) {
+      return SuperHeap::tryResize (ptr, sz);
+    }
+
+    inline bool resizeInPlace (void *, size_t, std::false_type) {
+      return false;
+    }
+
+    inline void freeSized (void * ptr, size_t sz, std::true_type) {
+      SuperHeap::free (ptr, sz);
+    }
+
+    inline void freeSized (void * ptr, size_t, std::false_type) {
+      SuperHeap::free (ptr);
+    }
+
+    /// Round a request up to a legal size; false if it is too large.
+    static inline bool normalize (size_t& sz) {
+      // Prevent integer underflows. This maximum should (and
+      // currently does) provide more than enough slack to compensate for any
+      // rounding below (in the alignment section).
+      if (sz > HL::MallocInfo::MaxSize) {
+	return false;
+      }
+      if (sz < HL::MallocInfo::MinSize) {
+      	sz = HL::MallocInfo::MinSize;
+      }
+      // Enforce alignment requirements: round up allocation sizes if needed.
+      // NOTE: Alignment needs to be a power of two.
+      sassert<(HL::MallocInfo::Alignment & (HL::MallocInfo::Alignment - 1)) == 0> powTwo;
+      powTwo = powTwo;
+
+      // Enforce alignment.
+      sz = (sz + HL::MallocInfo::Alignment - 1UL) &
+	~(HL::MallocInfo::Alignment - 1UL);
+      return true;
+    }
   };
 
 }
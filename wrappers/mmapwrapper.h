@@ -123,6 +123,16 @@ namespace HL {
       VirtualFree (ptr, 0, MEM_RELEASE);
     }
 
+    /// Reserve address space without committing memory to it.
+    static void * reserve (size_t sz) {
+      return VirtualAlloc (NULL, sz, MEM_RESERVE, PAGE_NOACCESS);
+    }
+
+    /// Commit part of a reserved range (it reads as zero).
+    static bool commit (void * ptr, size_t sz) {
+      return VirtualAlloc (ptr, sz, MEM_COMMIT, PAGE_READWRITE) != NULL;
+    }
+
 #else // UNIX
 
     static void protect (void * ptr, size_t sz) {
@@ -172,6 +182,42 @@ namespace HL {
       sz = Size * ((sz + Size - 1) / Size);
       munmap ((caddr_t) ptr, sz);
     }
+
+    /// Reserve address space without committing memory to it.
+    static void * reserve (size_t sz) {
+      sz = Size * ((sz + Size - 1) / Size);
+#if defined(MAP_NORESERVE)
+      const int reserveFlag = MAP_NORESERVE;
+#else
+      const int reserveFlag = 0;
+#endif
+      void * ptr = mmap (NULL, sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | reserveFlag, -1, 0);
+      if (ptr == MAP_FAILED) {
+	return NULL;
+      }
+      return ptr;
+    }
+
+    /// Commit part of a reserved range (it reads as zero).
+    static bool commit (void * ptr, size_t sz) {
+      return mprotect ((char *) ptr, sz, PROT_READ | PROT_WRITE) == 0;
+    }
+
+    /// Make a range read-only (writes fault until it is unprotected or remapped).
+    static void writeProtect (void * ptr, size_t sz) {
+      mprotect ((char *) ptr, sz, PROT_READ);
+    }
+
+    /// Map part of a file (such as a memfd) shared, replacing any
+    /// mapping at the given address if there is one.
+    static void * mapShared (int fd, size_t sz, off_t offset, void * at = NULL) {
+      const int flags = MAP_SHARED | ((at != NULL) ? MAP_FIXED : 0);
+      void * ptr = mmap (at, sz, HL_MMAP_PROTECTION_MASK, flags, fd, offset);
+      if (ptr == MAP_FAILED) {
+	return NULL;
+      }
+      return ptr;
+    }
    
 #endif
 
@@ -0,0 +1,286 @@
+// -*- C++ -*-
+
+/*
+
+  Heap Layers: An Extensible Memory Allocation Infrastructure
+  
+  Copyright (C) 2000-2015 by Emery Berger
+  http://www.emeryberger.com
+  emery@cs.umass.edu
+  
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef HL_NODEPOOLALLOCATOR_H
+#define HL_NODEPOOLALLOCATOR_H
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#include "heaps/threads/lockedheap.h"
+#include "locks/spinlock.h"
+#include "utility/guard.h"
+#include "utility/sassert.h"
+#include "utility/singleton.h"
+
+namespace HL {
+
+  /**
+   * @class NodePool
+   * @brief A process-wide pool of NodeSize-byte nodes with per-thread free lists.
+   *
+   * Nodes are carved from SlabBytes slabs obtained from SuperHeap and
+   * are never returned to it. Each thread allocates from and frees to
+   * its own list, exchanging BatchSize nodes at a time with the shared
+   * list when its list runs dry or grows past twice that.
+   */
+
+  template <size_t NodeSize,
+	    class SuperHeap,
+	    size_t SlabBytes = 64 * 1024>
+  class NodePool {
+  public:
+
+    enum { BatchSize = 64 };
+
+    NodePool()
+      : _freeList (NULL),
+	_bump (NULL),
+	_end (NULL)
+    {
+      sassert<(NodeSize >= sizeof(void *))> verifyHoldsLink;
+      sassert<(SlabBytes >= NodeSize)> verifySlabHoldsNode;
+      verifyHoldsLink = verifyHoldsLink;
+      verifySlabHoldsNode = verifySlabHoldsNode;
+    }
+
+    static NodePool& getInstance() {
+      return singleton<NodePool>::getInstance();
+    }
+
+    inline void * malloc() {
+      ThreadCache& tc = threadCache();
+      if (tc.head == NULL) {
+	refill (tc);
+	if (tc.head == NULL) {
+	  return NULL;
+	}
+      }
+      Node * n = tc.head;
+      tc.head = n->next;
+      tc.count--;
+      return n;
+    }
+
+    inline void free (void * ptr) {
+      ThreadCache& tc = threadCache();
+      Node * n = (Node *) ptr;
+      n->next = tc.head;
+      tc.head = n;
+      if (++tc.count > 2 * BatchSize) {
+	spill (tc, BatchSize);
+      }
+    }
+
+  private:
+
+    class Node {
+    public:
+      Node * next;
+    };
+
+    class ThreadCache {
+    public:
+      ThreadCache()
+	: head (NULL),
+	  count (0)
+      {}
+      ~ThreadCache() {
+	if (count > 0) {
+	  getInstance().spill (*this, count);
+	}
+      }
+      Node * head;
+      size_t count;
+    };
+
+    static ThreadCache& threadCache() {
+      static thread_local ThreadCache tc;
+      return tc;
+    }
+
+    /// Move up to BatchSize nodes to the thread's list, from the
+    /// shared list or else from the current slab.
+    void refill (ThreadCache& tc) {
+      Guard<SpinLockType> l (_lock);
+      while ((tc.count < BatchSize) && (_freeList != NULL)) {
+	Node * n = _freeList;
+	_freeList = n->next;
+	n->next = tc.head;
+	tc.head = n;
+	tc.count++;
+      }
+      while (tc.count < BatchSize) {
+	if (_bump + NodeSize > _end) {
+	  _bump = (char *) _slabs.malloc (SlabBytes);
+	  if (_bump == NULL) {
+	    _end = NULL;
+	    return;
+	  }
+	  _end = _bump + SlabBytes;
+	}
+	Node * n = (Node *) _bump;
+	_bump += NodeSize;
+	n->next = tc.head;
+	tc.head = n;
+	tc.count++;
+      }
+    }
+
+    /// Move n nodes from the thread's list to the shared list.
+    void spill (ThreadCache& tc, size_t n) {
+      Node * first = tc.head;
+      Node * last = first;
+      for (size_t i = 1; i < n; i++) {
+	last = last->next;
+      }
+      tc.head = last->next;
+      tc.count -= n;
+      Guard<SpinLockType> l (_lock);
+      last->next = _freeList;
+      _freeList = first;
+    }
+
+    SpinLockType _lock;
+    Node * _freeList;
+    SuperHeap _slabs;
+    char * _bump;
+    char * _end;
+  };
+
+
+  /**
+   * @class NodePoolAllocator
+   * @brief An STL allocator that serves single-node allocations from per-size node pools.
+   *
+   * Node-based containers (std::map, std::set, std::list,
+   * std::unordered_map) allocate one node at a time. Rebound to each
+   * node type, this allocator serves those from the NodePool for the
+   * node's size (rounded up to its alignment), so containers whose
+   * nodes are the same size share a pool. Because deallocate is told
+   * the count, no per-object header or size lookup is needed. Arrays
+   * (such as hash buckets) go to one shared, locked SuperHeap.
+   *
+   * The allocator is stateless and has no virtual members, so it adds
+   * nothing to the size of a container, and all instances compare equal.
+   *
+   * Example:
+   * <TT>
+   *   typedef NodePoolAllocator<std::pair<const int, int>, MmapHeap> A;<BR>
+   *   std::map<int, int, std::less<int>, A> m;<BR>
+   * </TT>
+   *
+   * @param T The allocated type.
+   * @param SuperHeap The heap for slabs and arrays (aligned for T).
+   */
+
+  template <class T, class SuperHeap>
+  class NodePoolAllocator {
+  public:
+
+    typedef T value_type;
+    typedef T * pointer;
+    typedef const T * const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::false_type propagate_on_container_swap;
+    typedef std::true_type is_always_equal;
+
+    template <class U>
+    struct rebind {
+      typedef NodePoolAllocator<U, SuperHeap> other;
+    };
+
+    NodePoolAllocator() throw() {}
+
+    template <class U>
+    NodePoolAllocator (const NodePoolAllocator<U, SuperHeap>&) throw() {}
+
+    inline T * allocate (size_type n) {
+      sassert<((int) SuperHeap::Alignment % alignof(T) == 0)> verifyAlignment;
+      verifyAlignment = verifyAlignment;
+      void * ptr;
+      if (n == 1) {
+	ptr = Pool::getInstance().malloc();
+      } else {
+	if (n > max_size()) {
+	  throw std::bad_alloc();
+	}
+	ptr = arrayHeap().malloc (n * sizeof(T));
+      }
+      if (ptr == NULL) {
+	throw std::bad_alloc();
+      }
+      return (T *) ptr;
+    }
+
+    inline void deallocate (T * ptr, size_type n) {
+      if (n == 1) {
+	Pool::getInstance().free (ptr);
+      } else {
+	arrayHeap().free (ptr);
+      }
+    }
+
+    size_type max_size() const {
+      return std::numeric_limits<std::size_t>::max() / sizeof(T);
+    }
+
+  private:
+
+    /// The node size: at least a pointer, rounded up to T's alignment.
+    enum { NodeAlignment = (alignof(T) > sizeof(void *)) ? alignof(T) : sizeof(void *) };
+    enum { NodeSize = (sizeof(T) + NodeAlignment - 1) & ~(NodeAlignment - 1) };
+
+    typedef NodePool<NodeSize, SuperHeap> Pool;
+
+    class ArrayHeap : public LockedHeap<SpinLockType, SuperHeap> {};
+
+    static ArrayHeap& arrayHeap() {
+      return singleton<ArrayHeap>::getInstance();
+    }
+  };
+
+  template <class T, class U, class S>
+  inline bool operator== (const NodePoolAllocator<T, S>&, const NodePoolAllocator<U, S>&) {
+    return true;
+  }
+
+  template <class T, class U, class S>
+  inline bool operator!= (const NodePoolAllocator<T, S>&, const NodePoolAllocator<U, S>&) {
+    return false;
+  }
+
+}
+
+#endif
@@ -34,6 +34,8 @@
 
 #include <memory> // STL
 
+#include "utility/mallocnear.h"
+
 // Somewhere someone is defining a max macro (on Windows),
 // and this is a problem -- solved by undefining it.
 
@@ -55,6 +57,10 @@ using namespace std;
  *   typedef STLAllocator<int, MyHeapType> MyAllocator;<BR>
  *   list<int, MyAllocator> l;<BR>
  * </TT>
+ *
+ * A hint passed to allocate (e.g., through
+ * std::allocator_traits<A>::allocate (a, n, hint)) places the new
+ * object near the hinted one if the heap supports mallocNear.
  */
 
 namespace HL {
@@ -117,8 +123,11 @@ public:
   }
 #else
   inline pointer allocate (size_type n,
-			  const void * = 0) {
+			  const void * hint = 0) {
     if (n) {
+      if (hint) {
+	return reinterpret_cast<pointer>(MallocNear::allocate (static_cast<Super&>(*this), sizeof(T) * n, hint));
+      }
       return reinterpret_cast<pointer>(Super::malloc (sizeof(T) * n));
     } else {
       return 0;
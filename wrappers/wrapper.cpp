@@ -35,6 +35,8 @@
 #include <stdint.h>
 #include <new>
 
+#include "utility/heapregistry.h"
+
 
 extern "C" {
 
@@ -348,9 +350,15 @@ extern "C" int  CUSTOM_MALLOPT (int /* param */, int /* value */) {
   return 1; // success.
 }
 
+/// Trim every heap registered with the HeapRegistry; returns the bytes known to be released.
+extern "C" size_t hl_release_free_memory (void) {
+  return HL::HeapRegistry::releaseFreeMemory();
+}
+
 extern "C" int CUSTOM_MALLOC_TRIM(size_t /* pad */) {
-  // NOP.
-  return 0; // no memory returned to OS.
+  // Trim registered caches; we can't always tell whether memory
+  // went back to the OS, so report success only when we know.
+  return (hl_release_free_memory() > 0);
 }
 
 extern "C" void CUSTOM_MALLOC_STATS(void) {